@@ -0,0 +1,93 @@
+#!/bin/bash
+# bench.sh - Time bytecheck and record its peak memory across file sizes
+#
+# Usage: ./bench.sh [largest size in MiB] [scratch directory]
+#
+# Files from 1 KiB up to the largest size (10 GiB by default) are scanned for
+# a single byte and for the full histogram. Throughput should climb to the
+# disk or page cache rate while the peak resident size stays flat, since the
+# file is read through one fixed buffer however large it is. Then one large
+# file and a directory of small ones are counted with 1 to 16 threads, which
+# should scale with the cores in both cases. Last, a multi-byte pattern is
+# counted in text next to grep -c (which counts matching lines, so the
+# numbers differ, but both have to read and search every byte).
+
+MAX_MB=${1:-10240}
+DIR=${2:-.}
+INPUT="$DIR/bench-input.bin"
+
+if [ ! -x ./bytecheck ]; then
+    echo "bench.sh: build bytecheck first (make)" >&2
+    exit 1
+fi
+
+# run a command and print its wall time, throughput and peak RSS
+measure() {
+    local label=$1
+    local bytes=$2
+    shift 2
+    local start=$(date +%s.%N)
+    local rss
+    if [ -x /usr/bin/time ]; then
+        rss=$( { /usr/bin/time -f "%M" "$@" > /dev/null; } 2>&1 | tail -n 1)
+    else
+        # posix_spawn keeps python's own pages out of the child's peak
+        rss=$(python3 -c 'import os, sys
+devnull = os.open(os.devnull, os.O_WRONLY)
+pid = os.posix_spawnp(sys.argv[1], sys.argv[1:], os.environ, file_actions=[(os.POSIX_SPAWN_DUP2, devnull, 1)])
+pid, status, usage = os.wait4(pid, 0)
+print(usage.ru_maxrss)' "$@")
+    fi
+    local end=$(date +%s.%N)
+    awk -v label="$label" -v bytes="$bytes" -v start="$start" -v end="$end" -v rss="$rss" \
+        'BEGIN { printf "%-28s %9.3f s %10.1f MiB/s %8d KiB peak\n", label, end - start, bytes / 1048576 / (end - start), rss }'
+}
+
+for SIZE in 1K 64K 1M 16M 256M 1G 10G; do
+    BYTES=$(numfmt --from=iec "$SIZE")
+    if [ "$BYTES" -gt $((MAX_MB * 1048576)) ]; then
+        break
+    fi
+
+    echo "Creating $SIZE input file..."
+    head -c "$BYTES" /dev/urandom > "$INPUT"
+    cat "$INPUT" > /dev/null
+
+    measure "bytecheck $SIZE 0x42" "$BYTES" ./bytecheck "$INPUT" 0x42
+    measure "bytecheck $SIZE -histogram" "$BYTES" ./bytecheck "$INPUT" -histogram
+done
+
+# one big file split between the threads
+SCALE_MB=$((MAX_MB < 1024 ? MAX_MB : 1024))
+echo "Creating $SCALE_MB MiB input file..."
+head -c $((SCALE_MB * 1048576)) /dev/urandom > "$INPUT"
+cat "$INPUT" > /dev/null
+for THREADS in 1 2 4 8 16; do
+    measure "one file, $THREADS threads" $((SCALE_MB * 1048576)) ./bytecheck -threads $THREADS "$INPUT" 0x42 0x0d0a
+done
+rm -f "$INPUT"
+
+# many small files handed out to the threads whole
+FILES="$DIR/bench-files"
+mkdir -p "$FILES"
+echo "Creating 256 files of $((SCALE_MB * 4)) KiB..."
+for i in $(seq 256); do
+    head -c $((SCALE_MB * 4096)) /dev/urandom > "$FILES/$i.bin"
+done
+cat "$FILES"/*.bin > /dev/null
+for THREADS in 1 2 4 8 16; do
+    measure "256 files, $THREADS threads" $((SCALE_MB * 1048576)) ./bytecheck -threads $THREADS "$FILES"/*.bin 0x42 0x0d0a
+done
+rm -rf "$FILES"
+
+# a multi-byte pattern in text, against grep
+echo "Creating $SCALE_MB MiB text file..."
+head -c $((SCALE_MB * 786432)) /dev/urandom | base64 > "$INPUT"
+cat "$INPUT" > /dev/null
+BYTES=$(stat -c %s "$INPUT")
+NEEDLE=Zm9v
+HEX=0x$(printf '%s' "$NEEDLE" | od -An -tx1 | tr -d ' \n')
+measure "bytecheck $NEEDLE, 1 thread" "$BYTES" ./bytecheck -threads 1 "$INPUT" "$HEX"
+measure "bytecheck $NEEDLE, all threads" "$BYTES" ./bytecheck "$INPUT" "$HEX"
+measure "grep -c -F $NEEDLE" "$BYTES" env LC_ALL=C grep -c -F "$NEEDLE" "$INPUT"
+rm -f "$INPUT"
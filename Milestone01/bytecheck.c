@@ -2,40 +2,43 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 
+#include "bytecheck.h"
+
+void print_usage() {
+    fprintf(stderr, "Usage: bytecheck [-threads N] [-offsets] <file>... <0x##...>... [-histogram]\n");
+}
+
 void check_num_args(int argc) {
-    // there should be three arguments: the program name, the filename, and the lookup byte
-    if (argc != 3) {
+    // there should be at least the program name, a filename, and a lookup pattern (or -histogram)
+    if (argc < 3) {
         fprintf(stderr, "Error: Incorrect number of inputs!\n");
+        print_usage();
         exit(1);
     }
 }
 
-void check_hex(char* hex) {
-    // the lookup hex byte should be in the form '0x##'
-    if (hex[0] != '0' || hex[1] != 'x') {
-        fprintf(stderr, "Error: Invalid lookup byte!\n");
+void check_pattern(struct Pattern* pPattern, char* text) {
+    // the lookup pattern should be '0x' followed by hex digits, one byte or several (0x0d0a)
+    if (pattern_parse(pPattern, text) != 0) {
+        fprintf(stderr, "Error: Invalid lookup byte %s!\n", text);
         exit(1);
     }
 }
 
-void check_lookup_byte(long int lookup_byte, char* end) {
-    // the lookup byte should be a valid hex digit
-    if (*end != '\0') {
-        fprintf(stderr, "Error: Invalid lookup byte!\n");
-        exit(1);
-    }
-    // the lookup byte should be less than 0x99
-    if (lookup_byte > 0x99) {
-        fprintf(stderr, "Error: Hex value too large!\n");
+void check_threads(int nThreads) {
+    if (nThreads < 1 || nThreads > MAX_THREADS) {
+        fprintf(stderr, "Error: Thread count must be between 1 and %d\n", MAX_THREADS);
         exit(1);
     }
 }
 
 struct stat check_file_stats(char* filename) {
     struct stat sb;
-    // the file should exist, be a regular file, and be less than 25kB
+    // the file should exist and be a regular file (any size, it is read a chunk at a time)
     if (stat(filename, &sb) != 0) {
         fprintf(stderr, "Error: File does not exist!\n");
         exit(1);
@@ -45,11 +48,6 @@ struct stat check_file_stats(char* filename) {
         exit(1);
     }
 
-    if (sb.st_size > 25000) {
-        fprintf(stderr, "Error: The file is over 25kB (file size was %lld bytes)\n", (long long) sb.st_size);
-        exit(1);
-    }
-
     return sb;
 }
 
@@ -61,47 +59,152 @@ void check_readability(char* filename) {
     }
 }
 
-void check_size(struct stat sb, int result) {
-    // if read correctly, the number of bytes read should equal the file size
-    if (result != sb.st_size) {
-        fprintf(stderr, "Error: Reading error");
+int default_threads() {
+    // one thread per online core, within what the scanner supports
+    long nCores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nCores < 1) {
+        return 1;
     }
+    return nCores < MAX_THREADS ? nCores : MAX_THREADS;
 }
 
-void count_lookup_byte(char* buffer, struct stat sb, long int lookup_byte) {
-    // iterate through all the bytes in the buffer and count the number of itmes the lookup byte appears
-    int i, count = 0;
-    for (i = 0; i < sb.st_size; i++) {
-        if (buffer[i] == lookup_byte) {
-            count++;
+void print_counts(struct ScanJob* pJob) {
+    int i, j;
+
+    // a single file and a single byte keeps the original output: just the count
+    if (pJob->nFiles == 1 && pJob->nPatterns == 1 && !pJob->bHistogram && !pJob->bOffsets) {
+        printf("%llu\n", (unsigned long long) pJob->counts[0]);
+        return;
+    }
+
+    for (i = 0; i < pJob->nFiles; i++) {
+        for (j = 0; j < pJob->nPatterns; j++) {
+            printf("%s %s %llu\n", pJob->filenames[i], pJob->patterns[j].text,
+                   (unsigned long long) pJob->counts[i * pJob->nPatterns + j]);
+        }
+    }
+    if (pJob->nFiles > 1) {
+        for (j = 0; j < pJob->nPatterns; j++) {
+            uint64_t total = 0;
+            for (i = 0; i < pJob->nFiles; i++) {
+                total += pJob->counts[i * pJob->nPatterns + j];
+            }
+            printf("total %s %llu\n", pJob->patterns[j].text, (unsigned long long) total);
+        }
+    }
+}
+
+void print_offsets(struct ScanJob* pJob) {
+    // every match as <file>:<offset> <pattern>, in file order
+    int i, j;
+    size_t k;
+    for (i = 0; i < pJob->nFiles; i++) {
+        for (j = 0; j < pJob->nPatterns; j++) {
+            struct MatchList* pMatches = &pJob->matches[i * pJob->nPatterns + j];
+            for (k = 0; k < pMatches->count; k++) {
+                printf("%s:%lld %s\n", pJob->filenames[i], (long long) pMatches->offsets[k], pJob->patterns[j].text);
+            }
         }
     }
-    printf("%d\n", count);
+}
+
+void print_histogram(struct ScanJob* pJob) {
+    // one line per byte value, counted over every file
+    int value;
+    for (value = 0; value < 256; value++) {
+        printf("0x%02x %llu\n", value, (unsigned long long) pJob->histogram[value]);
+    }
 }
 
 int main(int argc, char* argv[]) {
 
-    char* filename;
-    char* end;
-    long int lookup_byte;
+    struct ScanJob theJob;
+    int nThreads = default_threads();
+    int i;
 
-    // Check the user inputter the correct number of arguments, a valid hex digit as a lookup byte, and a valid file
+    memset(&theJob, 0, sizeof(theJob));
+    theJob.filenames = (char**) malloc(argc * sizeof(char*));
+    theJob.fds = (int*) malloc(argc * sizeof(int));
+    theJob.sizes = (off_t*) malloc(argc * sizeof(off_t));
+    theJob.patterns = (struct Pattern*) malloc(argc * sizeof(struct Pattern));
+    if (theJob.filenames == NULL || theJob.fds == NULL || theJob.sizes == NULL || theJob.patterns == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+
+    // Check the user inputted enough arguments; anything starting with 0x is a lookup pattern, the rest are files
     check_num_args(argc);
-    check_hex(argv[2]);
-    lookup_byte = strtol(argv[2], &end, 16);
-    check_lookup_byte(lookup_byte, end);
-    filename = strdup(argv[1]);
-    struct stat sb = check_file_stats(filename);
-
-    // Check the file is readable and if so then open it, read it into a buffer, and check the file was read correctly
-    check_readability(filename);
-    FILE* fp = fopen(filename, "r");
-    char buffer[sb.st_size];
-    size_t result = fread(buffer, sizeof(char), sb.st_size, fp);
-    check_size(sb, result);
-
-    // Count the number of times the lookup byte appears in the file and print it
-    count_lookup_byte(buffer, sb, lookup_byte);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-histogram") == 0) {
+            theJob.bHistogram = 1;
+        } else if (strcmp(argv[i], "-offsets") == 0) {
+            theJob.bOffsets = 1;
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            if (i + 1 >= argc) {
+                print_usage();
+                exit(1);
+            }
+            nThreads = atoi(argv[++i]);
+            check_threads(nThreads);
+        } else if (argv[i][0] == '0' && (argv[i][1] == 'x' || argv[i][1] == 'X')) {
+            struct Pattern* pPattern = &theJob.patterns[theJob.nPatterns++];
+            check_pattern(pPattern, argv[i]);
+            if (pPattern->length > theJob.maxPatternLength) {
+                theJob.maxPatternLength = pPattern->length;
+            }
+        } else {
+            theJob.filenames[theJob.nFiles++] = argv[i];
+        }
+    }
+    if (theJob.nFiles == 0 || (theJob.nPatterns == 0 && !theJob.bHistogram)) {
+        fprintf(stderr, "Error: Incorrect number of inputs!\n");
+        print_usage();
+        exit(1);
+    }
+
+    // Check every file exists and is readable, and if so then open it
+    for (i = 0; i < theJob.nFiles; i++) {
+        struct stat sb = check_file_stats(theJob.filenames[i]);
+        check_readability(theJob.filenames[i]);
+        theJob.sizes[i] = sb.st_size;
+        theJob.fds[i] = open(theJob.filenames[i], O_RDONLY);
+        if (theJob.fds[i] < 0) {
+            fprintf(stderr, "Error: Unable to open %s! %s\n", theJob.filenames[i], strerror(errno));
+            exit(1);
+        }
+    }
 
+    // Count every pattern in every file (and every byte value) across the threads and print the results
+    theJob.counts = (uint64_t*) calloc((size_t) theJob.nFiles * theJob.nPatterns + 1, sizeof(uint64_t));
+    if (theJob.bOffsets) {
+        theJob.matches = (struct MatchList*) calloc((size_t) theJob.nFiles * theJob.nPatterns + 1, sizeof(struct MatchList));
+    }
+    int error = parallel_scan(&theJob, nThreads);
+    if (error != 0) {
+        fprintf(stderr, "Error: Reading error: %s\n", strerror(error));
+        exit(1);
+    }
+    print_counts(&theJob);
+    if (theJob.bOffsets) {
+        print_offsets(&theJob);
+    }
+    if (theJob.bHistogram) {
+        print_histogram(&theJob);
+    }
+
+    for (i = 0; i < theJob.nFiles; i++) {
+        close(theJob.fds[i]);
+    }
+    if (theJob.bOffsets) {
+        for (i = 0; i < theJob.nFiles * theJob.nPatterns; i++) {
+            match_list_free(&theJob.matches[i]);
+        }
+        free(theJob.matches);
+    }
+    free(theJob.counts);
+    free(theJob.patterns);
+    free(theJob.sizes);
+    free(theJob.fds);
+    free(theJob.filenames);
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,115 @@
+/* bytecheck.h : Shared definitions for the bytecheck counting kernels */
+
+#ifndef BYTECHECK_H
+#define BYTECHECK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Size of the buffer files are read through, whatever their length */
+#define SCAN_CHUNK_SIZE (1 << 20)
+
+/* Longest byte sequence that can be looked up, and where Two-Way takes over from the prefilter */
+#define MAX_PATTERN_LEN 4096
+#define TWO_WAY_MIN_LEN 64
+
+/* Files larger than this are split into pieces for the worker threads */
+#define MIN_SPLIT_SIZE  (8 << 20)
+#define MAX_THREADS     64
+
+/* A byte sequence to count, parsed from its 0x## form */
+struct Pattern {
+    char*           text;
+    unsigned char   bytes[MAX_PATTERN_LEN];
+    size_t          length;
+
+    /* Two-Way critical factorization, set up by search_prepare */
+    long            split;
+    long            period;
+    int             bPeriodic;
+};
+
+/* Growable list of match offsets, kept only when they are asked for */
+struct MatchList {
+    off_t*          offsets;
+    size_t          count;
+    size_t          capacity;
+};
+
+/* Matches of one pattern across consecutive chunks. The last length-1 bytes
+   seen are carried so a match split between two chunks is still found. */
+struct PatternState {
+    const struct Pattern*   pPattern;
+    unsigned char           carry[MAX_PATTERN_LEN];
+    size_t                  carryLength;
+    uint64_t                count;
+    struct MatchList*       pMatches;       /* NULL unless offsets are wanted */
+};
+
+/* Everything one bytecheck run looks for, and the merged results */
+struct ScanJob {
+    int                 nFiles;
+    char**              filenames;
+    int*                fds;
+    off_t*              sizes;
+
+    int                 nPatterns;
+    struct Pattern*     patterns;
+    size_t              maxPatternLength;
+    int                 bHistogram;
+    int                 bOffsets;
+
+    /* counts[nFile * nPatterns + nPattern] and the histogram over all files */
+    uint64_t*           counts;
+    uint64_t            histogram[256];
+
+    /* matches[nFile * nPatterns + nPattern] in file order, when bOffsets is set */
+    struct MatchList*   matches;
+};
+
+/* Called once per chunk read by scan_range; offset is the chunk's position in the file */
+typedef void (*ScanCallback)(const unsigned char* chunk, size_t length, off_t offset, void* pData);
+
+/* Function prototypes */
+
+/* count.c - byte counting kernels, dispatched to AVX2 when the CPU has it */
+uint64_t count_byte(const unsigned char* buffer, size_t length, unsigned char lookup_byte);
+uint64_t count_byte_scalar(const unsigned char* buffer, size_t length, unsigned char lookup_byte);
+int      count_byte_has_avx2();
+uint64_t count_byte_avx2(const unsigned char* buffer, size_t length, unsigned char lookup_byte);
+
+/* count.c - add the counts of every byte value in buffer to histogram */
+void histogram_update(uint64_t histogram[256], const unsigned char* buffer, size_t length);
+
+/* scan.c - read [start, end) of fd through one chunkSize buffer, 0 on success or -1 with errno set */
+int scan_range(int fd, off_t start, off_t end, size_t chunkSize, ScanCallback callback, void* pData);
+
+/* pattern.c - parse 0x## text and follow a pattern across consecutive chunks */
+int      pattern_parse(struct Pattern* pPattern, char* text);
+void     pattern_state_init(struct PatternState* pState, const struct Pattern* pPattern, struct MatchList* pMatches);
+void     pattern_state_feed(struct PatternState* pState, const unsigned char* chunk, size_t length, off_t offset, off_t limit);
+
+/* search.c - count (and record at base + position) the matches starting before maxStart that fit in length */
+uint64_t pattern_search(const struct Pattern* pPattern, const unsigned char* buffer, size_t length, size_t maxStart,
+                        off_t base, struct MatchList* pMatches);
+void     search_prepare(struct Pattern* pPattern);
+
+/* search.c - the engines behind pattern_search; maxStart must already leave room for a whole match */
+uint64_t search_scalar(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                       off_t base, struct MatchList* pMatches);
+int      search_has_avx2();
+uint64_t search_avx2(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                     off_t base, struct MatchList* pMatches);
+uint64_t search_two_way(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                        off_t base, struct MatchList* pMatches);
+
+/* search.c - match offset lists */
+void     match_list_add(struct MatchList* pList, off_t offset);
+void     match_list_append(struct MatchList* pList, const struct MatchList* pOther);
+void     match_list_free(struct MatchList* pList);
+
+/* parallel.c - split the files into ranges and count them on nThreads threads, 0 or an errno */
+int parallel_scan(struct ScanJob* pJob, int nThreads);
+
+#endif
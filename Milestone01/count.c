@@ -0,0 +1,130 @@
+/*
+count.c - Byte counting kernels for bytecheck
+
+count_byte compares 32 bytes at a time against the lookup byte with AVX2,
+turns each comparison into a 32-bit mask and popcounts it. The scalar loop is
+kept for CPUs without AVX2 and as the reference.
+
+histogram_update counts all 256 byte values in one pass. Incrementing a single
+table stalls whenever neighbouring bytes are equal (each increment has to wait
+for the store of the previous one), so bytes are spread round-robin over four
+sub-histograms and summed at the end.
+*/
+
+#include <string.h>
+
+#include "bytecheck.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#define NUM_SUB_HISTOGRAMS  4
+
+/* Largest block counted into 32-bit sub-histograms before they are flushed */
+#define HISTOGRAM_BLOCK     (1UL << 30)
+
+uint64_t count_byte_scalar(const unsigned char* buffer, size_t length, unsigned char lookup_byte) {
+    // iterate through all the bytes in the buffer and count the number of itmes the lookup byte appears
+    uint64_t count = 0;
+    size_t i;
+    for (i = 0; i < length; i++) {
+        if (buffer[i] == lookup_byte) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int count_byte_has_avx2() {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#else
+    return 0;
+#endif
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2,popcnt")))
+uint64_t count_byte_avx2(const unsigned char* buffer, size_t length, unsigned char lookup_byte) {
+    const __m256i needle = _mm256_set1_epi8((char) lookup_byte);
+    uint64_t count = 0;
+    size_t i = 0;
+
+    // four vectors per iteration keeps the compare and popcount ports busy
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i)), needle);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i + 32)), needle);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i + 64)), needle);
+        __m256i d = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i + 96)), needle);
+        uint64_t ab = (uint32_t) _mm256_movemask_epi8(a) | ((uint64_t) (uint32_t) _mm256_movemask_epi8(b) << 32);
+        uint64_t cd = (uint32_t) _mm256_movemask_epi8(c) | ((uint64_t) (uint32_t) _mm256_movemask_epi8(d) << 32);
+        count += _mm_popcnt_u64(ab) + _mm_popcnt_u64(cd);
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i)), needle);
+        count += _mm_popcnt_u32((uint32_t) _mm256_movemask_epi8(v));
+    }
+    return count + count_byte_scalar(buffer + i, length - i, lookup_byte);
+}
+#else
+uint64_t count_byte_avx2(const unsigned char* buffer, size_t length, unsigned char lookup_byte) {
+    return count_byte_scalar(buffer, length, lookup_byte);
+}
+#endif
+
+uint64_t count_byte(const unsigned char* buffer, size_t length, unsigned char lookup_byte) {
+    static int bHasAvx2 = -1;
+    if (bHasAvx2 < 0) {
+        bHasAvx2 = count_byte_has_avx2();
+    }
+    if (bHasAvx2) {
+        return count_byte_avx2(buffer, length, lookup_byte);
+    }
+    return count_byte_scalar(buffer, length, lookup_byte);
+}
+
+/* Count one block into the four sub-histograms. Blocks are small enough that
+   the 32-bit counters cannot overflow. */
+static void histogram_block(uint32_t sub[NUM_SUB_HISTOGRAMS][256], const unsigned char* buffer, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, buffer + i, sizeof(word));
+        sub[0][word & 0xFF]++;
+        sub[1][(word >> 8) & 0xFF]++;
+        sub[2][(word >> 16) & 0xFF]++;
+        sub[3][(word >> 24) & 0xFF]++;
+        sub[0][(word >> 32) & 0xFF]++;
+        sub[1][(word >> 40) & 0xFF]++;
+        sub[2][(word >> 48) & 0xFF]++;
+        sub[3][word >> 56]++;
+    }
+    for (; i < length; i++) {
+        sub[0][buffer[i]]++;
+    }
+}
+
+void histogram_update(uint64_t histogram[256], const unsigned char* buffer, size_t length) {
+    uint32_t sub[NUM_SUB_HISTOGRAMS][256];
+
+    while (length > 0) {
+        size_t block = length < HISTOGRAM_BLOCK ? length : HISTOGRAM_BLOCK;
+
+        memset(sub, 0, sizeof(sub));
+        histogram_block(sub, buffer, block);
+
+        // fold the sub-histograms into the running totals
+        int value, k;
+        for (value = 0; value < 256; value++) {
+            for (k = 0; k < NUM_SUB_HISTOGRAMS; k++) {
+                histogram[value] += sub[k][value];
+            }
+        }
+
+        buffer += block;
+        length -= block;
+    }
+}
@@ -0,0 +1,123 @@
+/*
+count_bench.c - Cross-check and time the bytecheck counting kernels
+
+The AVX2 count and the histogram are first checked against the scalar count
+on random data, then everything is timed on one large buffer next to the
+loop bytecheck originally used.
+
+Usage: ./count_bench [buffer size in MiB] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bytecheck.h"
+
+#define DEFAULT_BENCH_MB    64
+#define DEFAULT_BENCH_ITERS 10
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The counting loop bytecheck started with: signed char against a long */
+static int count_original(char* buffer, long int length, long int lookup_byte) {
+    int i, count = 0;
+    for (i = 0; i < length; i++) {
+        if (buffer[i] == lookup_byte) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void report(char* label, double elapsed, size_t length, long int nIterations) {
+    printf("%-24s %10.2f GB/s\n", label, (double) length * nIterations / elapsed / 1e9);
+}
+
+int main(int argc, char* argv[]) {
+    long int nMegabytes = DEFAULT_BENCH_MB;
+    long int nIterations = DEFAULT_BENCH_ITERS;
+
+    if (argc > 1) {
+        nMegabytes = atol(argv[1]);
+    }
+    if (argc > 2) {
+        nIterations = atol(argv[2]);
+    }
+    if (nMegabytes <= 0 || nIterations <= 0) {
+        fprintf(stderr, "Usage: %s [buffer size in MiB] [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    size_t length = nMegabytes << 20;
+    unsigned char* buffer = (unsigned char*) malloc(length);
+    if (buffer == NULL) {
+        fprintf(stderr, "count_bench: unable to allocate %ld MiB\n", nMegabytes);
+        exit(1);
+    }
+    srand(time(NULL));
+    size_t i;
+    for (i = 0; i < length; i++) {
+        buffer[i] = rand();
+    }
+
+    // check the fast paths against the scalar count for every byte value
+    uint64_t histogram[256];
+    memset(histogram, 0, sizeof(histogram));
+    size_t checkLength = length < (1 << 20) ? length : (1 << 20) + 13;
+    histogram_update(histogram, buffer + 3, checkLength - 3);
+    int value;
+    for (value = 0; value < 256; value++) {
+        uint64_t expected = count_byte_scalar(buffer + 3, checkLength - 3, value);
+        if (count_byte(buffer + 3, checkLength - 3, value) != expected || histogram[value] != expected) {
+            fprintf(stderr, "count_bench: counts for 0x%02x differ from scalar\n", value);
+            exit(1);
+        }
+    }
+
+    volatile uint64_t sink = 0;
+    double start;
+    long int k;
+
+    start = now_seconds();
+    for (k = 0; k < nIterations; k++) {
+        sink += count_original((char*) buffer, length, 0x42);
+    }
+    report("original loop", now_seconds() - start, length, nIterations);
+
+    start = now_seconds();
+    for (k = 0; k < nIterations; k++) {
+        sink += count_byte_scalar(buffer, length, 0x42);
+    }
+    report("count scalar", now_seconds() - start, length, nIterations);
+
+    if (count_byte_has_avx2()) {
+        start = now_seconds();
+        for (k = 0; k < nIterations; k++) {
+            sink += count_byte_avx2(buffer, length, 0x42);
+        }
+        report("count avx2", now_seconds() - start, length, nIterations);
+    }
+
+    start = now_seconds();
+    for (k = 0; k < nIterations; k++) {
+        memset(histogram, 0, sizeof(histogram));
+        histogram_update(histogram, buffer, length);
+    }
+    report("histogram (256 bins)", now_seconds() - start, length, nIterations);
+
+    // what the histogram replaces: one scalar pass per byte value
+    start = now_seconds();
+    for (value = 0; value < 256; value++) {
+        sink += count_original((char*) buffer, length, value);
+    }
+    report("256 x original loop", now_seconds() - start, length, 1);
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,248 @@
+/*
+parallel.c - Multithreaded scanning for bytecheck
+
+Every file is cut into ranges up front: small files are one range each, a
+large file is split so all threads can work on it at once. Workers claim the
+next range, read it through their own buffer and count into that range's own
+result slot (and their own histogram), so nothing is shared while counting.
+The slots are added up per file after the join.
+
+A range owns the matches that start inside it. It is read length-1 bytes past
+its end so a pattern straddling two ranges is counted once, by the first.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "bytecheck.h"
+
+struct ScanRange {
+    int                 nFile;
+    off_t               start;
+    off_t               end;
+    uint64_t*           counts;     /* one per pattern, only written by the worker that claimed the range */
+    struct MatchList*   matches;    /* likewise, when offsets are wanted */
+};
+
+struct ParallelScan {
+    struct ScanJob*     job;
+    struct ScanRange*   ranges;
+    int                 numRanges;
+
+    /* Next range to hand out and the first error seen, both under lock */
+    int                 nextRange;
+    int                 nError;
+    pthread_mutex_t     lock;
+};
+
+struct ScanThreadInfo {
+    int                 nIndex;
+    pthread_t           threadId;
+    struct ParallelScan* scan;
+    uint64_t            histogram[256];
+};
+
+struct ScanThreadInfo TheScanWorkers[MAX_THREADS];
+
+/* What the scan_range callback needs to count one range */
+struct RangeScan {
+    struct PatternState* states;
+    int                 nPatterns;
+    uint64_t*           histogram;
+    off_t               limit;
+};
+
+/* Claim the next range index, or -1 once everything is handed out (or a worker failed) */
+static int claim_range(struct ParallelScan* pScan) {
+    int k = -1;
+    pthread_mutex_lock(&pScan->lock);
+    if (pScan->nError == 0 && pScan->nextRange < pScan->numRanges) {
+        k = pScan->nextRange;
+        pScan->nextRange++;
+    }
+    pthread_mutex_unlock(&pScan->lock);
+    return k;
+}
+
+static void record_error(struct ParallelScan* pScan, int error) {
+    pthread_mutex_lock(&pScan->lock);
+    if (pScan->nError == 0) {
+        pScan->nError = error;
+    }
+    pthread_mutex_unlock(&pScan->lock);
+}
+
+static void scan_chunk(const unsigned char* chunk, size_t length, off_t offset, void* pData) {
+    struct RangeScan* pRange = (struct RangeScan*) pData;
+
+    int i;
+    for (i = 0; i < pRange->nPatterns; i++) {
+        pattern_state_feed(&pRange->states[i], chunk, length, offset, pRange->limit);
+    }
+
+    // the histogram must not see the bytes read past the end for the patterns
+    if (pRange->histogram) {
+        size_t own = length;
+        if (offset + (off_t) own > pRange->limit) {
+            own = pRange->limit > offset ? pRange->limit - offset : 0;
+        }
+        histogram_update(pRange->histogram, chunk, own);
+    }
+}
+
+static void* scan_worker(void* pData) {
+    struct ScanThreadInfo* pThreadInfo = (struct ScanThreadInfo*) pData;
+    struct ParallelScan* pScan = pThreadInfo->scan;
+    struct ScanJob* pJob = pScan->job;
+
+    struct RangeScan theRange;
+    theRange.nPatterns = pJob->nPatterns;
+    theRange.histogram = pJob->bHistogram ? pThreadInfo->histogram : NULL;
+    theRange.states = (struct PatternState*) malloc(pJob->nPatterns * sizeof(struct PatternState));
+    if (theRange.states == NULL && pJob->nPatterns > 0) {
+        record_error(pScan, ENOMEM);
+        return NULL;
+    }
+
+    int k;
+    while ((k = claim_range(pScan)) >= 0) {
+        struct ScanRange* pRange = &pScan->ranges[k];
+        off_t fileSize = pJob->sizes[pRange->nFile];
+
+        // read a little past the end so matches starting near it can finish
+        off_t readEnd = pRange->end;
+        if (pJob->nPatterns > 0) {
+            readEnd += pJob->maxPatternLength - 1;
+            if (readEnd > fileSize) {
+                readEnd = fileSize;
+            }
+        }
+
+        int i;
+        for (i = 0; i < pJob->nPatterns; i++) {
+            pattern_state_init(&theRange.states[i], &pJob->patterns[i], pRange->matches ? &pRange->matches[i] : NULL);
+        }
+        theRange.limit = pRange->end;
+
+        if (scan_range(pJob->fds[pRange->nFile], pRange->start, readEnd, SCAN_CHUNK_SIZE, scan_chunk, &theRange) != 0) {
+            record_error(pScan, errno);
+            break;
+        }
+        for (i = 0; i < pJob->nPatterns; i++) {
+            pRange->counts[i] = theRange.states[i].count;
+        }
+    }
+
+    free(theRange.states);
+    return NULL;
+}
+
+/* Split a file into about one range per thread, but never into tiny ones */
+static off_t range_size(off_t fileSize, int nThreads) {
+    off_t split = (fileSize + nThreads - 1) / nThreads;
+    if (split < MIN_SPLIT_SIZE) {
+        split = MIN_SPLIT_SIZE;
+    }
+    return split;
+}
+
+int parallel_scan(struct ScanJob* pJob, int nThreads) {
+    struct ParallelScan theScan;
+    int i, j;
+
+    theScan.numRanges = 0;
+    for (i = 0; i < pJob->nFiles; i++) {
+        off_t split = range_size(pJob->sizes[i], nThreads);
+        theScan.numRanges += (pJob->sizes[i] + split - 1) / split;
+    }
+
+    theScan.job = pJob;
+    theScan.ranges = (struct ScanRange*) calloc(theScan.numRanges + 1, sizeof(struct ScanRange));
+    uint64_t* rangeCounts = (uint64_t*) calloc((size_t) (theScan.numRanges + 1) * (pJob->nPatterns + 1), sizeof(uint64_t));
+    struct MatchList* rangeMatches = NULL;
+    if (pJob->bOffsets) {
+        rangeMatches = (struct MatchList*) calloc((size_t) (theScan.numRanges + 1) * (pJob->nPatterns + 1), sizeof(struct MatchList));
+    }
+    if (theScan.ranges == NULL || rangeCounts == NULL || (pJob->bOffsets && rangeMatches == NULL)) {
+        free(theScan.ranges);
+        free(rangeCounts);
+        free(rangeMatches);
+        return ENOMEM;
+    }
+
+    int k = 0;
+    for (i = 0; i < pJob->nFiles; i++) {
+        off_t split = range_size(pJob->sizes[i], nThreads);
+        off_t start;
+        for (start = 0; start < pJob->sizes[i]; start += split) {
+            theScan.ranges[k].nFile = i;
+            theScan.ranges[k].start = start;
+            theScan.ranges[k].end = start + split < pJob->sizes[i] ? start + split : pJob->sizes[i];
+            theScan.ranges[k].counts = rangeCounts + (size_t) k * pJob->nPatterns;
+            theScan.ranges[k].matches = rangeMatches ? rangeMatches + (size_t) k * pJob->nPatterns : NULL;
+            k++;
+        }
+    }
+
+    // no point starting threads that would find nothing to claim
+    if (nThreads > theScan.numRanges) {
+        nThreads = theScan.numRanges > 0 ? theScan.numRanges : 1;
+    }
+
+    theScan.nextRange = 0;
+    theScan.nError = 0;
+    pthread_mutex_init(&theScan.lock, NULL);
+
+    for (i = 0; i < nThreads; i++) {
+        TheScanWorkers[i].nIndex = i;
+        TheScanWorkers[i].scan = &theScan;
+        memset(TheScanWorkers[i].histogram, 0, sizeof(TheScanWorkers[i].histogram));
+        if (pthread_create(&TheScanWorkers[i].threadId, NULL, scan_worker, &TheScanWorkers[i]) != 0) {
+            record_error(&theScan, EAGAIN);
+            nThreads = i;
+            break;
+        }
+    }
+    for (i = 0; i < nThreads; i++) {
+        pthread_join(TheScanWorkers[i].threadId, NULL);
+    }
+    pthread_mutex_destroy(&theScan.lock);
+
+    // merge the partial results now that every worker is done
+    if (theScan.nError == 0) {
+        memset(pJob->counts, 0, (size_t) pJob->nFiles * pJob->nPatterns * sizeof(uint64_t));
+        for (k = 0; k < theScan.numRanges; k++) {
+            uint64_t* fileCounts = pJob->counts + (size_t) theScan.ranges[k].nFile * pJob->nPatterns;
+            for (j = 0; j < pJob->nPatterns; j++) {
+                fileCounts[j] += theScan.ranges[k].counts[j];
+            }
+        }
+        // ranges are in file order, so appending them keeps each file's offsets sorted
+        if (pJob->bOffsets) {
+            for (k = 0; k < theScan.numRanges; k++) {
+                struct MatchList* fileMatches = pJob->matches + (size_t) theScan.ranges[k].nFile * pJob->nPatterns;
+                for (j = 0; j < pJob->nPatterns; j++) {
+                    match_list_append(&fileMatches[j], &theScan.ranges[k].matches[j]);
+                }
+            }
+        }
+        memset(pJob->histogram, 0, sizeof(pJob->histogram));
+        for (i = 0; i < nThreads; i++) {
+            for (j = 0; j < 256; j++) {
+                pJob->histogram[j] += TheScanWorkers[i].histogram[j];
+            }
+        }
+    }
+
+    if (rangeMatches) {
+        for (k = 0; k < theScan.numRanges * pJob->nPatterns; k++) {
+            match_list_free(&rangeMatches[k]);
+        }
+    }
+    free(rangeMatches);
+    free(rangeCounts);
+    free(theScan.ranges);
+    return theScan.nError;
+}
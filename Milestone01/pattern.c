@@ -0,0 +1,116 @@
+/*
+pattern.c - Multi-byte lookup patterns for bytecheck
+
+A pattern is written like a lookup byte with more digits: 0x0d0a is a CR LF
+pair. Overlapping matches all count, so 0x4141 is found twice in "AAA". The
+searching itself is in search.c.
+
+Files are read a chunk at a time, so each pattern keeps the tail of the data
+it has already seen. A match that starts in that tail and ends in the next
+chunk is found by checking the tail joined to the start of the new chunk.
+*/
+
+#include <string.h>
+
+#include "bytecheck.h"
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+int pattern_parse(struct Pattern* pPattern, char* text) {
+    // the pattern should be in the form '0x##', with any number of byte pairs
+    if (text[0] != '0' || (text[1] != 'x' && text[1] != 'X')) {
+        return -1;
+    }
+    char* digits = text + 2;
+    size_t nDigits = strlen(digits);
+    if (nDigits == 0 || (nDigits + 1) / 2 > MAX_PATTERN_LEN) {
+        return -1;
+    }
+
+    pPattern->text = text;
+    pPattern->length = 0;
+
+    // an odd number of digits means the first byte was written with one digit (0x4 is 0x04)
+    size_t i = 0;
+    if (nDigits % 2 == 1) {
+        int low = hex_value(digits[0]);
+        if (low < 0) {
+            return -1;
+        }
+        pPattern->bytes[pPattern->length++] = low;
+        i = 1;
+    }
+    for (; i < nDigits; i += 2) {
+        int high = hex_value(digits[i]);
+        int low = hex_value(digits[i + 1]);
+        if (high < 0 || low < 0) {
+            return -1;
+        }
+        pPattern->bytes[pPattern->length++] = (high << 4) | low;
+    }
+
+    search_prepare(pPattern);
+    return 0;
+}
+
+void pattern_state_init(struct PatternState* pState, const struct Pattern* pPattern, struct MatchList* pMatches) {
+    pState->pPattern = pPattern;
+    pState->pMatches = pMatches;
+    pState->carryLength = 0;
+    pState->count = 0;
+}
+
+void pattern_state_feed(struct PatternState* pState, const unsigned char* chunk, size_t length, off_t offset, off_t limit) {
+    const struct Pattern* pPattern = pState->pPattern;
+    size_t keep = pPattern->length - 1;
+    size_t maxStart;
+
+    // matches that start in the carried tail and finish in this chunk
+    if (pState->carryLength > 0) {
+        unsigned char stitch[2 * MAX_PATTERN_LEN];
+        size_t head = length < keep ? length : keep;
+        off_t stitchOffset = offset - (off_t) pState->carryLength;
+
+        memcpy(stitch, pState->carry, pState->carryLength);
+        memcpy(stitch + pState->carryLength, chunk, head);
+        maxStart = pState->carryLength;
+        if (stitchOffset + (off_t) maxStart > limit) {
+            maxStart = limit > stitchOffset ? limit - stitchOffset : 0;
+        }
+        pState->count += pattern_search(pPattern, stitch, pState->carryLength + head, maxStart,
+                                        stitchOffset, pState->pMatches);
+    }
+
+    // matches entirely inside this chunk, only those starting before the limit are ours
+    maxStart = length;
+    if (offset + (off_t) maxStart > limit) {
+        maxStart = limit > offset ? limit - offset : 0;
+    }
+    pState->count += pattern_search(pPattern, chunk, length, maxStart, offset, pState->pMatches);
+
+    // carry the last length-1 bytes seen, which may reach back past this chunk if it was short
+    if (keep == 0) {
+        return;
+    }
+    if (length >= keep) {
+        memcpy(pState->carry, chunk + length - keep, keep);
+        pState->carryLength = keep;
+    } else {
+        size_t total = pState->carryLength + length;
+        size_t drop = total > keep ? total - keep : 0;
+        memmove(pState->carry, pState->carry + drop, pState->carryLength - drop);
+        memcpy(pState->carry + pState->carryLength - drop, chunk, length);
+        pState->carryLength = total - drop;
+    }
+}
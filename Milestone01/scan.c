@@ -0,0 +1,54 @@
+/*
+scan.c - Bounded-memory file reader for bytecheck
+
+A byte range of the file is read through one fixed-size heap buffer and each
+chunk is handed to a callback, so a 10 GB log costs the same memory as a
+10 KB one. The kernel is told the access is sequential so it reads ahead
+while the callback counts.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bytecheck.h"
+
+int scan_range(int fd, off_t start, off_t end, size_t chunkSize, ScanCallback callback, void* pData) {
+    unsigned char* buffer = (unsigned char*) malloc(chunkSize);
+    if (buffer == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+
+    off_t offset = start;
+    while (offset < end) {
+        size_t want = chunkSize;
+        if (offset + (off_t) want > end) {
+            want = end - offset;
+        }
+
+        ssize_t result = pread(fd, buffer, want, offset);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            free(buffer);
+            return -1;
+        }
+        if (result == 0) {
+            // the file got shorter underneath us
+            free(buffer);
+            errno = EIO;
+            return -1;
+        }
+
+        callback(buffer, result, offset, pData);
+        offset += result;
+    }
+
+    free(buffer);
+    return 0;
+}
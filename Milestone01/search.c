@@ -0,0 +1,314 @@
+/*
+search.c - Substring search engine for bytecheck patterns
+
+Short patterns use an AVX2 prefilter: 32 candidate positions at a time are
+checked for both the first and the last byte of the pattern, and only the
+positions where both match are compared in full. Requiring two bytes to agree
+throws away nearly every false candidate that a first-byte memchr would stop
+at, which matters most for common bytes such as 0x00 or spaces.
+
+Long patterns fall back to the Two-Way algorithm (Crochemore and Perrin),
+which never looks at a text byte more than twice however the pattern and text
+are made up. They still start on the prefilter, which is faster on ordinary
+data, but if it has to verify too many candidates for the ground it covers
+(each costs up to a whole pattern compare, quadratic on text such as a long
+run of one byte) the rest of the buffer is handed to Two-Way. The critical
+factorization Two-Way needs is worked out once when the pattern is parsed.
+
+Every search reports the matches starting before maxStart that fit in the
+buffer, overlapping ones included, and can also record their offsets.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecheck.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+void match_list_add(struct MatchList* pList, off_t offset) {
+    if (pList->count == pList->capacity) {
+        size_t capacity = pList->capacity ? 2 * pList->capacity : 1024;
+        off_t* offsets = (off_t*) realloc(pList->offsets, capacity * sizeof(off_t));
+        if (offsets == NULL) {
+            fprintf(stderr, "Error: Out of memory recording match offsets\n");
+            exit(1);
+        }
+        pList->offsets = offsets;
+        pList->capacity = capacity;
+    }
+    pList->offsets[pList->count++] = offset;
+}
+
+void match_list_append(struct MatchList* pList, const struct MatchList* pOther) {
+    size_t i;
+    for (i = 0; i < pOther->count; i++) {
+        match_list_add(pList, pOther->offsets[i]);
+    }
+}
+
+void match_list_free(struct MatchList* pList) {
+    free(pList->offsets);
+    pList->offsets = NULL;
+    pList->count = 0;
+    pList->capacity = 0;
+}
+
+/* Maximal suffix of the pattern under the byte order (bReverse flips it).
+   Returns its start minus one and stores the period of that suffix. */
+static long maximal_suffix(const unsigned char* x, long m, int bReverse, long* pPeriod) {
+    long ms = -1, j = 0, k = 1, p = 1;
+    while (j + k < m) {
+        unsigned char a = x[j + k];
+        unsigned char b = x[ms + k];
+        if (bReverse ? a > b : a < b) {
+            j += k;
+            k = 1;
+            p = j - ms;
+        } else if (a == b) {
+            if (k != p) {
+                k++;
+            } else {
+                j += p;
+                k = 1;
+            }
+        } else {
+            ms = j;
+            j = ms + 1;
+            k = p = 1;
+        }
+    }
+    *pPeriod = p;
+    return ms;
+}
+
+void search_prepare(struct Pattern* pPattern) {
+    long m = pPattern->length;
+    long p, q;
+    long i = maximal_suffix(pPattern->bytes, m, 0, &p);
+    long j = maximal_suffix(pPattern->bytes, m, 1, &q);
+
+    // the later of the two maximal suffixes gives a critical factorization
+    if (i > j) {
+        pPattern->split = i;
+        pPattern->period = p;
+    } else {
+        pPattern->split = j;
+        pPattern->period = q;
+    }
+
+    // when the left part repeats with that period the whole pattern is periodic
+    pPattern->bPeriodic = memcmp(pPattern->bytes, pPattern->bytes + pPattern->period, pPattern->split + 1) == 0;
+    if (!pPattern->bPeriodic) {
+        // matches can be no closer than this, so it is a safe shift after one
+        long left = pPattern->split + 1;
+        long right = m - pPattern->split - 1;
+        pPattern->period = (left > right ? left : right) + 1;
+    }
+}
+
+uint64_t search_scalar(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                       off_t base, struct MatchList* pMatches) {
+    size_t m = pPattern->length;
+    uint64_t count = 0;
+    size_t i = 0;
+
+    // let memchr find each candidate first byte and compare the rest
+    while (i < maxStart) {
+        const unsigned char* p = (const unsigned char*) memchr(buffer + i, pPattern->bytes[0], maxStart - i);
+        if (p == NULL) {
+            break;
+        }
+        i = p - buffer;
+        if (memcmp(p + 1, pPattern->bytes + 1, m - 1) == 0) {
+            count++;
+            if (pMatches) {
+                match_list_add(pMatches, base + i);
+            }
+        }
+        i++;
+    }
+    return count;
+}
+
+int search_has_avx2() {
+    return count_byte_has_avx2();
+}
+
+/* Candidates allowed per 32 positions scanned before a long pattern gives up
+   on the prefilter, and the slack given at the start */
+#define PREFILTER_BUDGET_SHIFT  5
+#define PREFILTER_BUDGET_SLACK  64
+
+#ifdef HAVE_X86_KERNELS
+/* The AVX2 first/last byte prefilter. With bBounded set it stops once it has
+   verified too many candidates for the ground covered (each one can cost a
+   whole pattern compare) and leaves the rest from *pEnd to Two-Way. */
+__attribute__((target("avx2")))
+static uint64_t prefilter_avx2(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                               off_t base, struct MatchList* pMatches, int bBounded, size_t* pEnd) {
+    size_t m = pPattern->length;
+    const __m256i first = _mm256_set1_epi8((char) pPattern->bytes[0]);
+    const __m256i last = _mm256_set1_epi8((char) pPattern->bytes[m - 1]);
+    uint64_t count = 0;
+    size_t candidates = 0;
+    size_t i = 0;
+
+    // the last-byte load reaches i+m+30, which is inside the buffer while i+32 <= maxStart
+    for (; i + 32 <= maxStart; i += 32) {
+        if (bBounded && candidates > (i >> PREFILTER_BUDGET_SHIFT) + PREFILTER_BUDGET_SLACK) {
+            *pEnd = i;
+            return count;
+        }
+
+        __m256i eqFirst = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i)), first);
+        __m256i eqLast = _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i*) (buffer + i + m - 1)), last);
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(eqFirst, eqLast));
+
+        while (mask != 0) {
+            size_t candidate = i + __builtin_ctz(mask);
+            // first and last already agree, compare what lies between them
+            if (m <= 2 || memcmp(buffer + candidate + 1, pPattern->bytes + 1, m - 2) == 0) {
+                count++;
+                if (pMatches) {
+                    match_list_add(pMatches, base + candidate);
+                }
+            }
+            candidates++;
+            mask &= mask - 1;
+        }
+    }
+
+    if (i < maxStart) {
+        count += search_scalar(pPattern, buffer + i, maxStart - i, base + i, pMatches);
+    }
+    *pEnd = maxStart;
+    return count;
+}
+
+uint64_t search_avx2(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                     off_t base, struct MatchList* pMatches) {
+    size_t end;
+    return prefilter_avx2(pPattern, buffer, maxStart, base, pMatches, 0, &end);
+}
+#else
+static uint64_t prefilter_avx2(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                               off_t base, struct MatchList* pMatches, int bBounded, size_t* pEnd) {
+    *pEnd = maxStart;
+    return search_scalar(pPattern, buffer, maxStart, base, pMatches);
+}
+
+uint64_t search_avx2(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                     off_t base, struct MatchList* pMatches) {
+    return search_scalar(pPattern, buffer, maxStart, base, pMatches);
+}
+#endif
+
+uint64_t search_two_way(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                        off_t base, struct MatchList* pMatches) {
+    const unsigned char* x = pPattern->bytes;
+    long m = pPattern->length;
+    long ell = pPattern->split;
+    long per = pPattern->period;
+    long n = maxStart;
+    uint64_t count = 0;
+    long i, j = 0;
+
+    if (pPattern->bPeriodic) {
+        // after a match the next period of the left part is already known to agree
+        long memory = -1;
+        while (j < n) {
+            i = (ell > memory ? ell : memory) + 1;
+            while (i < m && x[i] == buffer[i + j]) {
+                i++;
+            }
+            if (i >= m) {
+                i = ell;
+                while (i > memory && x[i] == buffer[i + j]) {
+                    i--;
+                }
+                if (i <= memory) {
+                    count++;
+                    if (pMatches) {
+                        match_list_add(pMatches, base + j);
+                    }
+                }
+                j += per;
+                memory = m - per - 1;
+            } else {
+                j += i - ell;
+                memory = -1;
+            }
+        }
+    } else {
+        while (j < n) {
+            i = ell + 1;
+            while (i < m && x[i] == buffer[i + j]) {
+                i++;
+            }
+            if (i >= m) {
+                i = ell;
+                while (i >= 0 && x[i] == buffer[i + j]) {
+                    i--;
+                }
+                if (i < 0) {
+                    count++;
+                    if (pMatches) {
+                        match_list_add(pMatches, base + j);
+                    }
+                }
+                j += per;
+            } else {
+                j += i - ell;
+            }
+        }
+    }
+    return count;
+}
+
+uint64_t pattern_search(const struct Pattern* pPattern, const unsigned char* buffer, size_t length, size_t maxStart,
+                        off_t base, struct MatchList* pMatches) {
+    static int bHasAvx2 = -1;
+    size_t m = pPattern->length;
+
+    if (length < m) {
+        return 0;
+    }
+    // a match has to fit in the buffer as well as start before maxStart
+    if (maxStart > length - m + 1) {
+        maxStart = length - m + 1;
+    }
+    if (maxStart == 0) {
+        return 0;
+    }
+
+    // a lone byte without offsets is the plain byte count
+    if (m == 1 && pMatches == NULL) {
+        return count_byte(buffer, maxStart, pPattern->bytes[0]);
+    }
+    if (bHasAvx2 < 0) {
+        bHasAvx2 = search_has_avx2();
+    }
+
+    // long patterns start on the prefilter but move to Two-Way if the text keeps it verifying
+    if (m >= TWO_WAY_MIN_LEN) {
+        if (!bHasAvx2) {
+            return search_two_way(pPattern, buffer, maxStart, base, pMatches);
+        }
+        size_t end;
+        uint64_t count = prefilter_avx2(pPattern, buffer, maxStart, base, pMatches, 1, &end);
+        if (end < maxStart) {
+            count += search_two_way(pPattern, buffer + end, maxStart - end, base + end, pMatches);
+        }
+        return count;
+    }
+
+    if (bHasAvx2) {
+        return search_avx2(pPattern, buffer, maxStart, base, pMatches);
+    }
+    return search_scalar(pPattern, buffer, maxStart, base, pMatches);
+}
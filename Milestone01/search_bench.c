@@ -0,0 +1,174 @@
+/*
+search_bench.c - Cross-check and time the bytecheck pattern search engines
+
+Every engine is first checked against a naive compare-at-every-position scan
+on text drawn from a small alphabet (so matches, near misses and periodic
+patterns are common), offsets included. Then each engine is timed on one
+large random buffer for a range of pattern lengths.
+
+Usage: ./search_bench [buffer size in MiB] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bytecheck.h"
+
+#define DEFAULT_BENCH_MB    64
+#define DEFAULT_BENCH_ITERS 5
+#define CHECK_LENGTH        (1 << 16)
+
+typedef uint64_t (*SearchEngine)(const struct Pattern*, const unsigned char*, size_t, off_t, struct MatchList*);
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The obvious search: compare the whole pattern at every position */
+static uint64_t search_naive(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                             off_t base, struct MatchList* pMatches) {
+    uint64_t count = 0;
+    size_t i;
+    for (i = 0; i < maxStart; i++) {
+        if (memcmp(buffer + i, pPattern->bytes, pPattern->length) == 0) {
+            count++;
+            if (pMatches) {
+                match_list_add(pMatches, base + i);
+            }
+        }
+    }
+    return count;
+}
+
+/* What bytecheck itself calls, including the switch from prefilter to Two-Way */
+static uint64_t search_dispatch(const struct Pattern* pPattern, const unsigned char* buffer, size_t maxStart,
+                                off_t base, struct MatchList* pMatches) {
+    return pattern_search(pPattern, buffer, maxStart + pPattern->length - 1, maxStart, base, pMatches);
+}
+
+static void make_pattern(struct Pattern* pPattern, const unsigned char* bytes, size_t length) {
+    memcpy(pPattern->bytes, bytes, length);
+    pPattern->length = length;
+    pPattern->text = "";
+    search_prepare(pPattern);
+}
+
+static void check_engine(char* name, SearchEngine engine, const struct Pattern* pPattern,
+                         const unsigned char* buffer, size_t length) {
+    struct MatchList expected, actual;
+    memset(&expected, 0, sizeof(expected));
+    memset(&actual, 0, sizeof(actual));
+
+    size_t maxStart = length - pPattern->length + 1;
+    uint64_t nExpected = search_naive(pPattern, buffer, maxStart, 0, &expected);
+    uint64_t nActual = engine(pPattern, buffer, maxStart, 0, &actual);
+    if (nActual != nExpected || actual.count != expected.count ||
+        (expected.count > 0 && memcmp(actual.offsets, expected.offsets, expected.count * sizeof(off_t)) != 0)) {
+        fprintf(stderr, "search_bench: %s found %llu matches of a %zu byte pattern, naive found %llu\n",
+                name, (unsigned long long) nActual, pPattern->length, (unsigned long long) nExpected);
+        exit(1);
+    }
+    match_list_free(&expected);
+    match_list_free(&actual);
+}
+
+static void time_engine(char* name, SearchEngine engine, const struct Pattern* pPattern,
+                        const unsigned char* buffer, size_t length, long int nIterations) {
+    volatile uint64_t sink = 0;
+    long int k;
+    double start = now_seconds();
+    for (k = 0; k < nIterations; k++) {
+        sink += engine(pPattern, buffer, length - pPattern->length + 1, 0, NULL);
+    }
+    double elapsed = now_seconds() - start;
+    printf("%-16s %4zu bytes %10.2f GB/s\n", name, pPattern->length, (double) length * nIterations / elapsed / 1e9);
+}
+
+int main(int argc, char* argv[]) {
+    long int nMegabytes = DEFAULT_BENCH_MB;
+    long int nIterations = DEFAULT_BENCH_ITERS;
+
+    if (argc > 1) {
+        nMegabytes = atol(argv[1]);
+    }
+    if (argc > 2) {
+        nIterations = atol(argv[2]);
+    }
+    if (nMegabytes <= 0 || nIterations <= 0) {
+        fprintf(stderr, "Usage: %s [buffer size in MiB] [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    size_t length = nMegabytes << 20;
+    unsigned char* buffer = (unsigned char*) malloc(length);
+    if (buffer == NULL) {
+        fprintf(stderr, "search_bench: unable to allocate %ld MiB\n", nMegabytes);
+        exit(1);
+    }
+    srand(time(NULL));
+
+    // small alphabets make matches and partial matches frequent enough to check every path
+    struct Pattern thePattern;
+    unsigned char bytes[MAX_PATTERN_LEN];
+    size_t i, m;
+    int alphabet;
+    for (alphabet = 2; alphabet <= 4; alphabet++) {
+        for (i = 0; i < CHECK_LENGTH; i++) {
+            buffer[i] = 'a' + rand() % alphabet;
+        }
+        for (m = 1; m <= 200; m += (m < 70 ? 1 : 13)) {
+            // a random pattern, and a periodic one built from a short random word
+            size_t word = 1 + rand() % 3;
+            int periodic;
+            for (periodic = 0; periodic < 2; periodic++) {
+                for (i = 0; i < m; i++) {
+                    bytes[i] = (periodic && i >= word) ? bytes[i % word] : 'a' + rand() % alphabet;
+                }
+                make_pattern(&thePattern, bytes, m);
+                check_engine("scalar", search_scalar, &thePattern, buffer, CHECK_LENGTH);
+                check_engine("avx2", search_avx2, &thePattern, buffer, CHECK_LENGTH);
+                check_engine("two-way", search_two_way, &thePattern, buffer, CHECK_LENGTH);
+                check_engine("dispatch", search_dispatch, &thePattern, buffer, CHECK_LENGTH);
+            }
+        }
+    }
+
+    // time on random bytes with a pattern that does not occur, so only the search is measured
+    for (i = 0; i < length; i++) {
+        buffer[i] = rand();
+    }
+    size_t lengths[] = { 2, 4, 8, 16, 32, 64, 256, 1024 };
+    int k;
+    for (k = 0; k < (int) (sizeof(lengths) / sizeof(lengths[0])); k++) {
+        m = lengths[k];
+        for (i = 0; i < m; i++) {
+            bytes[i] = rand();
+        }
+        make_pattern(&thePattern, bytes, m);
+        time_engine("naive", search_naive, &thePattern, buffer, length, nIterations);
+        time_engine("memchr", search_scalar, &thePattern, buffer, length, nIterations);
+        if (search_has_avx2()) {
+            time_engine("avx2", search_avx2, &thePattern, buffer, length, nIterations);
+        }
+        time_engine("two-way", search_two_way, &thePattern, buffer, length, nIterations);
+    }
+
+    // a run of one byte and a pattern that almost matches it everywhere is the prefilter's worst case
+    memset(buffer, 'a', length);
+    m = 256;
+    memset(bytes, 'a', m);
+    bytes[m / 2] = 'b';
+    make_pattern(&thePattern, bytes, m);
+    if (search_has_avx2()) {
+        time_engine("avx2 worst", search_avx2, &thePattern, buffer, length, 1);
+    }
+    time_engine("two-way worst", search_two_way, &thePattern, buffer, length, 1);
+    time_engine("dispatch worst", search_dispatch, &thePattern, buffer, length, 1);
+
+    free(buffer);
+    return 0;
+}
@@ -5,14 +5,13 @@
 #include <sys/wait.h>
 #include <signal.h>
 
+#include "tokenizer.h"
+
 void exit_handler(int signum) {
     fprintf(stderr, "\nControl-C was pressed... exiting\n");
     exit(1);
 }
 
-int input_size = 100;
-int max_command_len = 10;
-
 int main(int argc, char* argv[]) {
 
     if (argc != 1) {
@@ -22,22 +21,25 @@ int main(int argc, char* argv[]) {
 
     signal(SIGINT, exit_handler);
 
-    char input[input_size];
+    // any length of line, with quotes and escapes
+    struct Tokenizer tok;
+    tokenizer_init(&tok);
 
     fprintf(stdout, "Execute? ");
-    fgets(input, input_size, stdin);
-
-    input[strlen(input) - 1] = '\0';
-    char* split = strtok(input, " ");
-    char* command[max_command_len];
-
-    int counter = 0;
-    while (split != NULL) {
-        command[counter] = split;
-        counter++;
-        split = strtok(NULL, " ");
+    fflush(stdout);
+    ssize_t nLength = tokenizer_read_line(&tok, stdin);
+    if (nLength < 0) {
+        exit(0);
+    }
+    if (tokenizer_split(&tok, tok.line, nLength) < 0) {
+        fprintf(stderr, "Error: %s\n", tok.szError);
+        exit(1);
+    }
+    if (tok.nTokens == 0) {
+        fprintf(stderr, "Error: Enter a command to run!\n");
+        exit(1);
     }
-    command[counter] = NULL;
+    char** command = tok.tokens;
 
     int rc = fork();
     if (rc < 0) {
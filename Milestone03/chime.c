@@ -3,71 +3,175 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
-char g_bKeepLooping = 1;
-#define MAX_THREADS 5
-#define BUFFER_SIZE 1024
-#define maxCommandLen 10
+#include "chime.h"
+#include "tokenizer.h"
 
-pthread_mutex_t lock;
+#define MAX_THREADS 5
 
 struct ChimeThreadInfo {
     int        nIndex;
     float      fChimeInterval;
     char       bIsValid;
     pthread_t  ThreadID;
+
+    /* Everything below is shared with the prompt and guarded by lock. The
+       thread waits on wake until its next deadline (CLOCK_MONOTONIC), so an
+       adjust or a stop only has to signal it. */
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    char       bStop;
+    int64_t    intervalNs;
+    int64_t    deadlineNs;
+
+    /* How far from its schedule the chime has run, for -drift */
+    uint64_t   nFires;
+    int64_t    lastLateNs;
+    int64_t    maxLateNs;
 };
 
 struct ChimeThreadInfo TheThreads[MAX_THREADS];
 
+/* With -loop every chime runs on one event-loop thread instead of a thread each,
+   and -wheel does the same on a timing wheel instead of a heap */
+char g_bEventLoop = 0;
+char g_bWheel = 0;
+struct Scheduler TheScheduler;
+
+/* With -drift every ding says how far it was from its schedule */
+char g_bDrift = 0;
+uint64_t g_nLoopFires = 0;
+int64_t g_nLoopMaxLateNs = 0;
+
+/* Dings go through a lock-free ring to one writer thread; with -count they are only counted */
+char g_bCountOnly = 0;
+struct Output TheOutput;
+
 void * ThreadChime (void * pData) {
     struct ChimeThreadInfo  * pThreadInfo;
 
     pThreadInfo = (struct ChimeThreadInfo *) pData;
-    while(g_bKeepLooping) {
-        // lock the mutex for sleep
-        pthread_mutex_lock(&lock);
-        sleep(pThreadInfo->fChimeInterval);
-        // unlock the mutex
-        pthread_mutex_unlock(&lock);
-        printf("Ding - Chime %d with an interval of %.2f s!\n", pThreadInfo->nIndex, pThreadInfo->fChimeInterval);
+    pthread_mutex_lock(&pThreadInfo->lock);
+    while(!pThreadInfo->bStop) {
+        // wait for the deadline itself rather than for an interval, so time spent printing never adds up
+        struct timespec ts;
+        ts.tv_sec = pThreadInfo->deadlineNs / NSEC_PER_SEC;
+        ts.tv_nsec = pThreadInfo->deadlineNs % NSEC_PER_SEC;
+        pthread_cond_timedwait(&pThreadInfo->wake, &pThreadInfo->lock, &ts);
+
+        // woken early by an adjust, a stop or spuriously: look at the (maybe new) deadline again
+        int64_t now = now_ns();
+        if (pThreadInfo->bStop || now < pThreadInfo->deadlineNs) {
+            continue;
+        }
+
+        pThreadInfo->nFires++;
+        pThreadInfo->lastLateNs = now - pThreadInfo->deadlineNs;
+        if (pThreadInfo->lastLateNs > pThreadInfo->maxLateNs) {
+            pThreadInfo->maxLateNs = pThreadInfo->lastLateNs;
+        }
+        struct ChimeEvent theEvent;
+        theEvent.nIndex = pThreadInfo->nIndex;
+        theEvent.nFire = pThreadInfo->nFires;
+        theEvent.intervalNs = pThreadInfo->intervalNs;
+        theEvent.deadlineNs = pThreadInfo->deadlineNs;
+        theEvent.firedNs = now;
+
+        pThreadInfo->deadlineNs += pThreadInfo->intervalNs;
+        if (pThreadInfo->deadlineNs <= now) {
+            // more than an interval behind, skip to the next deadline still ahead
+            pThreadInfo->deadlineNs += ((now - pThreadInfo->deadlineNs) / pThreadInfo->intervalNs + 1) * pThreadInfo->intervalNs;
+        }
+
+        // hand the ding to the writer, which never blocks, so it can be done under the lock
+        output_push(&TheOutput, &theEvent);
     }
+    pthread_mutex_unlock(&pThreadInfo->lock);
     return NULL;
 }
 
+/* Ask a chime thread to stop, wake it and wait for it */
+void StopChime (struct ChimeThreadInfo * pThreadInfo) {
+    pthread_mutex_lock(&pThreadInfo->lock);
+    pThreadInfo->bStop = 1;
+    pthread_cond_signal(&pThreadInfo->wake);
+    pthread_mutex_unlock(&pThreadInfo->lock);
+    pthread_join(pThreadInfo->ThreadID, NULL);
+    pthread_cond_destroy(&pThreadInfo->wake);
+    pthread_mutex_destroy(&pThreadInfo->lock);
+    pThreadInfo->bIsValid = 0;
+}
+
+void LoopChime (int nIndex, int64_t intervalNs, int64_t deadlineNs, int64_t firedNs, void * pData) {
+    // runs on the scheduler thread with the scheduler locked, which also guards the totals;
+    // the scheduler counts each chime's own dings, g_nLoopFires is only for drift
+    g_nLoopFires++;
+    if (firedNs - deadlineNs > g_nLoopMaxLateNs) {
+        g_nLoopMaxLateNs = firedNs - deadlineNs;
+    }
+    struct ChimeEvent theEvent;
+    theEvent.nIndex = nIndex;
+    theEvent.nFire = TheScheduler.chimes[nIndex].nFires;
+    theEvent.intervalNs = intervalNs;
+    theEvent.deadlineNs = deadlineNs;
+    theEvent.firedNs = firedNs;
+    output_push(&TheOutput, &theEvent);
+}
+
 int main (int argc, char *argv[]) {
 
-    char szBuffer[BUFFER_SIZE];
+    struct Tokenizer tok;
+    tokenizer_init(&tok);
+
     /* Set all of the thread information to be invalid (none allocated) */
     for (int j=0; j<MAX_THREADS; j++) {
         TheThreads[j].bIsValid = 0;
     }
+
+    // -loop runs the chimes on the epoll scheduler instead of a thread per chime
+    for (int j=1; j<argc; j++) {
+        if (strcmp(argv[j], "-loop") == 0) {
+            g_bEventLoop = 1;
+        } else if (strcmp(argv[j], "-wheel") == 0) {
+            g_bEventLoop = 1;
+            g_bWheel = 1;
+        } else if (strcmp(argv[j], "-drift") == 0) {
+            g_bDrift = 1;
+        } else if (strcmp(argv[j], "-count") == 0) {
+            g_bCountOnly = 1;
+        } else {
+            fprintf(stderr, "Usage: chime [-loop | -wheel] [-drift] [-count]\n");
+            return 1;
+        }
+    }
+    if (output_start(&TheOutput, STDOUT_FILENO, g_bCountOnly, g_bDrift) != 0) {
+        perror("chime: unable to start the output writer");
+        return 1;
+    }
+    if (g_bEventLoop && scheduler_start(&TheScheduler, g_bWheel, LoopChime, NULL) != 0) {
+        perror("chime: unable to start the scheduler");
+        return 1;
+    }
     
     while(1) {
         /* Prompt and flush to stdout */
         printf("CHIME>");
         fflush(stdout);
-        /* Wait for user input via fgets */
-        char* fgets_return = fgets(szBuffer, BUFFER_SIZE, stdin);
-        
-        if (fgets_return == NULL) {
+        /* Wait for user input, a whole line however long it is */
+        ssize_t nLength = tokenizer_read_line(&tok, stdin);
+
+        if (nLength < 0) {
             break;
         }
 
-        // remove the newline character and replace with null terminator and split the string
-        szBuffer[strlen(szBuffer) - 1] = '\0';
-        char* split = strtok(szBuffer, " ");
-        char* command[maxCommandLen];
-
-        // parse the command and arguments and count how many there are
-        int counter = 0;
-        while (split != NULL && counter < maxCommandLen) {
-            command[counter] = split;
-            split = strtok(NULL, " ");
-            counter++;
+        // split the line into the command and its arguments
+        int counter = tokenizer_split(&tok, tok.line, nLength);
+        char** command = tok.tokens;
+        if (counter < 0) {
+            printf("CHIME: %s\n", tok.szError);
+            continue;
         }
-        // set the last element to null
-        command[counter] = NULL;
 
         // if user clicked enter then continue
         if (counter == 0) {
@@ -86,14 +190,14 @@ int main (int argc, char *argv[]) {
             if (index == 0 && strcmp(command[1], "0") != 0) {
                 printf("CHIME: chime index must be an integer\n");
                 continue;
-            // check if index is in range
-            } else if (index < 0 || index >= MAX_THREADS) {
+            // check if index is in range (the event loop takes many more chimes than there are threads)
+            } else if (index < 0 || index >= (g_bEventLoop ? MAX_CHIMES : MAX_THREADS)) {
                 printf("CHIME: cannot adjust chime %d, out of range\n", index);
                 continue;
             }
 
-            // convert interval to float
-            float seconds = atof(command[2]);
+            // convert interval to float (the event loop keeps it as a double, in nanoseconds)
+            double seconds = atof(command[2]);
             // check if interval is valid (atof returns 0 if it can't convert)
             if (seconds == 0 && strcmp(command[2], "0") != 0) {
                 printf("CHIME: chime interval must be a floating point number\n");
@@ -104,34 +208,127 @@ int main (int argc, char *argv[]) {
                 continue;
             }
 
+            // keep the interval in nanoseconds from here on
+            int64_t intervalNs = (int64_t) (seconds * NSEC_PER_SEC + 0.5);
+            if (intervalNs <= 0) {
+                printf("CHIME: chime interval must be greater than 0\n");
+                continue;
+            }
+
+            if (g_bEventLoop) {
+                int result = scheduler_set(&TheScheduler, index, intervalNs);
+                if (result < 0) {
+                    printf("CHIME: out of memory for chime %d\n", index);
+                } else if (result == 0) {
+                    printf("Starting chime %d, interval of %.2f s\n", index, seconds);
+                } else {
+                    printf("Adjusting chime %d to interval of %.2f s\n", index, seconds);
+                }
+                continue;
+            }
+
             // if thread is not valid then create it
             if (TheThreads[index].bIsValid == 0) {
+                pthread_condattr_t attr;
+                pthread_condattr_init(&attr);
+                pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+                pthread_cond_init(&TheThreads[index].wake, &attr);
+                pthread_condattr_destroy(&attr);
+                pthread_mutex_init(&TheThreads[index].lock, NULL);
+
                 TheThreads[index].nIndex = index;
                 TheThreads[index].fChimeInterval = seconds;
+                TheThreads[index].intervalNs = intervalNs;
+                TheThreads[index].deadlineNs = now_ns() + intervalNs;
+                TheThreads[index].bStop = 0;
+                TheThreads[index].nFires = 0;
+                TheThreads[index].lastLateNs = 0;
+                TheThreads[index].maxLateNs = 0;
                 TheThreads[index].bIsValid = 1;
                 pthread_create(&TheThreads[index].ThreadID, NULL, ThreadChime, &TheThreads[index]);
                 printf("Starting thread %ld for chime %d, interval of %.2f s\n", TheThreads[index].ThreadID, index, seconds);
-            // if thread is valid then just change the interval
+            // if thread is valid then change the interval and wake it so the change counts from its last ding
             } else {
+                pthread_mutex_lock(&TheThreads[index].lock);
+                TheThreads[index].deadlineNs += intervalNs - TheThreads[index].intervalNs;
+                TheThreads[index].intervalNs = intervalNs;
                 TheThreads[index].fChimeInterval = seconds;
+                pthread_cond_signal(&TheThreads[index].wake);
+                pthread_mutex_unlock(&TheThreads[index].lock);
                 printf("Adjusting chime %d to interval of %.2f s\n", index, seconds);
             }
 
+        } else if (strcmp(command[0], "cancel") == 0) {
+            // call cancel
+            // if user didn't use 2 arguments (cancel, index) then exit
+            if (counter != 2) {
+                printf("CHIME: cancel command requires one argument\n");
+                continue;
+            }
+            int index = atoi(command[1]);
+            if (index == 0 && strcmp(command[1], "0") != 0) {
+                printf("CHIME: chime %s is not running\n", command[1]);
+                continue;
+            }
+            if (g_bEventLoop) {
+                if (index < 0 || index >= MAX_CHIMES || scheduler_cancel(&TheScheduler, index) != 0) {
+                    printf("CHIME: chime %d is not running\n", index);
+                    continue;
+                }
+            } else {
+                if (index < 0 || index >= MAX_THREADS || TheThreads[index].bIsValid == 0) {
+                    printf("CHIME: chime %d is not running\n", index);
+                    continue;
+                }
+                StopChime(&TheThreads[index]);
+            }
+            printf("Cancelled chime %d\n", index);
+
+        } else if (strcmp(command[0], "drift") == 0) {
+            // call drift
+            // how far the chimes have strayed from their schedules
+            if (g_bEventLoop) {
+                pthread_mutex_lock(&TheScheduler.lock);
+                printf("%llu dings, latest ever %.3f ms after its schedule, %llu skipped\n",
+                       (unsigned long long) g_nLoopFires, g_nLoopMaxLateNs / 1e6, (unsigned long long) TheScheduler.nMissed);
+                pthread_mutex_unlock(&TheScheduler.lock);
+                continue;
+            }
+            for (int i=0; i<MAX_THREADS; i++) {
+                if (TheThreads[i].bIsValid == 1) {
+                    pthread_mutex_lock(&TheThreads[i].lock);
+                    printf("Chime %d: %llu dings, last %.3f ms and latest ever %.3f ms after its schedule\n", i,
+                           (unsigned long long) TheThreads[i].nFires, TheThreads[i].lastLateNs / 1e6, TheThreads[i].maxLateNs / 1e6);
+                    pthread_mutex_unlock(&TheThreads[i].lock);
+                }
+            }
+
         } else if (strcmp(command[0], "exit") == 0) {
             // call exit
             // if user gave more arguments than they should have then exit
             if (counter > 1) {
                 printf("CHIME: exit command has no additional arguments\n");
             }
-            // stop looping and join all threads
-            g_bKeepLooping = 0;
+            // stop every chime (each one wakes straight away) and join all threads
+            if (g_bEventLoop) {
+                scheduler_stop(&TheScheduler);
+                printf("Stopped the chime scheduler (%llu chimes fired)\n", (unsigned long long) TheScheduler.nFires);
+            }
             for (int i=0; i<MAX_THREADS; i++) {
                 if (TheThreads[i].bIsValid == 1) {
                     printf("Joining chime %d (Thread %ld)\n", i, TheThreads[i].ThreadID);
-                    pthread_join(TheThreads[i].ThreadID, NULL);
+                    StopChime(&TheThreads[i]);
                     printf("Join complete for chime %d\n", i);
                 }
             }
+            // every chime has stopped, so the writer can drain what is left
+            fflush(stdout);
+            output_stop(&TheOutput);
+            if (g_bCountOnly) {
+                printf("%llu dings counted\n", (unsigned long long) TheOutput.nCounted);
+            } else if (TheOutput.nDropped > 0) {
+                printf("%llu dings dropped because the output ring was full\n", (unsigned long long) TheOutput.nDropped);
+            }
             printf("Exiting chime program...\n");
             break;
         // print message if user entered an invalid command
@@ -140,5 +337,6 @@ int main (int argc, char *argv[]) {
         }    
     }
 
+    tokenizer_free(&tok);
     return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,146 @@
+/* chime.h : Shared definitions for the chime event-loop scheduler */
+
+#ifndef CHIME_H
+#define CHIME_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Chime indexes the event loop accepts; the table grows as they are used */
+#define MAX_CHIMES          (1 << 20)
+
+#define NSEC_PER_SEC        1000000000LL
+
+/* Timing wheel shape, and the tick it turns at under chime -wheel */
+#define WHEEL_BITS          8
+#define WHEEL_SLOTS         (1 << WHEEL_BITS)
+#define WHEEL_LEVELS        4
+#define WHEEL_TICK_NS       1000000LL
+
+/* Output ring slots (a power of two), dings per writev and the longest ding line */
+#define OUTPUT_RING_SIZE    (1 << 16)
+#define OUTPUT_BATCH        256
+#define OUTPUT_LINE_LEN     128
+
+/* Called on the loop thread, with the scheduler locked, every time a chime
+   fires. deadlineNs is when it was due and firedNs when it actually ran,
+   both CLOCK_MONOTONIC. It must not call back into the scheduler. */
+typedef void (*ChimeFireFn)(int nIndex, int64_t intervalNs, int64_t deadlineNs, int64_t firedNs, void* pData);
+
+struct ChimeTimer {
+    int         bIsValid;
+    int64_t     intervalNs;
+    int64_t     deadlineNs;
+    int         nHeapIndex;         /* position in the heap */
+    int         nSlot;              /* wheel level * WHEEL_SLOTS + slot, -1 when not in the wheel */
+    int         nNext;              /* neighbours in the wheel slot's list */
+    int         nPrev;
+    uint64_t    nFires;             /* dings since it was started */
+};
+
+struct TimerHeap {
+    int*        slots;              /* chime numbers, earliest deadline first */
+    int         nCount;
+    int         nCapacity;
+};
+
+struct TimingWheel {
+    int64_t     tickNs;
+    int64_t     current;            /* next tick to run */
+    int         slots[WHEEL_LEVELS][WHEEL_SLOTS];   /* first chime in each slot, -1 when empty */
+    int         nCount;
+};
+
+/* Called by wheel_advance for each chime whose tick has come, already out of the wheel */
+typedef void (*WheelExpireFn)(int nIndex, void* pData);
+
+struct Scheduler {
+    int                 epollFd;
+    int                 timerFd;    /* armed for the earliest deadline, or every tick with the wheel */
+    int                 eventFd;    /* wakes the loop when the chimes change */
+
+    struct ChimeTimer*  chimes;     /* indexed by chime number */
+    int                 nCapacity;
+    int                 nChimes;
+
+    /* Deadlines are kept in one or the other */
+    int                 bWheel;
+    struct TimerHeap    heap;
+    struct TimingWheel  wheel;
+    int                 bTicking;
+
+    ChimeFireFn         onFire;
+    void*               pData;
+
+    uint64_t            nFires;
+    uint64_t            nMissed;    /* whole intervals skipped because the loop fell behind */
+
+    int                 bKeepLooping;
+    pthread_mutex_t     lock;
+    pthread_t           ThreadID;
+};
+
+/* One ding on its way to the writer, stamped when it fired */
+struct ChimeEvent {
+    int         nIndex;
+    uint64_t    nFire;
+    int64_t     intervalNs;
+    int64_t     deadlineNs;
+    int64_t     firedNs;
+};
+
+struct OutputSlot {
+    uint64_t            seq;        /* ticket + 1 once the event is published, ticket + ring size once it is free again */
+    struct ChimeEvent   event;
+};
+
+struct Output {
+    int                 fd;
+    int                 bCountOnly; /* count dings instead of writing them */
+    int                 bDrift;     /* add the fire number and offset from schedule */
+
+    struct OutputSlot*  slots;
+    uint64_t            nMask;
+    uint64_t            tail __attribute__((aligned(64)));  /* next ticket, shared by the producers */
+    uint64_t            head __attribute__((aligned(64)));  /* next slot to write, the writer's alone */
+
+    int                 eventFd;
+    int                 bSleeping;
+    int                 bStopping;
+    pthread_t           ThreadID;
+    char                lines[OUTPUT_BATCH][OUTPUT_LINE_LEN];
+
+    uint64_t            nWritten;
+    uint64_t            nBatches;
+    uint64_t            nDropped;   /* dings lost to a full ring */
+    uint64_t            nCounted;
+};
+
+/* Function prototypes */
+
+/* scheduler.c - every chime on one epoll/timerfd loop thread, on the heap or the wheel */
+int64_t now_ns();
+int     scheduler_start(struct Scheduler* pSched, int bWheel, ChimeFireFn onFire, void* pData);
+int     scheduler_set(struct Scheduler* pSched, int nIndex, int64_t intervalNs);
+int     scheduler_cancel(struct Scheduler* pSched, int nIndex);
+void    scheduler_stop(struct Scheduler* pSched);
+
+/* output.c - lock-free multi-producer ring drained by one writev writer thread */
+int     output_start(struct Output* pOutput, int fd, int bCountOnly, int bDrift);
+int     output_push(struct Output* pOutput, struct ChimeEvent* pEvent);
+void    output_stop(struct Output* pOutput);
+
+/* heap.c - O(log n) insert, re-time and remove, earliest deadline at the top */
+int     heap_insert(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex);
+void    heap_remove(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex);
+void    heap_update(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex);
+int     heap_top(struct TimerHeap* pHeap);
+void    heap_free(struct TimerHeap* pHeap);
+
+/* wheel.c - O(1) insert and remove, O(1) amortized per tick */
+void    wheel_init(struct TimingWheel* pWheel, int64_t tickNs, int64_t nowNs);
+void    wheel_insert(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int nIndex);
+void    wheel_remove(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int nIndex);
+void    wheel_advance(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int64_t nowNs, WheelExpireFn onExpire, void* pData);
+
+#endif
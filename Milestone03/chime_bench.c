@@ -0,0 +1,133 @@
+/*
+chime_bench.c - Jitter and throughput of the chime event-loop scheduler
+
+Starts a number of chimes with random intervals on the scheduler, lets them
+run, and records how late every fire due after the last one was added was
+against its deadline. Reports the
+fire rate, the lateness percentiles, how many fires were skipped because the
+loop fell behind, and the CPU time the whole run used.
+
+Usage: ./chime_bench [chimes] [seconds] [shortest interval ms] [longest interval ms] [heap | wheel]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "chime.h"
+
+#define DEFAULT_CHIMES      10000
+#define DEFAULT_SECONDS     5
+#define DEFAULT_MIN_MS      10
+#define DEFAULT_MAX_MS      100
+
+/* Lateness of every fire, filled in by the loop thread once every chime is set up */
+struct Samples {
+    int64_t*    lateness;
+    size_t      count;
+    size_t      capacity;
+    int64_t     startNs;
+};
+
+static void record_fire(int nIndex, int64_t intervalNs, int64_t deadlineNs, int64_t firedNs, void* pData) {
+    struct Samples* pSamples = (struct Samples*) pData;
+    if (deadlineNs >= pSamples->startNs && pSamples->count < pSamples->capacity) {
+        pSamples->lateness[pSamples->count++] = firedNs - deadlineNs;
+    }
+}
+
+static int compare_int64(const void* a, const void* b) {
+    int64_t x = *(const int64_t*) a;
+    int64_t y = *(const int64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(struct Samples* pSamples, double fraction) {
+    if (pSamples->count == 0) {
+        return 0;
+    }
+    size_t k = (size_t) (fraction * (pSamples->count - 1));
+    return pSamples->lateness[k] / 1e3;
+}
+
+int main(int argc, char* argv[]) {
+    int nChimes = DEFAULT_CHIMES;
+    int nSeconds = DEFAULT_SECONDS;
+    int nMinMs = DEFAULT_MIN_MS;
+    int nMaxMs = DEFAULT_MAX_MS;
+    int bWheel = 0;
+
+    if (argc > 1) {
+        nChimes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nSeconds = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        nMinMs = atoi(argv[3]);
+    }
+    if (argc > 4) {
+        nMaxMs = atoi(argv[4]);
+    }
+    if (argc > 5) {
+        bWheel = strcmp(argv[5], "wheel") == 0;
+    }
+    if (nChimes <= 0 || nChimes > MAX_CHIMES || nSeconds <= 0 || nMinMs <= 0 || nMaxMs < nMinMs) {
+        fprintf(stderr, "Usage: %s [chimes] [seconds] [shortest interval ms] [longest interval ms] [heap | wheel]\n", argv[0]);
+        return 1;
+    }
+
+    // enough room for every chime firing at its shortest interval for the whole run
+    struct Samples theSamples;
+    theSamples.count = 0;
+    theSamples.startNs = INT64_MAX;
+    theSamples.capacity = (size_t) nChimes * (nSeconds * 1000 / nMinMs + 1);
+    theSamples.lateness = (int64_t*) malloc(theSamples.capacity * sizeof(int64_t));
+    if (theSamples.lateness == NULL) {
+        fprintf(stderr, "chime_bench: unable to allocate %zu samples\n", theSamples.capacity);
+        return 1;
+    }
+
+    struct Scheduler theScheduler;
+    if (scheduler_start(&theScheduler, bWheel, record_fire, &theSamples) != 0) {
+        perror("chime_bench: unable to start the scheduler");
+        return 1;
+    }
+
+    srand(time(NULL));
+    int i;
+    for (i = 0; i < nChimes; i++) {
+        int64_t intervalNs = (nMinMs + (int64_t) rand() % (nMaxMs - nMinMs + 1)) * 1000000;
+        // a random sub-millisecond part so the deadlines do not all line up
+        intervalNs += rand() % 1000000;
+        scheduler_set(&theScheduler, i, intervalNs);
+    }
+    // only measure once the prompt thread has stopped adding chimes
+    pthread_mutex_lock(&theScheduler.lock);
+    theSamples.startNs = now_ns();
+    pthread_mutex_unlock(&theScheduler.lock);
+
+    sleep(nSeconds);
+    scheduler_stop(&theScheduler);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+
+    qsort(theSamples.lateness, theSamples.count, sizeof(int64_t), compare_int64);
+    printf("chimes          %d (%d-%d ms intervals) on the %s\n", nChimes, nMinMs, nMaxMs, bWheel ? "wheel" : "heap");
+    printf("fires           %llu in %d s, %.0f fires/s\n", (unsigned long long) theScheduler.nFires, nSeconds,
+           (double) theScheduler.nFires / nSeconds);
+    printf("missed          %llu\n", (unsigned long long) theScheduler.nMissed);
+    printf("lateness p50    %10.1f us\n", percentile_us(&theSamples, 0.50));
+    printf("lateness p99    %10.1f us\n", percentile_us(&theSamples, 0.99));
+    printf("lateness p99.9  %10.1f us\n", percentile_us(&theSamples, 0.999));
+    printf("lateness max    %10.1f us\n", percentile_us(&theSamples, 1.0));
+    printf("cpu time        %.2f s (%.1f%% of one core)\n", cpu, 100 * cpu / nSeconds);
+
+    free(theSamples.lateness);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+heap.c - Binary min-heap of chime deadlines
+
+The heap holds chime numbers, earliest deadline first, and every chime
+remembers where it sits so it can be re-timed or removed in O(log n) without
+searching for it.
+*/
+
+#include <stdlib.h>
+
+#include "chime.h"
+
+static int64_t heap_deadline(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nPosition) {
+    return chimes[pHeap->slots[nPosition]].deadlineNs;
+}
+
+static void heap_swap(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int a, int b) {
+    int nIndexA = pHeap->slots[a];
+    int nIndexB = pHeap->slots[b];
+    pHeap->slots[a] = nIndexB;
+    pHeap->slots[b] = nIndexA;
+    chimes[nIndexB].nHeapIndex = a;
+    chimes[nIndexA].nHeapIndex = b;
+}
+
+static void heap_up(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nPosition) {
+    while (nPosition > 0) {
+        int nParent = (nPosition - 1) / 2;
+        if (heap_deadline(pHeap, chimes, nParent) <= heap_deadline(pHeap, chimes, nPosition)) {
+            break;
+        }
+        heap_swap(pHeap, chimes, nParent, nPosition);
+        nPosition = nParent;
+    }
+}
+
+static void heap_down(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nPosition) {
+    while (1) {
+        int nSmallest = nPosition;
+        int nLeft = 2 * nPosition + 1;
+        int nRight = nLeft + 1;
+        if (nLeft < pHeap->nCount && heap_deadline(pHeap, chimes, nLeft) < heap_deadline(pHeap, chimes, nSmallest)) {
+            nSmallest = nLeft;
+        }
+        if (nRight < pHeap->nCount && heap_deadline(pHeap, chimes, nRight) < heap_deadline(pHeap, chimes, nSmallest)) {
+            nSmallest = nRight;
+        }
+        if (nSmallest == nPosition) {
+            break;
+        }
+        heap_swap(pHeap, chimes, nSmallest, nPosition);
+        nPosition = nSmallest;
+    }
+}
+
+int heap_insert(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex) {
+    if (pHeap->nCount == pHeap->nCapacity) {
+        int nCapacity = pHeap->nCapacity ? 2 * pHeap->nCapacity : 64;
+        int* slots = (int*) realloc(pHeap->slots, nCapacity * sizeof(int));
+        if (slots == NULL) {
+            return -1;
+        }
+        pHeap->slots = slots;
+        pHeap->nCapacity = nCapacity;
+    }
+    chimes[nIndex].nHeapIndex = pHeap->nCount;
+    pHeap->slots[pHeap->nCount++] = nIndex;
+    heap_up(pHeap, chimes, chimes[nIndex].nHeapIndex);
+    return 0;
+}
+
+void heap_remove(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex) {
+    int nPosition = chimes[nIndex].nHeapIndex;
+    pHeap->nCount--;
+    if (nPosition != pHeap->nCount) {
+        // the last entry takes the hole and moves whichever way it has to
+        heap_swap(pHeap, chimes, nPosition, pHeap->nCount);
+        heap_up(pHeap, chimes, nPosition);
+        heap_down(pHeap, chimes, nPosition);
+    }
+    chimes[nIndex].nHeapIndex = -1;
+}
+
+void heap_update(struct TimerHeap* pHeap, struct ChimeTimer* chimes, int nIndex) {
+    heap_up(pHeap, chimes, chimes[nIndex].nHeapIndex);
+    heap_down(pHeap, chimes, chimes[nIndex].nHeapIndex);
+}
+
+int heap_top(struct TimerHeap* pHeap) {
+    return pHeap->nCount > 0 ? pHeap->slots[0] : -1;
+}
+
+void heap_free(struct TimerHeap* pHeap) {
+    free(pHeap->slots);
+    pHeap->slots = NULL;
+    pHeap->nCount = 0;
+    pHeap->nCapacity = 0;
+}
@@ -0,0 +1,219 @@
+/*
+output.c - Batched, lock-free output stage for chime dings
+
+Chime threads and the event loop do not print. Each ding is pushed as a small
+event, stamped with the time it fired, into a bounded multi-producer ring
+(Vyukov's sequence-numbered slots): a producer claims a slot with one
+compare-and-swap on the tail and publishes it by bumping the slot's sequence
+number, so no producer ever takes a lock or waits on another.
+
+One writer thread owns the head. It takes up to OUTPUT_BATCH events at a
+time, formats them and hands the whole batch to the kernel with a single
+writev. When the ring is empty it sleeps on an eventfd, and a producer only
+writes to the eventfd when it sees the writer asleep, so a busy ring costs no
+system calls on the producer side. If the ring fills, dings are dropped and
+counted rather than blocking a chime.
+
+In counter-only mode nothing is queued or written; each ding just bumps a
+counter, which is what the benchmarks use to measure the scheduler alone.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+
+#include "chime.h"
+
+/* Producers must see the writer's bSleeping after publishing, and the writer
+   must see published slots after setting it, or a wake-up could be lost */
+#define FULL_FENCE()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static void output_format(struct Output* pOutput, struct ChimeEvent* pEvent, struct iovec* pIov, char* szLine) {
+    int nLength;
+    if (pOutput->bDrift) {
+        nLength = snprintf(szLine, OUTPUT_LINE_LEN, "Ding - Chime %d with an interval of %.2f s! (fire %llu, %+.3f ms from schedule)\n",
+                           pEvent->nIndex, (double) pEvent->intervalNs / NSEC_PER_SEC, (unsigned long long) pEvent->nFire,
+                           (pEvent->firedNs - pEvent->deadlineNs) / 1e6);
+    } else {
+        nLength = snprintf(szLine, OUTPUT_LINE_LEN, "Ding - Chime %d with an interval of %.2f s!\n",
+                           pEvent->nIndex, (double) pEvent->intervalNs / NSEC_PER_SEC);
+    }
+    if (nLength >= OUTPUT_LINE_LEN) {
+        nLength = OUTPUT_LINE_LEN - 1;
+    }
+    pIov->iov_base = szLine;
+    pIov->iov_len = nLength;
+}
+
+/* writev until every byte is out, picking up after short writes */
+static void output_write_all(int fd, struct iovec* iov, int nIov) {
+    while (nIov > 0) {
+        ssize_t nWritten = writev(fd, iov, nIov);
+        if (nWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("chime: writev");
+            return;
+        }
+        while (nIov > 0 && (size_t) nWritten >= iov->iov_len) {
+            nWritten -= iov->iov_len;
+            iov++;
+            nIov--;
+        }
+        if (nIov > 0) {
+            iov->iov_base = (char*) iov->iov_base + nWritten;
+            iov->iov_len -= nWritten;
+        }
+    }
+}
+
+/* Take the next published event, or return 0 if the ring is empty. Only the writer calls this. */
+static int output_pop(struct Output* pOutput, struct ChimeEvent* pEvent) {
+    struct OutputSlot* pSlot = &pOutput->slots[pOutput->head & pOutput->nMask];
+    uint64_t seq = __atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE);
+    if (seq != pOutput->head + 1) {
+        return 0;
+    }
+    *pEvent = pSlot->event;
+    // hand the slot back to the producers for the next lap round the ring
+    __atomic_store_n(&pSlot->seq, pOutput->head + pOutput->nMask + 1, __ATOMIC_RELEASE);
+    pOutput->head++;
+    return 1;
+}
+
+static void* output_writer(void* pData) {
+    struct Output* pOutput = (struct Output*) pData;
+    struct iovec iov[OUTPUT_BATCH];
+    struct ChimeEvent theEvent;
+    uint64_t value;
+
+    while (1) {
+        int nBatch = 0;
+        while (nBatch < OUTPUT_BATCH && output_pop(pOutput, &theEvent)) {
+            output_format(pOutput, &theEvent, &iov[nBatch], pOutput->lines[nBatch]);
+            nBatch++;
+        }
+        if (nBatch > 0) {
+            output_write_all(pOutput->fd, iov, nBatch);
+            pOutput->nWritten += nBatch;
+            pOutput->nBatches++;
+            continue;
+        }
+
+        // the ring is empty: announce we are going to sleep, then look once more
+        if (__atomic_load_n(&pOutput->bStopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        __atomic_store_n(&pOutput->bSleeping, 1, __ATOMIC_SEQ_CST);
+        FULL_FENCE();
+        struct OutputSlot* pSlot = &pOutput->slots[pOutput->head & pOutput->nMask];
+        if (__atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE) == pOutput->head + 1
+            || __atomic_load_n(&pOutput->bStopping, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&pOutput->bSleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (read(pOutput->eventFd, &value, sizeof(value)) < 0 && errno != EINTR) {
+            perror("chime: read");
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Wake the writer if it is (about to be) asleep */
+static void output_wake(struct Output* pOutput) {
+    uint64_t one = 1;
+    FULL_FENCE();
+    if (__atomic_load_n(&pOutput->bSleeping, __ATOMIC_RELAXED)
+        && __atomic_exchange_n(&pOutput->bSleeping, 0, __ATOMIC_ACQ_REL)) {
+        if (write(pOutput->eventFd, &one, sizeof(one)) < 0) {
+            perror("chime: write");
+        }
+    }
+}
+
+int output_start(struct Output* pOutput, int fd, int bCountOnly, int bDrift) {
+    memset(pOutput, 0, sizeof(struct Output));
+    pOutput->fd = fd;
+    pOutput->bCountOnly = bCountOnly;
+    pOutput->bDrift = bDrift;
+    if (bCountOnly) {
+        return 0;
+    }
+
+    pOutput->nMask = OUTPUT_RING_SIZE - 1;
+    pOutput->slots = (struct OutputSlot*) malloc(OUTPUT_RING_SIZE * sizeof(struct OutputSlot));
+    if (pOutput->slots == NULL) {
+        return -1;
+    }
+    // slot i is free for the producer whose ticket is i
+    uint64_t i;
+    for (i = 0; i < OUTPUT_RING_SIZE; i++) {
+        pOutput->slots[i].seq = i;
+    }
+
+    pOutput->eventFd = eventfd(0, EFD_CLOEXEC);
+    if (pOutput->eventFd < 0) {
+        return -1;
+    }
+    if (pthread_create(&pOutput->ThreadID, NULL, output_writer, pOutput) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Queue one ding. Safe from any number of threads at once; never blocks.
+   Returns 0, or -1 if the ring was full and the ding was dropped. */
+int output_push(struct Output* pOutput, struct ChimeEvent* pEvent) {
+    if (pOutput->bCountOnly) {
+        __atomic_fetch_add(&pOutput->nCounted, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    struct OutputSlot* pSlot;
+    uint64_t pos = __atomic_load_n(&pOutput->tail, __ATOMIC_RELAXED);
+    while (1) {
+        pSlot = &pOutput->slots[pos & pOutput->nMask];
+        uint64_t seq = __atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) (seq - pos);
+        if (diff == 0) {
+            // the slot is free for this ticket, try to claim it (a failed CAS reloads pos)
+            if (__atomic_compare_exchange_n(&pOutput->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the writer has not emptied this slot since the last lap: the ring is full
+            __atomic_fetch_add(&pOutput->nDropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        } else {
+            // another producer got this ticket first
+            pos = __atomic_load_n(&pOutput->tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    pSlot->event = *pEvent;
+    __atomic_store_n(&pSlot->seq, pos + 1, __ATOMIC_RELEASE);
+    output_wake(pOutput);
+    return 0;
+}
+
+/* Write out everything still queued and stop the writer. The producers must already have stopped. */
+void output_stop(struct Output* pOutput) {
+    if (pOutput->bCountOnly) {
+        return;
+    }
+    uint64_t one = 1;
+    __atomic_store_n(&pOutput->bStopping, 1, __ATOMIC_RELEASE);
+    if (write(pOutput->eventFd, &one, sizeof(one)) < 0) {
+        perror("chime: write");
+    }
+    pthread_join(pOutput->ThreadID, NULL);
+    close(pOutput->eventFd);
+    free(pOutput->slots);
+    pOutput->slots = NULL;
+}
@@ -0,0 +1,137 @@
+/*
+output_bench.c - Throughput of the chime output stage
+
+A number of threads each push a batch of dings as fast as they can, the way
+chime threads do when many chimes fire at once. The same work is done three
+ways: a printf per ding from every thread (what chime used to do), the
+lock-free ring drained by the writev writer (output.c), and counter-only
+mode, which is the cost of the chimes alone. Dings go to /dev/null unless a
+file is named, so the terminal is not what gets measured.
+
+Usage: ./output_bench [threads] [dings per thread] [file]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "chime.h"
+
+#define DEFAULT_THREADS     4
+#define DEFAULT_DINGS       1000000
+
+struct Producer {
+    int             nIndex;
+    int             nDings;
+    struct Output*  pOutput;        /* NULL to printf instead */
+    FILE*           pFile;
+};
+
+static void* produce(void* pData) {
+    struct Producer* pProducer = (struct Producer*) pData;
+    struct ChimeEvent theEvent;
+    int i;
+
+    theEvent.nIndex = pProducer->nIndex;
+    theEvent.intervalNs = NSEC_PER_SEC / 100;
+    for (i = 0; i < pProducer->nDings; i++) {
+        theEvent.nFire = i + 1;
+        theEvent.firedNs = now_ns();
+        theEvent.deadlineNs = theEvent.firedNs;
+        if (pProducer->pOutput == NULL) {
+            fprintf(pProducer->pFile, "Ding - Chime %d with an interval of %.2f s!\n",
+                    theEvent.nIndex, (double) theEvent.intervalNs / NSEC_PER_SEC);
+            continue;
+        }
+        // a full ring drops the ding; try again until there is room so every mode does the same work
+        while (output_push(pProducer->pOutput, &theEvent) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Run nThreads producers to completion and return the seconds it took, writer drain included.
+   *pProducers is how long the producers themselves took, which is what a chime thread waits for. */
+static double run(int nThreads, int nDings, struct Output* pOutput, FILE* pFile, double* pProducers) {
+    pthread_t threads[nThreads];
+    struct Producer producers[nThreads];
+    int i;
+
+    int64_t start = now_ns();
+    for (i = 0; i < nThreads; i++) {
+        producers[i].nIndex = i;
+        producers[i].nDings = nDings;
+        producers[i].pOutput = pOutput;
+        producers[i].pFile = pFile;
+        pthread_create(&threads[i], NULL, produce, &producers[i]);
+    }
+    for (i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    *pProducers = (now_ns() - start) / 1e9;
+    if (pOutput != NULL) {
+        output_stop(pOutput);
+    } else {
+        fflush(pFile);
+    }
+    return (now_ns() - start) / 1e9;
+}
+
+static void report(char* szMode, uint64_t nDings, double seconds, double producers) {
+    printf("%-8s %12llu dings %8.3f s %12.0f dings/s %8.1f ns/ding %8.1f ns/ding in the chime thread\n", szMode,
+           (unsigned long long) nDings, seconds, nDings / seconds, seconds * 1e9 / nDings, producers * 1e9 / nDings);
+}
+
+int main(int argc, char* argv[]) {
+    int nThreads = DEFAULT_THREADS;
+    int nDings = DEFAULT_DINGS;
+    char* szFile = "/dev/null";
+
+    if (argc > 1) {
+        nThreads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nDings = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        szFile = argv[3];
+    }
+    if (nThreads <= 0 || nThreads > 1024 || nDings <= 0) {
+        fprintf(stderr, "Usage: %s [threads] [dings per thread] [file]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(szFile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE* pFile = fdopen(fd, "w");
+    if (fd < 0 || pFile == NULL) {
+        perror("output_bench: open");
+        return 1;
+    }
+    uint64_t nTotal = (uint64_t) nThreads * nDings;
+    struct Output theOutput;
+    double seconds, producers;
+
+    seconds = run(nThreads, nDings, NULL, pFile, &producers);
+    report("printf", nTotal, seconds, producers);
+
+    if (output_start(&theOutput, fd, 0, 0) != 0) {
+        perror("output_bench: output_start");
+        return 1;
+    }
+    seconds = run(nThreads, nDings, &theOutput, NULL, &producers);
+    report("ring", theOutput.nWritten, seconds, producers);
+    printf("         %12.1f dings per writev, %llu pushes found the ring full\n",
+           (double) theOutput.nWritten / theOutput.nBatches, (unsigned long long) theOutput.nDropped);
+
+    output_start(&theOutput, fd, 1, 0);
+    seconds = run(nThreads, nDings, &theOutput, NULL, &producers);
+    report("count", theOutput.nCounted, seconds, producers);
+
+    fclose(pFile);
+    return 0;
+}
@@ -0,0 +1,297 @@
+/*
+scheduler.c - Event-loop scheduler for chime
+
+Every chime lives in one min-heap ordered by its next deadline (heap.c), and
+a single thread waits in epoll on two descriptors: a timerfd armed for the
+earliest deadline and an eventfd the prompt writes to whenever a chime is
+added or changed. There is no thread or sleep per chime, so tens of thousands
+of chimes cost one core, and deadlines are kept in nanoseconds of
+CLOCK_MONOTONIC.
+
+With the timing wheel (wheel.c) instead, the timerfd ticks every
+WHEEL_TICK_NS while there are chimes and each tick runs what is due. Adding,
+re-timing and cancelling become O(1), at the price of firing up to one tick
+late.
+
+Each chime's next deadline is its previous deadline plus the interval, never
+"now" plus the interval, so the schedule does not creep however late the loop
+wakes. If the loop falls more than an interval behind, the missed fires are
+skipped and counted rather than delivered in a burst.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "chime.h"
+
+int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Make room for chime number nIndex in the table */
+static int scheduler_grow(struct Scheduler* pSched, int nIndex) {
+    if (nIndex < pSched->nCapacity) {
+        return 0;
+    }
+    int nCapacity = pSched->nCapacity ? pSched->nCapacity : 64;
+    while (nCapacity <= nIndex) {
+        nCapacity *= 2;
+    }
+
+    struct ChimeTimer* chimes = (struct ChimeTimer*) realloc(pSched->chimes, nCapacity * sizeof(struct ChimeTimer));
+    if (chimes == NULL) {
+        return -1;
+    }
+    memset(chimes + pSched->nCapacity, 0, (nCapacity - pSched->nCapacity) * sizeof(struct ChimeTimer));
+    pSched->chimes = chimes;
+    pSched->nCapacity = nCapacity;
+    return 0;
+}
+
+/* Point the timerfd at the earliest deadline, or disarm it when there are no chimes */
+static void scheduler_arm(struct Scheduler* pSched) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+
+    if (pSched->bWheel) {
+        // the wheel needs a steady tick, but only while it has chimes
+        if ((pSched->nChimes > 0) == pSched->bTicking) {
+            return;
+        }
+        pSched->bTicking = pSched->nChimes > 0;
+        if (pSched->bTicking) {
+            // tick on whole multiples of the tick, which is where the wheel's slots fall due
+            int64_t first = (now_ns() / WHEEL_TICK_NS + 1) * WHEEL_TICK_NS;
+            its.it_value.tv_sec = first / NSEC_PER_SEC;
+            its.it_value.tv_nsec = first % NSEC_PER_SEC;
+            its.it_interval.tv_nsec = WHEEL_TICK_NS;
+        }
+        timerfd_settime(pSched->timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+        return;
+    }
+
+    int nIndex = heap_top(&pSched->heap);
+    if (nIndex >= 0) {
+        int64_t deadline = pSched->chimes[nIndex].deadlineNs;
+        its.it_value.tv_sec = deadline / NSEC_PER_SEC;
+        its.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+    }
+    timerfd_settime(pSched->timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Run one chime that is due and work out its next deadline */
+static void scheduler_run_chime(struct Scheduler* pSched, int nIndex, int64_t now) {
+    struct ChimeTimer* pChime = &pSched->chimes[nIndex];
+
+    pChime->nFires++;
+    pSched->onFire(nIndex, pChime->intervalNs, pChime->deadlineNs, now, pSched->pData);
+    pSched->nFires++;
+
+    pChime->deadlineNs += pChime->intervalNs;
+    if (pChime->deadlineNs <= now) {
+        // we fell behind, skip to the first deadline still in the future
+        int64_t nBehind = (now - pChime->deadlineNs) / pChime->intervalNs + 1;
+        pChime->deadlineNs += nBehind * pChime->intervalNs;
+        pSched->nMissed += nBehind;
+    }
+}
+
+/* What the wheel hands back for each chime whose tick came round */
+struct WheelFire {
+    struct Scheduler*   pSched;
+    int64_t             now;
+};
+
+static void scheduler_wheel_expire(int nIndex, void* pData) {
+    struct WheelFire* pFire = (struct WheelFire*) pData;
+    scheduler_run_chime(pFire->pSched, nIndex, pFire->now);
+    wheel_insert(&pFire->pSched->wheel, pFire->pSched->chimes, nIndex);
+}
+
+/* Fire every chime that is due and move each one to its next deadline */
+static void scheduler_fire(struct Scheduler* pSched) {
+    int64_t now = now_ns();
+
+    if (pSched->bWheel) {
+        struct WheelFire theFire;
+        theFire.pSched = pSched;
+        theFire.now = now;
+        wheel_advance(&pSched->wheel, pSched->chimes, now, scheduler_wheel_expire, &theFire);
+        return;
+    }
+
+    int nIndex;
+    while ((nIndex = heap_top(&pSched->heap)) >= 0 && pSched->chimes[nIndex].deadlineNs <= now) {
+        scheduler_run_chime(pSched, nIndex, now);
+        heap_update(&pSched->heap, pSched->chimes, nIndex);
+    }
+}
+
+static void* scheduler_loop(void* pData) {
+    struct Scheduler* pSched = (struct Scheduler*) pData;
+    struct epoll_event events[2];
+    uint64_t value;
+
+    while (1) {
+        int nEvents = epoll_wait(pSched->epollFd, events, 2, -1);
+        if (nEvents < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("chime: epoll_wait");
+            break;
+        }
+
+        // both descriptors are non-blocking, just clear whatever woke us
+        int i;
+        for (i = 0; i < nEvents; i++) {
+            if (read(events[i].data.fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+                perror("chime: read");
+            }
+        }
+
+        pthread_mutex_lock(&pSched->lock);
+        if (!pSched->bKeepLooping) {
+            pthread_mutex_unlock(&pSched->lock);
+            break;
+        }
+        scheduler_fire(pSched);
+        scheduler_arm(pSched);
+        pthread_mutex_unlock(&pSched->lock);
+    }
+    return NULL;
+}
+
+/* Wake the loop so it re-reads the heap */
+static void scheduler_wake(struct Scheduler* pSched) {
+    uint64_t one = 1;
+    if (write(pSched->eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("chime: write");
+    }
+}
+
+int scheduler_start(struct Scheduler* pSched, int bWheel, ChimeFireFn onFire, void* pData) {
+    memset(pSched, 0, sizeof(struct Scheduler));
+    pSched->bWheel = bWheel;
+    wheel_init(&pSched->wheel, WHEEL_TICK_NS, now_ns());
+    pSched->onFire = onFire;
+    pSched->pData = pData;
+    pSched->bKeepLooping = 1;
+
+    pSched->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    pSched->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pSched->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (pSched->timerFd < 0 || pSched->eventFd < 0 || pSched->epollFd < 0) {
+        return -1;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = pSched->timerFd;
+    if (epoll_ctl(pSched->epollFd, EPOLL_CTL_ADD, pSched->timerFd, &event) != 0) {
+        return -1;
+    }
+    event.data.fd = pSched->eventFd;
+    if (epoll_ctl(pSched->epollFd, EPOLL_CTL_ADD, pSched->eventFd, &event) != 0) {
+        return -1;
+    }
+
+    pthread_mutex_init(&pSched->lock, NULL);
+    if (pthread_create(&pSched->ThreadID, NULL, scheduler_loop, pSched) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/* Start chime nIndex, or change its interval. Returns 0 when it was started,
+   1 when it was adjusted, or -1 if there was no memory for it. */
+int scheduler_set(struct Scheduler* pSched, int nIndex, int64_t intervalNs) {
+    int nResult;
+
+    pthread_mutex_lock(&pSched->lock);
+    if (scheduler_grow(pSched, nIndex) != 0) {
+        pthread_mutex_unlock(&pSched->lock);
+        return -1;
+    }
+
+    struct ChimeTimer* pChime = &pSched->chimes[nIndex];
+    if (!pChime->bIsValid) {
+        pChime->intervalNs = intervalNs;
+        pChime->deadlineNs = now_ns() + intervalNs;
+        pChime->nFires = 0;
+        if (pSched->bWheel) {
+            // an idle wheel has not been turning, catch it up to now first
+            if (pSched->wheel.nCount == 0) {
+                wheel_advance(&pSched->wheel, pSched->chimes, now_ns(), NULL, NULL);
+            }
+            wheel_insert(&pSched->wheel, pSched->chimes, nIndex);
+        } else if (heap_insert(&pSched->heap, pSched->chimes, nIndex) != 0) {
+            pthread_mutex_unlock(&pSched->lock);
+            return -1;
+        }
+        pChime->bIsValid = 1;
+        pSched->nChimes++;
+        nResult = 0;
+    } else {
+        // the new interval counts from the last fire, not from when it was typed
+        pChime->deadlineNs += intervalNs - pChime->intervalNs;
+        pChime->intervalNs = intervalNs;
+        if (pSched->bWheel) {
+            wheel_remove(&pSched->wheel, pSched->chimes, nIndex);
+            wheel_insert(&pSched->wheel, pSched->chimes, nIndex);
+        } else {
+            heap_update(&pSched->heap, pSched->chimes, nIndex);
+        }
+        nResult = 1;
+    }
+    pthread_mutex_unlock(&pSched->lock);
+
+    scheduler_wake(pSched);
+    return nResult;
+}
+
+/* Stop chime nIndex. Returns 0, or -1 if it was not running. */
+int scheduler_cancel(struct Scheduler* pSched, int nIndex) {
+    pthread_mutex_lock(&pSched->lock);
+    if (nIndex < 0 || nIndex >= pSched->nCapacity || !pSched->chimes[nIndex].bIsValid) {
+        pthread_mutex_unlock(&pSched->lock);
+        return -1;
+    }
+    if (pSched->bWheel) {
+        wheel_remove(&pSched->wheel, pSched->chimes, nIndex);
+    } else {
+        heap_remove(&pSched->heap, pSched->chimes, nIndex);
+    }
+    pSched->chimes[nIndex].bIsValid = 0;
+    pSched->chimes[nIndex].nFires = 0;
+    pSched->nChimes--;
+    pthread_mutex_unlock(&pSched->lock);
+
+    scheduler_wake(pSched);
+    return 0;
+}
+
+void scheduler_stop(struct Scheduler* pSched) {
+    pthread_mutex_lock(&pSched->lock);
+    pSched->bKeepLooping = 0;
+    pthread_mutex_unlock(&pSched->lock);
+    scheduler_wake(pSched);
+    pthread_join(pSched->ThreadID, NULL);
+
+    pthread_mutex_destroy(&pSched->lock);
+    close(pSched->epollFd);
+    close(pSched->eventFd);
+    close(pSched->timerFd);
+    heap_free(&pSched->heap);
+    free(pSched->chimes);
+}
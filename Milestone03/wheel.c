@@ -0,0 +1,140 @@
+/*
+wheel.c - Hierarchical timing wheel for chime (Varghese and Lauck)
+
+Time is counted in ticks. Level 0 has a slot for each of the next 256 ticks;
+each level above covers 256 times the span of the one below, so four levels
+reach 2^32 ticks (49 days at 1 ms). A chime goes in the lowest level whose
+span covers its deadline, in the slot picked by that level's bits of the
+expiry tick. Slots are doubly linked lists, so adding, re-timing and
+cancelling a chime are a few pointer updates whatever the number of chimes.
+
+Each tick runs the chimes in one level 0 slot. When level 0 wraps round, the
+next slot of level 1 is emptied back into the wheel, which spreads its chimes
+over level 0, and so on upwards. A chime cascades at most once per level, so
+the work per tick is constant when amortized over the chimes.
+
+The lists link chime numbers rather than pointers, so the chime table can be
+reallocated as it grows.
+*/
+
+#include "chime.h"
+
+/* Chimes further out than the wheel reaches are parked at its far end and
+   cascade down again from there */
+#define WHEEL_MAX_TICKS     ((1LL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+void wheel_init(struct TimingWheel* pWheel, int64_t tickNs, int64_t nowNs) {
+    int nLevel, nSlot;
+    pWheel->tickNs = tickNs;
+    pWheel->current = nowNs / tickNs;
+    pWheel->nCount = 0;
+    for (nLevel = 0; nLevel < WHEEL_LEVELS; nLevel++) {
+        for (nSlot = 0; nSlot < WHEEL_SLOTS; nSlot++) {
+            pWheel->slots[nLevel][nSlot] = -1;
+        }
+    }
+}
+
+void wheel_insert(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int nIndex) {
+    struct ChimeTimer* pChime = &chimes[nIndex];
+
+    // round up so a chime never runs before its deadline
+    int64_t expires = (pChime->deadlineNs + pWheel->tickNs - 1) / pWheel->tickNs;
+    int64_t delta = expires - pWheel->current;
+    if (delta < 0) {
+        // already due, run it on the next tick
+        expires = pWheel->current;
+        delta = 0;
+    } else if (delta > WHEEL_MAX_TICKS) {
+        expires = pWheel->current + WHEEL_MAX_TICKS;
+        delta = WHEEL_MAX_TICKS;
+    }
+
+    int nLevel = 0;
+    while (nLevel < WHEEL_LEVELS - 1 && delta >= (1LL << (WHEEL_BITS * (nLevel + 1)))) {
+        nLevel++;
+    }
+    int nSlot = (expires >> (WHEEL_BITS * nLevel)) & (WHEEL_SLOTS - 1);
+
+    // push on the front of the slot's list
+    int* pHead = &pWheel->slots[nLevel][nSlot];
+    pChime->nSlot = nLevel * WHEEL_SLOTS + nSlot;
+    pChime->nPrev = -1;
+    pChime->nNext = *pHead;
+    if (*pHead >= 0) {
+        chimes[*pHead].nPrev = nIndex;
+    }
+    *pHead = nIndex;
+    pWheel->nCount++;
+}
+
+void wheel_remove(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int nIndex) {
+    struct ChimeTimer* pChime = &chimes[nIndex];
+    if (pChime->nPrev >= 0) {
+        chimes[pChime->nPrev].nNext = pChime->nNext;
+    } else {
+        pWheel->slots[pChime->nSlot / WHEEL_SLOTS][pChime->nSlot % WHEEL_SLOTS] = pChime->nNext;
+    }
+    if (pChime->nNext >= 0) {
+        chimes[pChime->nNext].nPrev = pChime->nPrev;
+    }
+    pChime->nSlot = -1;
+    pWheel->nCount--;
+}
+
+/* Take the whole list out of a slot, leaving it empty */
+static int wheel_detach(struct TimingWheel* pWheel, int nLevel, int nSlot) {
+    int nHead = pWheel->slots[nLevel][nSlot];
+    pWheel->slots[nLevel][nSlot] = -1;
+    return nHead;
+}
+
+/* Re-insert the chimes of one slot of a higher level, which lands them lower down */
+static void wheel_cascade(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int nLevel, int nSlot) {
+    int nIndex = wheel_detach(pWheel, nLevel, nSlot);
+    while (nIndex >= 0) {
+        int nNext = chimes[nIndex].nNext;
+        pWheel->nCount--;
+        wheel_insert(pWheel, chimes, nIndex);
+        nIndex = nNext;
+    }
+}
+
+void wheel_advance(struct TimingWheel* pWheel, struct ChimeTimer* chimes, int64_t nowNs, WheelExpireFn onExpire, void* pData) {
+    int64_t target = nowNs / pWheel->tickNs;
+
+    // an empty wheel can jump straight to now (and has nothing to call onExpire for)
+    if (pWheel->nCount == 0) {
+        if (target >= pWheel->current) {
+            pWheel->current = target + 1;
+        }
+        return;
+    }
+
+    while (pWheel->current <= target) {
+        int64_t tick = pWheel->current;
+        int nSlot = tick & (WHEEL_SLOTS - 1);
+
+        // level 0 wrapped, bring the next span down from the levels above
+        int nLevel = 1;
+        while (nSlot == 0 && nLevel < WHEEL_LEVELS) {
+            int nUpper = (tick >> (WHEEL_BITS * nLevel)) & (WHEEL_SLOTS - 1);
+            wheel_cascade(pWheel, chimes, nLevel, nUpper);
+            if (nUpper != 0) {
+                break;
+            }
+            nLevel++;
+        }
+
+        // move on first, so a chime re-added while it runs lands on a later tick
+        pWheel->current++;
+        int nIndex = wheel_detach(pWheel, 0, nSlot);
+        while (nIndex >= 0) {
+            int nNext = chimes[nIndex].nNext;
+            chimes[nIndex].nSlot = -1;
+            pWheel->nCount--;
+            onExpire(nIndex, pData);
+            nIndex = nNext;
+        }
+    }
+}
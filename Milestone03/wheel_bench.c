@@ -0,0 +1,187 @@
+/*
+wheel_bench.c - Stress the timing wheel against the binary heap
+
+A million chimes are created, re-timed to new random deadlines, run forward
+through simulated time so the earliest ones expire, and finally cancelled,
+once on the heap and once on the wheel. Time is simulated rather than read
+from the clock so only the data structures are measured. Each phase reports
+the average cost per operation, and the chimes each structure expired are
+checked against each other.
+
+Usage: ./wheel_bench [chimes] [longest deadline s] [seconds to run forward]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chime.h"
+
+#define DEFAULT_CHIMES      1000000
+#define DEFAULT_SPAN_S      60
+#define DEFAULT_RUN_S       5
+
+struct Expired {
+    struct ChimeTimer*  chimes;
+    int64_t             now;
+    uint64_t            count;
+    uint64_t            sum;        /* of the expired chime numbers, to compare the two runs */
+    int                 bEarly;     /* set if a chime expired before its deadline */
+};
+
+static double elapsed_ns(struct timespec* pStart) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - pStart->tv_sec) * 1e9 + (end.tv_nsec - pStart->tv_nsec);
+}
+
+static void report(char* structure, char* phase, double ns, uint64_t nOps) {
+    printf("%-6s %-10s %10llu ops %10.1f ns/op\n", structure, phase, (unsigned long long) nOps, nOps ? ns / nOps : 0);
+}
+
+static void wheel_expired(int nIndex, void* pData) {
+    struct Expired* pExpired = (struct Expired*) pData;
+    if (pExpired->chimes[nIndex].deadlineNs > pExpired->now) {
+        pExpired->bEarly = 1;
+    }
+    pExpired->chimes[nIndex].bIsValid = 0;
+    pExpired->count++;
+    pExpired->sum += nIndex;
+}
+
+int main(int argc, char* argv[]) {
+    int nChimes = DEFAULT_CHIMES;
+    int nSpanS = DEFAULT_SPAN_S;
+    int nRunS = DEFAULT_RUN_S;
+
+    if (argc > 1) {
+        nChimes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nSpanS = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        nRunS = atoi(argv[3]);
+    }
+    if (nChimes <= 0 || nSpanS <= 0 || nRunS <= 0) {
+        fprintf(stderr, "Usage: %s [chimes] [longest deadline s] [seconds to run forward]\n", argv[0]);
+        return 1;
+    }
+
+    // the same random deadlines for both structures
+    int64_t* firstDeadline = (int64_t*) malloc(nChimes * sizeof(int64_t));
+    int64_t* secondDeadline = (int64_t*) malloc(nChimes * sizeof(int64_t));
+    struct ChimeTimer* chimes = (struct ChimeTimer*) calloc(nChimes, sizeof(struct ChimeTimer));
+    if (firstDeadline == NULL || secondDeadline == NULL || chimes == NULL) {
+        fprintf(stderr, "wheel_bench: unable to allocate %d chimes\n", nChimes);
+        return 1;
+    }
+    srand(time(NULL));
+    int i;
+    int64_t spanNs = nSpanS * NSEC_PER_SEC;
+    for (i = 0; i < nChimes; i++) {
+        firstDeadline[i] = 1 + ((int64_t) rand() * RAND_MAX + rand()) % spanNs;
+        secondDeadline[i] = 1 + ((int64_t) rand() * RAND_MAX + rand()) % spanNs;
+    }
+    int64_t endNs = nRunS * NSEC_PER_SEC;
+
+    struct timespec start;
+    struct Expired heapExpired, wheelExpired;
+    uint64_t nCancelled;
+
+    /* The heap */
+    struct TimerHeap theHeap;
+    memset(&theHeap, 0, sizeof(theHeap));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        chimes[i].deadlineNs = firstDeadline[i];
+        chimes[i].bIsValid = 1;
+        heap_insert(&theHeap, chimes, i);
+    }
+    report("heap", "create", elapsed_ns(&start), nChimes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        chimes[i].deadlineNs = secondDeadline[i];
+        heap_update(&theHeap, chimes, i);
+    }
+    report("heap", "re-time", elapsed_ns(&start), nChimes);
+
+    memset(&heapExpired, 0, sizeof(heapExpired));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (heapExpired.now = 0; heapExpired.now <= endNs; heapExpired.now += WHEEL_TICK_NS) {
+        int nIndex;
+        while ((nIndex = heap_top(&theHeap)) >= 0 && chimes[nIndex].deadlineNs <= heapExpired.now) {
+            heap_remove(&theHeap, chimes, nIndex);
+            chimes[nIndex].bIsValid = 0;
+            heapExpired.count++;
+            heapExpired.sum += nIndex;
+        }
+    }
+    report("heap", "expire", elapsed_ns(&start), heapExpired.count);
+
+    nCancelled = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        if (chimes[i].bIsValid) {
+            heap_remove(&theHeap, chimes, i);
+            nCancelled++;
+        }
+    }
+    report("heap", "cancel", elapsed_ns(&start), nCancelled);
+    heap_free(&theHeap);
+
+    /* The wheel */
+    struct TimingWheel theWheel;
+    wheel_init(&theWheel, WHEEL_TICK_NS, 0);
+    memset(chimes, 0, nChimes * sizeof(struct ChimeTimer));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        chimes[i].deadlineNs = firstDeadline[i];
+        chimes[i].bIsValid = 1;
+        wheel_insert(&theWheel, chimes, i);
+    }
+    report("wheel", "create", elapsed_ns(&start), nChimes);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        wheel_remove(&theWheel, chimes, i);
+        chimes[i].deadlineNs = secondDeadline[i];
+        wheel_insert(&theWheel, chimes, i);
+    }
+    report("wheel", "re-time", elapsed_ns(&start), nChimes);
+
+    memset(&wheelExpired, 0, sizeof(wheelExpired));
+    wheelExpired.chimes = chimes;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (wheelExpired.now = 0; wheelExpired.now <= endNs; wheelExpired.now += WHEEL_TICK_NS) {
+        wheel_advance(&theWheel, chimes, wheelExpired.now, wheel_expired, &wheelExpired);
+    }
+    report("wheel", "expire", elapsed_ns(&start), wheelExpired.count);
+
+    nCancelled = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nChimes; i++) {
+        if (chimes[i].bIsValid) {
+            wheel_remove(&theWheel, chimes, i);
+            nCancelled++;
+        }
+    }
+    report("wheel", "cancel", elapsed_ns(&start), nCancelled);
+
+    // on tick boundaries the wheel must expire exactly what the heap did
+    if (wheelExpired.bEarly || wheelExpired.count != heapExpired.count || wheelExpired.sum != heapExpired.sum
+        || theWheel.nCount != 0) {
+        fprintf(stderr, "wheel_bench: the wheel expired %llu chimes, the heap %llu\n",
+                (unsigned long long) wheelExpired.count, (unsigned long long) heapExpired.count);
+        return 1;
+    }
+
+    free(chimes);
+    free(secondDeadline);
+    free(firstDeadline);
+    return 0;
+}
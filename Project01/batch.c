@@ -0,0 +1,296 @@
+/*
+batch.c - Transform many files in one bitflip process
+
+Input paths are collected up front (files, the regular files inside a
+directory, or names listed in a file / on stdin). A pool of worker threads
+then claims files one at a time, so while one worker waits on an open or a
+read another is transforming or writing. Each worker allocates its chunk
+buffer once and reuses it for every file it handles; files bigger than a
+chunk are walked chunk by chunk with pread/pwrite.
+
+A failed file is recorded and reported; it does not stop the batch.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "bitflip.h"
+
+struct BatchFile {
+    char*   in_filename;
+    char*   out_filename;
+    off_t   size;
+    int     nError;
+    double  fSeconds;
+};
+
+struct BatchJob {
+    struct BatchFile*   files;
+    int                 numFiles;
+    enum TransformMode  mode;
+    size_t              chunkSize;
+
+    /* Next file to hand out, under lock */
+    int                 nextFile;
+    pthread_mutex_t     lock;
+};
+
+struct BatchThreadInfo {
+    int                 nIndex;
+    pthread_t           threadId;
+    struct BatchJob*    job;
+};
+
+struct BatchThreadInfo TheBatchWorkers[MAX_THREADS];
+
+static struct BatchFile* batchFiles = NULL;
+static int numBatchFiles = 0;
+static int maxBatchFiles = 0;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void add_file(char* filename) {
+    if (numBatchFiles == maxBatchFiles) {
+        maxBatchFiles = maxBatchFiles ? maxBatchFiles * 2 : 64;
+        batchFiles = (struct BatchFile*) realloc(batchFiles, maxBatchFiles * sizeof(struct BatchFile));
+        if (batchFiles == NULL) {
+            fprintf(stderr, "Error: Unable to allocate the batch file list\n");
+            exit(1);
+        }
+    }
+    memset(&batchFiles[numBatchFiles], 0, sizeof(struct BatchFile));
+    batchFiles[numBatchFiles].in_filename = strdup(filename);
+    numBatchFiles++;
+}
+
+void batch_add_path(char* path) {
+    struct stat sb;
+    if (stat(path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+        // anything that is not a directory is checked when it is processed
+        add_file(path);
+        return;
+    }
+
+    // a directory contributes the regular files directly inside it
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Error: Unable to open directory %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* filename = (char*) malloc(strlen(path) + strlen(entry->d_name) + 2);
+        sprintf(filename, "%s/%s", path, entry->d_name);
+        if (stat(filename, &sb) == 0 && S_ISREG(sb.st_mode)) {
+            add_file(filename);
+        }
+        free(filename);
+    }
+    closedir(dir);
+}
+
+void batch_add_list(char* list_filename) {
+    FILE* fp = stdin;
+    if (strcmp(list_filename, "-") != 0) {
+        fp = fopen(list_filename, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "Error: Unable to open list %s: %s\n", list_filename, strerror(errno));
+            exit(1);
+        }
+    }
+
+    // one path per line, blank lines are skipped
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, fp)) != -1) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[length - 1] = '\0';
+        }
+        if (line[0] != '\0') {
+            batch_add_path(line);
+        }
+    }
+    free(line);
+
+    if (fp != stdin) {
+        fclose(fp);
+    }
+}
+
+/* Transform one file with the worker's reusable buffer
+   @returns 0 on success, an errno value otherwise */
+static int transform_one(struct BatchFile* pFile, enum TransformMode mode, char* buffer, size_t chunkSize) {
+    struct stat sb;
+    int error = 0;
+
+    int fdIn = open(pFile->in_filename, O_RDONLY);
+    if (fdIn < 0) {
+        return errno;
+    }
+    if (fstat(fdIn, &sb) != 0) {
+        error = errno;
+        close(fdIn);
+        return error;
+    }
+    if (!S_ISREG(sb.st_mode)) {
+        close(fdIn);
+        return EINVAL;
+    }
+    pFile->size = sb.st_size;
+
+    int fdOut = open(pFile->out_filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fdOut < 0) {
+        error = errno;
+        close(fdIn);
+        return error;
+    }
+
+    // same placement rule as the parallel engine: mirrored offsets when reversing
+    off_t inOffset;
+    for (inOffset = 0; inOffset < sb.st_size; inOffset += chunkSize) {
+        size_t length = chunkSize;
+        if (inOffset + (off_t) length > sb.st_size) {
+            length = sb.st_size - inOffset;
+        }
+        off_t outOffset = inOffset;
+        if (mode != MODE_BITFLIP) {
+            outOffset = sb.st_size - inOffset - length;
+        }
+
+        if (pread_full(fdIn, buffer, length, inOffset) != 0) {
+            error = errno;
+            break;
+        }
+        transform_buffer(buffer, length, mode);
+        if (pwrite_full(fdOut, buffer, length, outOffset) != 0) {
+            error = errno;
+            break;
+        }
+    }
+
+    if (close(fdOut) != 0 && error == 0) {
+        error = errno;
+    }
+    close(fdIn);
+
+    if (error != 0) {
+        unlink(pFile->out_filename);
+    }
+    return error;
+}
+
+static void* batch_worker(void* pData) {
+    struct BatchThreadInfo* pThreadInfo = (struct BatchThreadInfo*) pData;
+    struct BatchJob* pJob = pThreadInfo->job;
+
+    // one buffer per worker, reused for every file it picks up
+    char* buffer = (char*) malloc(pJob->chunkSize);
+
+    while (1) {
+        pthread_mutex_lock(&pJob->lock);
+        int index = pJob->nextFile;
+        if (index < pJob->numFiles) {
+            pJob->nextFile++;
+        }
+        pthread_mutex_unlock(&pJob->lock);
+
+        if (index >= pJob->numFiles) {
+            break;
+        }
+
+        struct BatchFile* pFile = &pJob->files[index];
+        double start = now_seconds();
+        pFile->nError = buffer ? transform_one(pFile, pJob->mode, buffer, pJob->chunkSize) : ENOMEM;
+        pFile->fSeconds = now_seconds() - start;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+int batch_run(enum TransformMode mode, char* extension, size_t chunkSize, int nThreads) {
+    struct BatchJob theJob;
+
+    if (numBatchFiles == 0) {
+        fprintf(stderr, "Error: No input files for the batch!\n");
+        exit(1);
+    }
+
+    int i;
+    for (i = 0; i < numBatchFiles; i++) {
+        char* in_filename = batchFiles[i].in_filename;
+        batchFiles[i].out_filename = (char*) malloc(strlen(in_filename) + strlen(extension) + 1);
+        strcpy(batchFiles[i].out_filename, in_filename);
+        strcat(batchFiles[i].out_filename, extension);
+    }
+
+    theJob.files = batchFiles;
+    theJob.numFiles = numBatchFiles;
+    theJob.mode = mode;
+    theJob.chunkSize = chunkSize;
+    theJob.nextFile = 0;
+    pthread_mutex_init(&theJob.lock, NULL);
+
+    if (nThreads > numBatchFiles) {
+        nThreads = numBatchFiles;
+    }
+
+    double start = now_seconds();
+
+    /* Create the threads */
+    for (i = 0; i < nThreads; i++) {
+        TheBatchWorkers[i].nIndex = i;
+        TheBatchWorkers[i].job = &theJob;
+        pthread_create(&TheBatchWorkers[i].threadId, NULL, batch_worker, &TheBatchWorkers[i]);
+    }
+
+    /* Join the threads */
+    for (i = 0; i < nThreads; i++) {
+        pthread_join(TheBatchWorkers[i].threadId, NULL);
+    }
+
+    double elapsed = now_seconds() - start;
+
+    // per-file results in input order, then the totals
+    int numFailed = 0;
+    long long totalBytes = 0;
+    for (i = 0; i < numBatchFiles; i++) {
+        struct BatchFile* pFile = &batchFiles[i];
+        if (pFile->nError != 0) {
+            fprintf(stderr, "Error: %s: %s\n", pFile->in_filename, strerror(pFile->nError));
+            numFailed++;
+        } else {
+            fprintf(stdout, "%s -> %s (%lld bytes, %.3f ms)\n", pFile->in_filename, pFile->out_filename,
+                    (long long) pFile->size, pFile->fSeconds * 1000);
+            totalBytes += pFile->size;
+        }
+    }
+
+    fprintf(stdout, "Batch: %d files, %d failed, %lld bytes in %.3f s (%.1f MiB/s, %.0f files/s)\n",
+            numBatchFiles, numFailed, totalBytes, elapsed,
+            totalBytes / 1048576.0 / elapsed, numBatchFiles / elapsed);
+
+    for (i = 0; i < numBatchFiles; i++) {
+        free(batchFiles[i].in_filename);
+        free(batchFiles[i].out_filename);
+    }
+    free(batchFiles);
+    batchFiles = NULL;
+    numBatchFiles = maxBatchFiles = 0;
+    pthread_mutex_destroy(&theJob.lock);
+
+    return numFailed;
+}
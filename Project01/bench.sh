@@ -0,0 +1,76 @@
+#!/bin/bash
+# bench.sh - Compare the bitflip engines against a plain disk copy
+#
+# Usage: ./bench.sh [size in MiB] [scratch directory]
+#
+# The copy through dd is the baseline for what the disk can sustain reading
+# one file and writing another. The streaming engine should land close to it,
+# and the parallel and io_uring engines should keep scaling with threads and
+# queue depth until they reach it. The mmap engine is compared with the
+# read/write path on both cold and hot caches.
+
+SIZE_MB=${1:-2048}
+DIR=${2:-.}
+INPUT="$DIR/bench-input.bin"
+OUTPUT="$DIR/bench-output.bin"
+
+if [ ! -x ./bitflip ]; then
+    echo "bench.sh: build bitflip first (make)" >&2
+    exit 1
+fi
+
+# drop the page cache between runs when we are allowed to, so we measure the disk
+drop_caches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+}
+
+# CACHE=cold drops the page cache before each run, CACHE=hot reads the input first
+CACHE=cold
+
+# run a command and print its throughput in MiB/s
+measure() {
+    local label=$1
+    shift
+    rm -f "$OUTPUT"
+    if [ "$CACHE" = "hot" ]; then
+        cat "$INPUT" > /dev/null
+    else
+        drop_caches
+    fi
+    local start=$(date +%s.%N)
+    "$@" > /dev/null || exit 1
+    sync
+    local end=$(date +%s.%N)
+    awk -v label="$label" -v mb="$SIZE_MB" -v start="$start" -v end="$end" \
+        'BEGIN { printf "%-32s %8.2f s %10.1f MiB/s\n", label, end - start, mb / (end - start) }'
+}
+
+echo "Creating $SIZE_MB MiB input file..."
+dd if=/dev/urandom of="$INPUT" bs=1M count="$SIZE_MB" status=none
+
+measure "dd copy" dd if="$INPUT" of="$OUTPUT" bs=1M status=none
+measure "bitflip -stream -bf" ./bitflip -bf -stream "$INPUT" -o "$OUTPUT"
+measure "bitflip -stream -r" ./bitflip -r -stream "$INPUT" -o "$OUTPUT"
+measure "bitflip -stream -bfr" ./bitflip -bfr -stream "$INPUT" -o "$OUTPUT"
+
+# the parallel engine should scale with threads until the device saturates
+for THREADS in 1 2 4 8 16; do
+    measure "bitflip -threads $THREADS -r" ./bitflip -r -threads "$THREADS" "$INPUT" -o "$OUTPUT"
+done
+
+# io_uring engine across queue depths
+for QD in 1 2 4 8 16 32 64; do
+    measure "bitflip -uring -qd $QD -r" ./bitflip -r -uring -qd "$QD" "$INPUT" -o "$OUTPUT"
+done
+
+# read/write against the mmap engine, with the input on disk and in the page cache
+for CACHE in cold hot; do
+    measure "bitflip -stream -bfr ($CACHE)" ./bitflip -bfr -stream "$INPUT" -o "$OUTPUT"
+    measure "bitflip -mmap -bfr ($CACHE)" ./bitflip -bfr -mmap "$INPUT" -o "$OUTPUT"
+    measure "bitflip -inplace -bfr ($CACHE)" ./bitflip -bfr -inplace "$INPUT"
+done
+
+rm -f "$INPUT" "$OUTPUT"
@@ -4,22 +4,52 @@
 #include <string.h>
 #include <sys/stat.h>
 
+#include "bitflip.h"
+
 long int nMaxFileSize = 25000;
 char* userRequest = "-bf";
 char* out_filename = NULL;
 int given_out_filename = 0;
 char* in_filename = NULL;
+int bStream = 0;
+long int nChunkSize = DEFAULT_CHUNK_SIZE;
+int nThreads = 0;
+int bMap = 0;
+int bInPlace = 0;
+int bBatch = 0;
+int bUring = 0;
+int bChecksum = 0;
+int bVerify = 0;
+int nQueueDepth = DEFAULT_QUEUE_DEPTH;
+char* list_filename = NULL;
+char** in_filenames = NULL;
+int in_filename_count = 0;
+
+void print_usage() {
+    fprintf(stderr, "Potential Arguments:\n");
+    fprintf(stderr, "\t-maxsize XXX: Set the maximum file size to XXX bytes.\n");
+    fprintf(stderr, "\t-o XXX: Set the output file name to XXX.\n");
+    fprintf(stderr, "\t-r: Return ther reverse order of bytes.\n");
+    fprintf(stderr, "\t-bf: Return the bit-flipped order of bytes.\n");
+    fprintf(stderr, "\t-stream: Process the file in chunks with bounded memory (no size limit).\n");
+    fprintf(stderr, "\t-chunk XXX: Set the streaming chunk size to XXX bytes.\n");
+    fprintf(stderr, "\t-threads N: Transform chunks in parallel on N threads (no size limit).\n");
+    fprintf(stderr, "\t-mmap: Transform directly between memory mappings of the files (no size limit).\n");
+    fprintf(stderr, "\t-inplace: Transform the input file itself through a shared mapping.\n");
+    fprintf(stderr, "\t-uring: Keep several chunk reads and writes in flight with io_uring (no size limit).\n");
+    fprintf(stderr, "\t-qd N: Set the number of chunks -uring keeps in flight.\n");
+    fprintf(stderr, "\t-checksum: Print the CRC32C of the input and output, computed in the same pass.\n");
+    fprintf(stderr, "\t-verify: Check that transforming twice gives the input back, without writing a file.\n");
+    fprintf(stderr, "\t-batch: Transform every input file or directory in one process (-threads sets the pool size).\n");
+    fprintf(stderr, "\t-list XXX: Add the files named in XXX to the batch, one per line (- for stdin).\n");
+    fprintf(stderr, "\t-help: Print this help message.\n");
+}
 
 void check_num_args(int argc) {
     // there should be three arguments: the program name, the filename, and the lookup byte
     if (argc < 2) {
         fprintf(stderr, "Error: Too few inputs!\n");
-        fprintf(stderr, "Potential Arguments:\n");
-        fprintf(stderr, "\t-maxsize XXX: Set the maximum file size to XXX bytes.\n");
-        fprintf(stderr, "\t-o XXX: Set the output file name to XXX.\n");
-        fprintf(stderr, "\t-r: Return ther reverse order of bytes.\n");
-        fprintf(stderr, "\t-bf: Return the bit-flipped order of bytes.\n");
-        fprintf(stderr, "\t-help: Print this help message.\n");
+        print_usage();
         exit(1);
     }
 }
@@ -30,19 +60,16 @@ void process_args(int argc, char* argv[]) {
     int request_count = 0;
     int maxsize_count = 0;
     int out_filename_count = 0;
-    int in_filename_count = 0;
+
+    // every non-flag argument is an input, only batch mode accepts more than one
+    in_filenames = (char**) malloc(argc * sizeof(char*));
 
     while (i < argc) {
         
         if (strcmp(argv[i], "-help") == 0) {
-            fprintf(stderr, "Potential Arguments:\n");
-            fprintf(stderr, "\t-maxsize XXX: Set the maximum file size to XXX bytes.\n");
-            fprintf(stderr, "\t-o XXX: Set the output file name to XXX.\n");
-            fprintf(stderr, "\t-r: Return ther reverse order of bytes.\n");
-            fprintf(stderr, "\t-bf: Return the bit-flipped order of bytes.\n");
-            fprintf(stderr, "\t-help: Print this help message.\n");
+            print_usage();
             exit(1);
-        } else if (strcmp(argv[i], "-bfr") == 0 || strcmp(argv[i], "-r") == 0) {
+        } else if (strcmp(argv[i], "-bf") == 0 || strcmp(argv[i], "-bfr") == 0 || strcmp(argv[i], "-r") == 0) {
             userRequest = argv[i];
             request_count++;
 
@@ -99,21 +126,79 @@ void process_args(int argc, char* argv[]) {
                 exit(1);
             }
 
-        } else if (argv[i][0] != '-') {
-            in_filename = strdup(argv[i]);
-            in_filename_count++;
+        } else if (strcmp(argv[i], "-stream") == 0) {
+            bStream = 1;
+        } else if (strcmp(argv[i], "-chunk") == 0) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Error: Too few inputs!\n");
+                exit(1);
+            }
+            char* endptr = NULL;
+            nChunkSize = strtol(argv[i], &endptr, 10);
+            // check if the user entered a valid integer
+            if (*endptr != '\0' || nChunkSize <= 0) {
+                fprintf(stderr, "Error: Invalid chunk argument!\n");
+                exit(1);
+            } else if (nChunkSize > MAX_CHUNK_SIZE) {
+                fprintf(stderr, "Error: Chunk size exceeds %d bytes!\n", MAX_CHUNK_SIZE);
+                exit(1);
+            }
+
+        } else if (strcmp(argv[i], "-mmap") == 0) {
+            bMap = 1;
+        } else if (strcmp(argv[i], "-inplace") == 0) {
+            bMap = 1;
+            bInPlace = 1;
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Error: Too few inputs!\n");
+                exit(1);
+            }
+            char* endptr = NULL;
+            nThreads = strtol(argv[i], &endptr, 10);
+            // check if the user entered a valid integer
+            if (*endptr != '\0' || nThreads <= 0 || nThreads > MAX_THREADS) {
+                fprintf(stderr, "Error: -threads requires a positive integer value that is at most %d\n", MAX_THREADS);
+                exit(1);
+            }
+
+        } else if (strcmp(argv[i], "-uring") == 0) {
+            bUring = 1;
+        } else if (strcmp(argv[i], "-qd") == 0) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Error: Too few inputs!\n");
+                exit(1);
+            }
+            char* endptr = NULL;
+            nQueueDepth = strtol(argv[i], &endptr, 10);
+            // check if the user entered a valid integer
+            if (*endptr != '\0' || nQueueDepth <= 0 || nQueueDepth > MAX_QUEUE_DEPTH) {
+                fprintf(stderr, "Error: -qd requires a positive integer value that is at most %d\n", MAX_QUEUE_DEPTH);
+                exit(1);
+            }
 
-            if (in_filename_count > 1) {
-                fprintf(stderr, "Error: Too many input filename arguments!\n");
+        } else if (strcmp(argv[i], "-checksum") == 0) {
+            bChecksum = 1;
+        } else if (strcmp(argv[i], "-verify") == 0) {
+            bVerify = 1;
+        } else if (strcmp(argv[i], "-batch") == 0) {
+            bBatch = 1;
+        } else if (strcmp(argv[i], "-list") == 0) {
+            i++;
+            if (i == argc) {
+                fprintf(stderr, "Error: Too few inputs!\n");
                 exit(1);
             }
+            list_filename = argv[i];
+            bBatch = 1;
+        } else if (argv[i][0] != '-') {
+            in_filenames[in_filename_count] = argv[i];
+            in_filename_count++;
         } else {
-            fprintf(stderr, "Potential Arguments:\n");
-            fprintf(stderr, "\t-maxsize XXX: Set the maximum file size to XXX bytes.\n");
-            fprintf(stderr, "\t-o XXX: Set the output file name to XXX.\n");
-            fprintf(stderr, "\t-r: Return ther reverse order of bytes.\n");
-            fprintf(stderr, "\t-bf: Return the bit-flipped order of bytes.\n");
-            fprintf(stderr, "\t-help: Print this help message.\n");
+            print_usage();
             exit(1);
         }
 
@@ -121,6 +206,14 @@ void process_args(int argc, char* argv[]) {
     
     }
 
+    if (in_filename_count > 1 && !bBatch) {
+        fprintf(stderr, "Error: Too many input filename arguments!\n");
+        exit(1);
+    }
+    if (in_filename_count > 0) {
+        in_filename = strdup(in_filenames[0]);
+    }
+
 }
 
 struct stat check_file_stats(char* filename) {
@@ -135,7 +228,8 @@ struct stat check_file_stats(char* filename) {
         exit(1);
     }
 
-    if (sb.st_size > nMaxFileSize) {
+    // the streaming, parallel, mmap and io_uring engines have no size limit
+    if (!bStream && nThreads == 0 && !bMap && !bUring && sb.st_size > nMaxFileSize) {
         fprintf(stderr, "Error: The file is over %ld bytes (file size was %lld bytes)\n", nMaxFileSize, (long long) sb.st_size);
         exit(1);
     }
@@ -158,25 +252,6 @@ void check_size(struct stat sb, int result) {
     }
 }
 
-void bitflip(char* buffer, int length) {
-    // flip every bit in buffer with XOR
-    int i;
-    for (i = 0; i < length; i++) {
-        buffer[i] = buffer[i] ^ 0xFF;
-    }
-}
-
-void reverse(char* buffer, int length) {
-    // reverse the order of the buffer by swapping the first and last bytes, then the second and second to last, etc.
-    int i, j = length-1, temp;
-    for (i=0; i < j; i++) {
-        temp = buffer[j];
-        buffer[j] = buffer[i];
-        buffer[i] = temp;
-        j--;
-    }
-}
-
 void write_to_file(char* buffer, int length, char* filename) {
 
     struct stat sb;
@@ -193,6 +268,49 @@ void write_to_file(char* buffer, int length, char* filename) {
     fclose(fp);
 }
 
+enum TransformMode request_mode(char** pExtension) {
+    // map the user's request to a transform and its output extension
+    if (strcmp(userRequest, "-bf") == 0) {
+        *pExtension = ".bf";
+        return MODE_BITFLIP;
+    } else if (strcmp(userRequest, "-r") == 0) {
+        *pExtension = ".r";
+        return MODE_REVERSE;
+    } else {
+        *pExtension = ".bfr";
+        return MODE_BITFLIP_REVERSE;
+    }
+}
+
+int run_batch() {
+    // batch outputs are always named after their input
+    if (given_out_filename) {
+        fprintf(stderr, "Error: -o cannot be used with -batch!\n");
+        exit(1);
+    }
+    if (bMap || bStream || bUring || bChecksum || bVerify) {
+        fprintf(stderr, "Error: -mmap, -inplace, -stream, -uring, -checksum and -verify cannot be used with -batch!\n");
+        exit(1);
+    }
+
+    int i;
+    for (i = 0; i < in_filename_count; i++) {
+        batch_add_path(in_filenames[i]);
+    }
+    if (list_filename) {
+        batch_add_list(list_filename);
+    }
+
+    char* extension;
+    enum TransformMode mode = request_mode(&extension);
+    int numFailed = batch_run(mode, extension, nChunkSize, nThreads > 0 ? nThreads : DEFAULT_BATCH_THREADS);
+
+    free(in_filename);
+    free(in_filenames);
+
+    return numFailed > 0 ? 1 : 0;
+}
+
 int main(int argc, char* argv[]) {
 
     check_num_args(argc); // check the number of arguments
@@ -202,49 +320,102 @@ int main(int argc, char* argv[]) {
     //char* in_filename;
     
     //in_filename = strdup(argv[1]);
+    if (bBatch) {
+        return run_batch();
+    }
     if (!in_filename) {
         fprintf(stderr, "Error: No input file specified!\n");
         exit(1);
     }
+    if (bInPlace && given_out_filename) {
+        fprintf(stderr, "Error: -inplace does not take an output file name!\n");
+        exit(1);
+    }
+    if (bVerify && given_out_filename) {
+        fprintf(stderr, "Error: -verify does not write an output file!\n");
+        exit(1);
+    }
+    // the integrity stage runs inside the default, -stream and -threads engines
+    if ((bChecksum || bVerify) && (bMap || bUring)) {
+        fprintf(stderr, "Error: -checksum and -verify cannot be used with -mmap, -inplace or -uring!\n");
+        exit(1);
+    }
     
     struct stat sb = check_file_stats(in_filename); // checks for object's existence, type, and size
     check_readability(in_filename); // checks for read permissions
 
-    FILE* fp = fopen(in_filename, "r");
-    char* buffer = (char*) malloc(sb.st_size * sizeof(char)); // allocate buffer according to filesize
-    size_t result = fread(buffer, sizeof(char), sb.st_size, fp);
-    check_size(sb, result); // check the read was successful
-
-    // reverse and/or bitflip the buffer based on the user's input and assign appropriate extension
+    // pick the transform and the appropriate extension based on the user's input
     char* extension;
-    if (strcmp(userRequest, "-bf") == 0) {
-        bitflip(buffer, sb.st_size);
-        extension = ".bf";
-    } else if (strcmp(userRequest, "-r") == 0) {
-        reverse(buffer, sb.st_size);
-        extension = ".r";
-    } else {
-        bitflip(buffer, sb.st_size);
-        reverse(buffer, sb.st_size);
-        extension = ".bfr";
-    }
+    enum TransformMode mode = request_mode(&extension);
 
     // allocate memory for ouput file and add the appropriate extension
-    if (given_out_filename == 0) {
-        out_filename = strdup(in_filename);
-        out_filename = strcat(out_filename, extension);
+    if (given_out_filename == 0 && !bInPlace && !bVerify) {
+        out_filename = (char*) malloc(strlen(in_filename) + strlen(extension) + 1);
+        strcpy(out_filename, in_filename);
+        strcat(out_filename, extension);
     }
 
-    write_to_file(buffer, sb.st_size, out_filename); // write the buffer to the output file
+    struct Checksums sums;
+    memset(&sums, 0, sizeof(sums));
+    struct Checksums* pSums = (bChecksum || bVerify) ? &sums : NULL;
+
+    if (bInPlace) {
+        // no output file, the input is transformed through a shared mapping
+        map_file(in_filename, NULL, mode);
+    } else if (bMap) {
+        // transform straight from the input mapping into the output mapping
+        map_file(in_filename, out_filename, mode);
+    } else if (bUring) {
+        // keep nQueueDepth chunk reads and writes in flight at once
+        uring_file(in_filename, out_filename, mode, nChunkSize, nQueueDepth);
+    } else if (nThreads > 0) {
+        // workers pread, transform and pwrite disjoint chunks straight to their final offsets
+        parallel_file(in_filename, out_filename, mode, nChunkSize, nThreads, pSums);
+    } else if (bStream) {
+        // stream the file through fixed-size chunks so memory stays bounded
+        stream_file(in_filename, out_filename, mode, nChunkSize, pSums);
+    } else {
+        FILE* fp = fopen(in_filename, "r");
+        char* buffer = (char*) malloc(sb.st_size * sizeof(char)); // allocate buffer according to filesize
+        size_t result = fread(buffer, sizeof(char), sb.st_size, fp);
+        check_size(sb, result); // check the read was successful
+
+        // reverse and/or bitflip the buffer based on the user's input
+        if (pSums) {
+            transform_checked(buffer, sb.st_size, mode, bVerify, pSums);
+        } else {
+            transform_buffer(buffer, sb.st_size, mode);
+        }
 
-    fclose(fp); // close the input file
-    free(buffer); // free the buffer
+        if (!bVerify) {
+            write_to_file(buffer, sb.st_size, out_filename); // write the buffer to the output file
+        }
+
+        fclose(fp); // close the input file
+        free(buffer); // free the buffer
+    }
 
-    fprintf(stdout, "Input: %s was %d bytes\n", in_filename, (int) sb.st_size);
-    fprintf(stdout, "Output: %s was output successfully\n", out_filename);
+    fprintf(stdout, "Input: %s was %lld bytes\n", in_filename, (long long) sb.st_size);
+    if (bChecksum) {
+        fprintf(stdout, "Checksum: input crc32c %08x, output crc32c %08x\n", sums.crcIn, sums.crcOut);
+    }
+    if (bVerify) {
+        // transforming twice must reproduce the input exactly
+        if (sums.crcRoundTrip != sums.crcIn) {
+            fprintf(stderr, "Error: %s does not round-trip through %s (crc32c %08x, expected %08x)\n",
+                    in_filename, userRequest, sums.crcRoundTrip, sums.crcIn);
+            exit(1);
+        }
+        fprintf(stdout, "Verify: %s round-trips through %s (crc32c %08x)\n", in_filename, userRequest, sums.crcIn);
+    } else if (bInPlace) {
+        fprintf(stdout, "Output: %s was transformed in place\n", in_filename);
+    } else {
+        fprintf(stdout, "Output: %s was output successfully\n", out_filename);
+    }
 
     free(out_filename);
     free(in_filename);
+    free(in_filenames);
 
     return 0;
 }
\ No newline at end of file
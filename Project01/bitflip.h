@@ -0,0 +1,101 @@
+/* bitflip.h : Shared definitions for the bitflip transform engines */
+
+#ifndef BITFLIP_H
+#define BITFLIP_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Default chunk size used by the streaming engine (1 MiB) */
+#define DEFAULT_CHUNK_SIZE      (1 << 20)
+
+/* Largest chunk size we accept from -chunk (1 GiB) */
+#define MAX_CHUNK_SIZE          (1 << 30)
+
+/* Most worker threads we accept from -threads */
+#define MAX_THREADS             64
+
+/* Worker pool size for -batch when -threads is not given */
+#define DEFAULT_BATCH_THREADS   4
+
+/* Chunks the io_uring engine keeps in flight by default, and at most */
+#define DEFAULT_QUEUE_DEPTH     8
+#define MAX_QUEUE_DEPTH         256
+
+enum TransformMode
+{
+    MODE_BITFLIP,
+    MODE_REVERSE,
+    MODE_BITFLIP_REVERSE
+};
+
+/* Instruction set used by the transform kernels, widest last */
+enum KernelLevel
+{
+    KERNEL_SCALAR,
+    KERNEL_SSSE3,
+    KERNEL_AVX2,
+    KERNEL_AVX512
+};
+
+/* Integrity stage results for -checksum and -verify */
+struct Checksums
+{
+    off_t       length;         /* bytes covered so far */
+    uint32_t    crcIn;          /* CRC32C of the input */
+    uint32_t    crcOut;         /* CRC32C of the transformed output */
+    uint32_t    crcRoundTrip;   /* -verify: CRC32C of the transform applied twice */
+};
+
+/* Function prototypes */
+
+/* kernels.c - transforms dispatched to the best kernel for this CPU */
+void bitflip(char* buffer, size_t length);
+void reverse(char* buffer, size_t length);
+void bitflip_reverse(char* buffer, size_t length);
+void transform_buffer(char* buffer, size_t length, enum TransformMode mode);
+void transform_copy(char* dst, const char* src, size_t length, enum TransformMode mode);
+
+enum KernelLevel kernel_best_level();
+int              kernel_set_level(enum KernelLevel level);
+const char*      kernel_name(enum KernelLevel level);
+
+/* checksum.c - CRC32C integrity stage fused into the transform */
+uint32_t crc32c(uint32_t crc, const char* buffer, size_t length);
+uint32_t crc32c_combine(uint32_t crcA, uint32_t crcB, off_t lengthB);
+void     transform_checked(char* buffer, size_t length, enum TransformMode mode, char bVerify, struct Checksums* pSums);
+void     checksums_merge(struct Checksums* pTotal, struct Checksums* pChunk, char bInputFirst, char bOutputFirst);
+
+/* stream.c - transform a file of any size in bounded memory. When pSums is
+   given the integrity stage runs on every chunk; with no out_filename the file
+   is only verified (transformed twice) and nothing is written.
+   @returns the number of bytes transformed */
+off_t stream_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, struct Checksums* pSums);
+
+/* stream.c - I/O helpers that retry short reads and writes, 0 on success */
+int pread_full(int fd, char* buffer, size_t length, off_t offset);
+int write_full(int fd, char* buffer, size_t length);
+int pwrite_full(int fd, char* buffer, size_t length, off_t offset);
+int create_output(char* out_filename);
+
+/* parallel.c - transform disjoint chunks on nThreads workers with pread/pwrite,
+   with the same pSums / out_filename handling as stream_file
+   @returns the number of bytes transformed */
+off_t parallel_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, int nThreads, struct Checksums* pSums);
+
+/* mapfile.c - transform between two memory mappings, or inside one when out_filename is NULL
+   @returns the number of bytes transformed */
+off_t map_file(char* in_filename, char* out_filename, enum TransformMode mode);
+
+/* uring.c - keep queueDepth chunk reads/writes in flight with io_uring,
+   falling back to parallel_file when io_uring is unavailable
+   @returns the number of bytes written */
+off_t uring_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, int queueDepth);
+
+/* batch.c - transform many files in one process on a worker pool
+   @returns the number of files that failed */
+void batch_add_path(char* path);
+void batch_add_list(char* list_filename);
+int  batch_run(enum TransformMode mode, char* extension, size_t chunkSize, int nThreads);
+
+#endif
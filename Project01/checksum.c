@@ -0,0 +1,175 @@
+/*
+checksum.c - CRC32C for the bitflip integrity stage
+
+The engines hash each chunk while it is still in cache, right after it is read
+and right after it is transformed, so no file has to be read a second time.
+Chunks do not always arrive in file order (reverse modes read from the end,
+workers finish in any order), so per-chunk CRCs are stitched together with
+crc32c_combine, which computes crc(A || B) from crc(A), crc(B) and len(B).
+
+The SSE4.2 crc32 instruction is used when the CPU has it, otherwise a
+byte-at-a-time table.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bitflip.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_HW_CRC32C 1
+#endif
+
+/* Reflected CRC32C (Castagnoli) polynomial */
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crcTable[256];
+static int bHardwareCrc = 0;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crc32c_init() {
+    uint32_t i, j;
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crcTable[i] = crc;
+    }
+#ifdef HAVE_HW_CRC32C
+    __builtin_cpu_init();
+    bHardwareCrc = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_table(uint32_t crc, const char* buffer, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ (unsigned char) buffer[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_HW_CRC32C
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const char* buffer, size_t length) {
+    uint64_t crc64 = crc;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, buffer + i, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; i < length; i++) {
+        crc = _mm_crc32_u8(crc, buffer[i]);
+    }
+    return crc;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const char* buffer, size_t length) {
+    pthread_once(&crcOnce, crc32c_init);
+    crc = ~crc;
+#ifdef HAVE_HW_CRC32C
+    if (bHardwareCrc) {
+        return ~crc32c_hardware(crc, buffer, length);
+    }
+#endif
+    return ~crc32c_table(crc, buffer, length);
+}
+
+/* GF(2) matrix helpers for crc32c_combine (same approach as zlib's crc32_combine) */
+
+static uint32_t gf2_matrix_times(uint32_t* matrix, uint32_t vector) {
+    uint32_t sum = 0;
+    while (vector) {
+        if (vector & 1) {
+            sum ^= *matrix;
+        }
+        vector >>= 1;
+        matrix++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, uint32_t* matrix) {
+    int n;
+    for (n = 0; n < 32; n++) {
+        square[n] = gf2_matrix_times(matrix, matrix[n]);
+    }
+}
+
+uint32_t crc32c_combine(uint32_t crcA, uint32_t crcB, off_t lengthB) {
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    if (lengthB <= 0) {
+        return crcA;
+    }
+
+    // operator for one zero bit
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    int n;
+    for (n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    // two zero bits, then four
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    // append lengthB zero bytes to crcA, squaring the operator for each bit of the length
+    do {
+        gf2_matrix_square(even, odd);
+        if (lengthB & 1) {
+            crcA = gf2_matrix_times(even, crcA);
+        }
+        lengthB >>= 1;
+        if (lengthB == 0) {
+            break;
+        }
+        gf2_matrix_square(odd, even);
+        if (lengthB & 1) {
+            crcA = gf2_matrix_times(odd, crcA);
+        }
+        lengthB >>= 1;
+    } while (lengthB != 0);
+
+    return crcA ^ crcB;
+}
+
+void transform_checked(char* buffer, size_t length, enum TransformMode mode, char bVerify, struct Checksums* pSums) {
+    // hash on the way in and on the way out while the chunk is still in cache
+    pSums->length = length;
+    pSums->crcIn = crc32c(0, buffer, length);
+    transform_buffer(buffer, length, mode);
+    pSums->crcOut = crc32c(0, buffer, length);
+
+    // every mode is its own inverse, so a second pass should give the input back
+    pSums->crcRoundTrip = 0;
+    if (bVerify) {
+        transform_buffer(buffer, length, mode);
+        pSums->crcRoundTrip = crc32c(0, buffer, length);
+    }
+}
+
+void checksums_merge(struct Checksums* pTotal, struct Checksums* pChunk, char bInputFirst, char bOutputFirst) {
+    if (bInputFirst) {
+        pTotal->crcIn = crc32c_combine(pChunk->crcIn, pTotal->crcIn, pTotal->length);
+        pTotal->crcRoundTrip = crc32c_combine(pChunk->crcRoundTrip, pTotal->crcRoundTrip, pTotal->length);
+    } else {
+        pTotal->crcIn = crc32c_combine(pTotal->crcIn, pChunk->crcIn, pChunk->length);
+        pTotal->crcRoundTrip = crc32c_combine(pTotal->crcRoundTrip, pChunk->crcRoundTrip, pChunk->length);
+    }
+    if (bOutputFirst) {
+        pTotal->crcOut = crc32c_combine(pChunk->crcOut, pTotal->crcOut, pTotal->length);
+    } else {
+        pTotal->crcOut = crc32c_combine(pTotal->crcOut, pChunk->crcOut, pChunk->length);
+    }
+    pTotal->length += pChunk->length;
+}
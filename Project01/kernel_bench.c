@@ -0,0 +1,128 @@
+/*
+kernel_bench.c - Cross-check and time the bitflip transform kernels
+
+Every kernel the CPU supports (in-place and copy) is first checked against the
+scalar version on random buffers of random lengths and alignments, then the
+in-place kernels are timed on a large buffer.
+
+Usage: ./kernel_bench [buffer size in MiB] [iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bitflip.h"
+
+#define CHECK_ROUNDS        20000
+#define CHECK_MAX_LENGTH    1024
+#define DEFAULT_BENCH_MB    64
+#define DEFAULT_BENCH_ITERS 20
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Compare one kernel level against scalar on random inputs
+   @returns 1 if every round matched, 0 otherwise */
+static int check_level(enum KernelLevel level) {
+    char source[CHECK_MAX_LENGTH + 64];
+    char expected[CHECK_MAX_LENGTH + 64];
+    char actual[CHECK_MAX_LENGTH + 64];
+
+    int round;
+    for (round = 0; round < CHECK_ROUNDS; round++) {
+        size_t length = rand() % (CHECK_MAX_LENGTH + 1);
+        size_t align = rand() % 64;
+        enum TransformMode mode = rand() % 3;
+
+        size_t i;
+        for (i = 0; i < length; i++) {
+            source[align + i] = rand();
+        }
+
+        memcpy(expected + align, source + align, length);
+        kernel_set_level(KERNEL_SCALAR);
+        transform_buffer(expected + align, length, mode);
+
+        memcpy(actual + align, source + align, length);
+        kernel_set_level(level);
+        transform_buffer(actual + align, length, mode);
+
+        if (memcmp(expected + align, actual + align, length) != 0) {
+            fprintf(stderr, "kernel_bench: %s mode %d differs from scalar (length %zu, align %zu)\n",
+                    kernel_name(level), mode, length, align);
+            return 0;
+        }
+
+        // the out-of-place kernel must produce the same bytes
+        memset(actual, 0, sizeof(actual));
+        transform_copy(actual + (align ^ 63), source + align, length, mode);
+        if (memcmp(expected + align, actual + (align ^ 63), length) != 0) {
+            fprintf(stderr, "kernel_bench: %s copy mode %d differs from scalar (length %zu, align %zu)\n",
+                    kernel_name(level), mode, length, align);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    long int nMegabytes = DEFAULT_BENCH_MB;
+    long int nIterations = DEFAULT_BENCH_ITERS;
+
+    if (argc > 1) {
+        nMegabytes = atol(argv[1]);
+    }
+    if (argc > 2) {
+        nIterations = atol(argv[2]);
+    }
+    if (nMegabytes <= 0 || nIterations <= 0) {
+        fprintf(stderr, "Usage: %s [buffer size in MiB] [iterations]\n", argv[0]);
+        exit(1);
+    }
+
+    size_t length = nMegabytes << 20;
+    char* buffer = (char*) malloc(length);
+    if (buffer == NULL) {
+        fprintf(stderr, "kernel_bench: unable to allocate %ld MiB\n", nMegabytes);
+        exit(1);
+    }
+    memset(buffer, 0x5A, length);
+
+    srand(time(NULL));
+
+    const char* modeNames[] = { "-bf", "-r", "-bfr" };
+    enum KernelLevel best = kernel_best_level();
+    enum KernelLevel level;
+
+    printf("%-8s %-5s %10s\n", "kernel", "mode", "GB/s");
+    for (level = KERNEL_SCALAR; level <= best; level++) {
+        if (!check_level(level)) {
+            exit(1);
+        }
+        kernel_set_level(level);
+
+        enum TransformMode mode;
+        for (mode = MODE_BITFLIP; mode <= MODE_BITFLIP_REVERSE; mode++) {
+            // warm up the buffer so page faults don't land in the timing
+            transform_buffer(buffer, length, mode);
+
+            double start = now_seconds();
+            long int i;
+            for (i = 0; i < nIterations; i++) {
+                transform_buffer(buffer, length, mode);
+            }
+            double elapsed = now_seconds() - start;
+
+            printf("%-8s %-5s %10.2f\n", kernel_name(level), modeNames[mode],
+                   (double) length * nIterations / elapsed / 1e9);
+        }
+    }
+
+    free(buffer);
+    return 0;
+}
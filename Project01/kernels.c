@@ -0,0 +1,386 @@
+/*
+kernels.c - Bitflip and byte-reverse kernels with runtime CPU dispatch
+
+Every transform has a scalar version (the reference) and vectorized versions
+for SSSE3, AVX2 and AVX-512 VBMI. The widest kernel the CPU supports is picked
+the first time a transform is called.
+
+The in-place reverse works from both ends at once: load one vector from the
+front and one from the back, reverse the bytes in each with a shuffle, and
+store them swapped. Whatever is left in the middle is finished with the scalar
+swap loop. The fused -bfr kernel XORs in the same pass.
+
+The copy kernels used by the mmap engine read the source front to back and
+store each (reversed) vector straight into its final place in the destination.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bitflip.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+static const char* KernelNames[] = { "scalar", "ssse3", "avx2", "avx512" };
+
+/* Scalar reference kernels */
+
+static void bitflip_scalar(char* buffer, size_t length) {
+    // flip every bit in buffer with XOR
+    size_t i;
+    for (i = 0; i < length; i++) {
+        buffer[i] = buffer[i] ^ 0xFF;
+    }
+}
+
+static void reverse_scalar(char* buffer, size_t length) {
+    // reverse the order of the buffer by swapping the first and last bytes, then the second and second to last, etc.
+    if (length < 2) {
+        return;
+    }
+    size_t i, j = length - 1;
+    char temp;
+    for (i = 0; i < j; i++) {
+        temp = buffer[j];
+        buffer[j] = buffer[i];
+        buffer[i] = temp;
+        j--;
+    }
+}
+
+static void bitflip_reverse_scalar(char* buffer, size_t length) {
+    // swap from both ends and flip the bits on the way
+    if (length == 0) {
+        return;
+    }
+    size_t i, j = length - 1;
+    char temp;
+    for (i = 0; i < j; i++) {
+        temp = buffer[j] ^ 0xFF;
+        buffer[j] = buffer[i] ^ 0xFF;
+        buffer[i] = temp;
+        j--;
+    }
+    // odd lengths leave the middle byte to flip on its own
+    if (i == j) {
+        buffer[i] = buffer[i] ^ 0xFF;
+    }
+}
+
+static void transform_copy_scalar(char* dst, const char* src, size_t length, char bFlip, char bReverse) {
+    // read src front to back and write each byte to its final place in dst
+    char flip = bFlip ? 0xFF : 0;
+    size_t i;
+    if (bReverse) {
+        for (i = 0; i < length; i++) {
+            dst[length - 1 - i] = src[i] ^ flip;
+        }
+    } else {
+        for (i = 0; i < length; i++) {
+            dst[i] = src[i] ^ flip;
+        }
+    }
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* SSSE3 kernels: 16 bytes at a time, pshufb to reverse */
+
+__attribute__((target("ssse3")))
+static void bitflip_ssse3(char* buffer, size_t length) {
+    const __m128i ones = _mm_set1_epi8((char) 0xFF);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i*) (buffer + i));
+        _mm_storeu_si128((__m128i*) (buffer + i), _mm_xor_si128(v, ones));
+    }
+    bitflip_scalar(buffer + i, length - i);
+}
+
+__attribute__((target("ssse3")))
+static void reverse_flip_ssse3(char* buffer, size_t length, char bFlip) {
+    const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i ones = _mm_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0, j = length;
+    while (j - i >= 32) {
+        __m128i front = _mm_loadu_si128((__m128i*) (buffer + i));
+        __m128i back = _mm_loadu_si128((__m128i*) (buffer + j - 16));
+        front = _mm_xor_si128(_mm_shuffle_epi8(front, mask), ones);
+        back = _mm_xor_si128(_mm_shuffle_epi8(back, mask), ones);
+        _mm_storeu_si128((__m128i*) (buffer + i), back);
+        _mm_storeu_si128((__m128i*) (buffer + j - 16), front);
+        i += 16;
+        j -= 16;
+    }
+    if (bFlip) {
+        bitflip_reverse_scalar(buffer + i, j - i);
+    } else {
+        reverse_scalar(buffer + i, j - i);
+    }
+}
+
+static void reverse_ssse3(char* buffer, size_t length) {
+    reverse_flip_ssse3(buffer, length, 0);
+}
+
+static void bitflip_reverse_ssse3(char* buffer, size_t length) {
+    reverse_flip_ssse3(buffer, length, 1);
+}
+
+__attribute__((target("ssse3")))
+static void transform_copy_ssse3(char* dst, const char* src, size_t length, char bFlip, char bReverse) {
+    const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i ones = _mm_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_xor_si128(_mm_loadu_si128((__m128i*) (src + i)), ones);
+        if (bReverse) {
+            _mm_storeu_si128((__m128i*) (dst + length - i - 16), _mm_shuffle_epi8(v, mask));
+        } else {
+            _mm_storeu_si128((__m128i*) (dst + i), v);
+        }
+    }
+    // the leftover source bytes land at the start of dst when reversing
+    transform_copy_scalar(bReverse ? dst : dst + i, src + i, length - i, bFlip, bReverse);
+}
+
+/* AVX2 kernels: 32 bytes at a time, pshufb within each lane then swap the lanes */
+
+__attribute__((target("avx2")))
+static void bitflip_avx2(char* buffer, size_t length) {
+    const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128) {
+        __m256i a = _mm256_loadu_si256((__m256i*) (buffer + i));
+        __m256i b = _mm256_loadu_si256((__m256i*) (buffer + i + 32));
+        __m256i c = _mm256_loadu_si256((__m256i*) (buffer + i + 64));
+        __m256i d = _mm256_loadu_si256((__m256i*) (buffer + i + 96));
+        _mm256_storeu_si256((__m256i*) (buffer + i), _mm256_xor_si256(a, ones));
+        _mm256_storeu_si256((__m256i*) (buffer + i + 32), _mm256_xor_si256(b, ones));
+        _mm256_storeu_si256((__m256i*) (buffer + i + 64), _mm256_xor_si256(c, ones));
+        _mm256_storeu_si256((__m256i*) (buffer + i + 96), _mm256_xor_si256(d, ones));
+    }
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i*) (buffer + i));
+        _mm256_storeu_si256((__m256i*) (buffer + i), _mm256_xor_si256(v, ones));
+    }
+    bitflip_scalar(buffer + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i reverse_bytes_avx2(__m256i v, __m256i mask) {
+    v = _mm256_shuffle_epi8(v, mask);
+    return _mm256_permute2x128_si256(v, v, 0x01);
+}
+
+__attribute__((target("avx2")))
+static void reverse_flip_avx2(char* buffer, size_t length, char bFlip) {
+    const __m256i mask = _mm256_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i ones = _mm256_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0, j = length;
+    while (j - i >= 64) {
+        __m256i front = _mm256_loadu_si256((__m256i*) (buffer + i));
+        __m256i back = _mm256_loadu_si256((__m256i*) (buffer + j - 32));
+        front = _mm256_xor_si256(reverse_bytes_avx2(front, mask), ones);
+        back = _mm256_xor_si256(reverse_bytes_avx2(back, mask), ones);
+        _mm256_storeu_si256((__m256i*) (buffer + i), back);
+        _mm256_storeu_si256((__m256i*) (buffer + j - 32), front);
+        i += 32;
+        j -= 32;
+    }
+    if (bFlip) {
+        bitflip_reverse_scalar(buffer + i, j - i);
+    } else {
+        reverse_scalar(buffer + i, j - i);
+    }
+}
+
+static void reverse_avx2(char* buffer, size_t length) {
+    reverse_flip_avx2(buffer, length, 0);
+}
+
+static void bitflip_reverse_avx2(char* buffer, size_t length) {
+    reverse_flip_avx2(buffer, length, 1);
+}
+
+__attribute__((target("avx2")))
+static void transform_copy_avx2(char* dst, const char* src, size_t length, char bFlip, char bReverse) {
+    const __m256i mask = _mm256_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                         0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m256i ones = _mm256_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((__m256i*) (src + i)), ones);
+        if (bReverse) {
+            _mm256_storeu_si256((__m256i*) (dst + length - i - 32), reverse_bytes_avx2(v, mask));
+        } else {
+            _mm256_storeu_si256((__m256i*) (dst + i), v);
+        }
+    }
+    transform_copy_scalar(bReverse ? dst : dst + i, src + i, length - i, bFlip, bReverse);
+}
+
+/* AVX-512 kernels: 64 bytes at a time, a single vpermb reverses a whole vector */
+
+__attribute__((target("avx512f,avx512bw")))
+static void bitflip_avx512(char* buffer, size_t length) {
+    const __m512i ones = _mm512_set1_epi8((char) 0xFF);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_loadu_si512((void*) (buffer + i));
+        _mm512_storeu_si512((void*) (buffer + i), _mm512_xor_si512(v, ones));
+    }
+    // the tail is done with a masked load/store instead of the scalar loop
+    if (i < length) {
+        __mmask64 tail = (1ULL << (length - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(tail, buffer + i);
+        _mm512_mask_storeu_epi8(buffer + i, tail, _mm512_xor_si512(v, ones));
+    }
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void reverse_flip_avx512(char* buffer, size_t length, char bFlip) {
+    const __m512i index = _mm512_set_epi8(
+         0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+        32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63);
+    const __m512i ones = _mm512_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0, j = length;
+    while (j - i >= 128) {
+        __m512i front = _mm512_loadu_si512((void*) (buffer + i));
+        __m512i back = _mm512_loadu_si512((void*) (buffer + j - 64));
+        front = _mm512_xor_si512(_mm512_permutexvar_epi8(index, front), ones);
+        back = _mm512_xor_si512(_mm512_permutexvar_epi8(index, back), ones);
+        _mm512_storeu_si512((void*) (buffer + i), back);
+        _mm512_storeu_si512((void*) (buffer + j - 64), front);
+        i += 64;
+        j -= 64;
+    }
+    // less than two vectors left, the AVX2 kernel can finish the middle
+    if (bFlip) {
+        bitflip_reverse_avx2(buffer + i, j - i);
+    } else {
+        reverse_avx2(buffer + i, j - i);
+    }
+}
+
+static void reverse_avx512(char* buffer, size_t length) {
+    reverse_flip_avx512(buffer, length, 0);
+}
+
+static void bitflip_reverse_avx512(char* buffer, size_t length) {
+    reverse_flip_avx512(buffer, length, 1);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void transform_copy_avx512(char* dst, const char* src, size_t length, char bFlip, char bReverse) {
+    const __m512i index = _mm512_set_epi8(
+         0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+        32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+        48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63);
+    const __m512i ones = _mm512_set1_epi8(bFlip ? (char) 0xFF : 0);
+    size_t i = 0;
+    for (; i + 64 <= length; i += 64) {
+        __m512i v = _mm512_xor_si512(_mm512_loadu_si512((void*) (src + i)), ones);
+        if (bReverse) {
+            _mm512_storeu_si512((void*) (dst + length - i - 64), _mm512_permutexvar_epi8(index, v));
+        } else {
+            _mm512_storeu_si512((void*) (dst + i), v);
+        }
+    }
+    transform_copy_avx2(bReverse ? dst : dst + i, src + i, length - i, bFlip, bReverse);
+}
+
+#endif
+
+/* Dispatch table, filled in once by select_kernels */
+
+struct KernelSet {
+    void (*pBitflip)(char*, size_t);
+    void (*pReverse)(char*, size_t);
+    void (*pBitflipReverse)(char*, size_t);
+    void (*pTransformCopy)(char*, const char*, size_t, char, char);
+};
+
+static struct KernelSet TheKernels[] = {
+    { bitflip_scalar, reverse_scalar, bitflip_reverse_scalar, transform_copy_scalar },
+#ifdef HAVE_X86_KERNELS
+    { bitflip_ssse3, reverse_ssse3, bitflip_reverse_ssse3, transform_copy_ssse3 },
+    { bitflip_avx2, reverse_avx2, bitflip_reverse_avx2, transform_copy_avx2 },
+    { bitflip_avx512, reverse_avx512, bitflip_reverse_avx512, transform_copy_avx512 },
+#endif
+};
+
+static enum KernelLevel currentLevel = KERNEL_SCALAR;
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+
+static void select_kernels() {
+    currentLevel = kernel_best_level();
+}
+
+enum KernelLevel kernel_best_level() {
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi")) {
+        return KERNEL_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return KERNEL_AVX2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return KERNEL_SSSE3;
+    }
+#endif
+    return KERNEL_SCALAR;
+}
+
+int kernel_set_level(enum KernelLevel level) {
+    pthread_once(&kernelsOnce, select_kernels);
+    // only allow kernels this CPU can actually run
+    if (level > kernel_best_level()) {
+        return 0;
+    }
+    currentLevel = level;
+    return 1;
+}
+
+const char* kernel_name(enum KernelLevel level) {
+    return KernelNames[level];
+}
+
+void bitflip(char* buffer, size_t length) {
+    pthread_once(&kernelsOnce, select_kernels);
+    TheKernels[currentLevel].pBitflip(buffer, length);
+}
+
+void reverse(char* buffer, size_t length) {
+    pthread_once(&kernelsOnce, select_kernels);
+    TheKernels[currentLevel].pReverse(buffer, length);
+}
+
+void bitflip_reverse(char* buffer, size_t length) {
+    pthread_once(&kernelsOnce, select_kernels);
+    TheKernels[currentLevel].pBitflipReverse(buffer, length);
+}
+
+void transform_buffer(char* buffer, size_t length, enum TransformMode mode) {
+    if (mode == MODE_BITFLIP) {
+        bitflip(buffer, length);
+    } else if (mode == MODE_REVERSE) {
+        reverse(buffer, length);
+    } else {
+        bitflip_reverse(buffer, length);
+    }
+}
+
+void transform_copy(char* dst, const char* src, size_t length, enum TransformMode mode) {
+    pthread_once(&kernelsOnce, select_kernels);
+    TheKernels[currentLevel].pTransformCopy(dst, src, length, mode != MODE_REVERSE, mode != MODE_BITFLIP);
+}
@@ -0,0 +1,105 @@
+/*
+mapfile.c - Zero-copy mmap engine for bitflip
+
+The input is mapped read-only and the output is a shared writable mapping of
+a preallocated file, so the transform reads straight out of the page cache
+and writes straight back into it with no heap buffer and no stdio copies.
+
+With -inplace there is no second file at all: the input is mapped shared and
+transformed where it sits.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bitflip.h"
+
+/* Hint the kernel about how a mapping will be used. These are only hints,
+   so failures (e.g. no transparent hugepages for this filesystem) are ignored. */
+static void advise_mapping(void* pMap, size_t length, int advice) {
+    madvise(pMap, length, advice);
+#ifdef MADV_HUGEPAGE
+    madvise(pMap, length, MADV_HUGEPAGE);
+#endif
+}
+
+static void* map_or_exit(size_t length, int prot, int fd, char* filename) {
+    void* pMap = mmap(NULL, length, prot, MAP_SHARED, fd, 0);
+    if (pMap == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to map %s: %s\n", filename, strerror(errno));
+        exit(1);
+    }
+    return pMap;
+}
+
+off_t map_file(char* in_filename, char* out_filename, enum TransformMode mode) {
+    struct stat sb;
+
+    // in place means the input itself has to be writable
+    int fdIn = open(in_filename, out_filename ? O_RDONLY : O_RDWR);
+    if (fdIn < 0) {
+        fprintf(stderr, "Error: Unable to open %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+    if (fstat(fdIn, &sb) != 0) {
+        fprintf(stderr, "Error: Unable to stat %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+    size_t length = sb.st_size;
+
+    if (out_filename == NULL) {
+        // an empty file maps to nothing, and is its own transform
+        if (length > 0) {
+            char* pData = (char*) map_or_exit(length, PROT_READ | PROT_WRITE, fdIn, in_filename);
+            // reversing touches both ends at once, so sequential read-ahead won't help there
+            advise_mapping(pData, length, mode == MODE_BITFLIP ? MADV_SEQUENTIAL : MADV_WILLNEED);
+
+            transform_buffer(pData, length, mode);
+
+            munmap(pData, length);
+        }
+        close(fdIn);
+        return length;
+    }
+
+    int fdOut = create_output(out_filename);
+
+    if (length > 0) {
+        // the output mapping needs real blocks behind it, or a store could SIGBUS on a full disk
+        int result = posix_fallocate(fdOut, 0, length);
+        if (result == EOPNOTSUPP || result == EINVAL) {
+            result = ftruncate(fdOut, length) == 0 ? 0 : errno;
+        }
+        if (result != 0) {
+            fprintf(stderr, "Error: Unable to allocate %s: %s\n", out_filename, strerror(result));
+            unlink(out_filename);
+            exit(1);
+        }
+
+        char* pIn = (char*) map_or_exit(length, PROT_READ, fdIn, in_filename);
+        char* pOut = (char*) map_or_exit(length, PROT_READ | PROT_WRITE, fdOut, out_filename);
+
+        // the copy kernels walk the input front to back in every mode
+        advise_mapping(pIn, length, MADV_SEQUENTIAL);
+        advise_mapping(pOut, length, mode == MODE_BITFLIP ? MADV_SEQUENTIAL : MADV_NORMAL);
+
+        transform_copy(pOut, pIn, length, mode);
+
+        munmap(pIn, length);
+        munmap(pOut, length);
+    }
+
+    if (close(fdOut) != 0) {
+        fprintf(stderr, "Error: Unable to write %s: %s\n", out_filename, strerror(errno));
+        exit(1);
+    }
+    close(fdIn);
+
+    return length;
+}
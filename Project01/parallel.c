@@ -0,0 +1,204 @@
+/*
+parallel.c - Multithreaded chunked transform for bitflip
+
+Every output chunk's position is known up front: -bf writes chunk data at the
+same offset it was read from, -r and -bfr write it at the mirrored offset. So
+the output file is preallocated and each worker repeatedly claims the next
+chunk, preads it, transforms it in its own buffer and pwrites it straight to
+its final place. No ordering between workers is needed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "bitflip.h"
+
+struct ParallelJob {
+    int                 fdIn;
+    int                 fdOut;
+    off_t               fileSize;
+    size_t              chunkSize;
+    off_t               numChunks;
+    enum TransformMode  mode;
+
+    /* Per-chunk integrity results, merged in file order after the join (NULL when off) */
+    struct Checksums*   chunkSums;
+
+    /* Next chunk to hand out and the first error seen, both under lock */
+    off_t               nextChunk;
+    int                 nError;
+    pthread_mutex_t     lock;
+};
+
+struct ParallelThreadInfo {
+    int                 nIndex;
+    pthread_t           threadId;
+    struct ParallelJob* job;
+};
+
+struct ParallelThreadInfo TheWorkers[MAX_THREADS];
+
+/* Claim the next chunk index, or -1 once everything is handed out (or a worker failed) */
+static off_t claim_chunk(struct ParallelJob* pJob) {
+    off_t k = -1;
+    pthread_mutex_lock(&pJob->lock);
+    if (pJob->nError == 0 && pJob->nextChunk < pJob->numChunks) {
+        k = pJob->nextChunk;
+        pJob->nextChunk++;
+    }
+    pthread_mutex_unlock(&pJob->lock);
+    return k;
+}
+
+static void record_error(struct ParallelJob* pJob, int error) {
+    pthread_mutex_lock(&pJob->lock);
+    if (pJob->nError == 0) {
+        pJob->nError = error;
+    }
+    pthread_mutex_unlock(&pJob->lock);
+}
+
+static void* parallel_worker(void* pData) {
+    struct ParallelThreadInfo* pThreadInfo = (struct ParallelThreadInfo*) pData;
+    struct ParallelJob* pJob = pThreadInfo->job;
+
+    char* buffer = (char*) malloc(pJob->chunkSize);
+    if (buffer == NULL) {
+        record_error(pJob, ENOMEM);
+        return NULL;
+    }
+
+    off_t k;
+    while ((k = claim_chunk(pJob)) >= 0) {
+        off_t inOffset = k * pJob->chunkSize;
+        size_t length = pJob->chunkSize;
+        if (inOffset + (off_t) length > pJob->fileSize) {
+            length = pJob->fileSize - inOffset;
+        }
+
+        // reversed output puts the chunk at the mirrored position
+        off_t outOffset = inOffset;
+        if (pJob->mode != MODE_BITFLIP) {
+            outOffset = pJob->fileSize - inOffset - length;
+        }
+
+        if (pread_full(pJob->fdIn, buffer, length, inOffset) != 0) {
+            record_error(pJob, errno ? errno : EIO);
+            break;
+        }
+        if (pJob->chunkSums) {
+            transform_checked(buffer, length, pJob->mode, pJob->fdOut < 0, &pJob->chunkSums[k]);
+        } else {
+            transform_buffer(buffer, length, pJob->mode);
+        }
+        if (pJob->fdOut >= 0 && pwrite_full(pJob->fdOut, buffer, length, outOffset) != 0) {
+            record_error(pJob, errno);
+            break;
+        }
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+off_t parallel_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, int nThreads, struct Checksums* pSums) {
+    struct ParallelJob theJob;
+    struct stat sb;
+
+    theJob.fdIn = open(in_filename, O_RDONLY);
+    if (theJob.fdIn < 0) {
+        fprintf(stderr, "Error: Unable to open %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+    if (fstat(theJob.fdIn, &sb) != 0) {
+        fprintf(stderr, "Error: Unable to stat %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+
+    // verifying only reads, there is no output file
+    theJob.fdOut = -1;
+    if (out_filename) {
+        theJob.fdOut = create_output(out_filename);
+    }
+
+    // reserve the whole output up front so workers can write anywhere in it
+    if (theJob.fdOut >= 0 && sb.st_size > 0) {
+        int result = posix_fallocate(theJob.fdOut, 0, sb.st_size);
+        if (result == EOPNOTSUPP || result == EINVAL) {
+            // not every filesystem can preallocate, a sized sparse file works too
+            result = ftruncate(theJob.fdOut, sb.st_size) == 0 ? 0 : errno;
+        }
+        if (result != 0) {
+            fprintf(stderr, "Error: Unable to allocate %s: %s\n", out_filename, strerror(result));
+            unlink(out_filename);
+            exit(1);
+        }
+    }
+
+    theJob.fileSize = sb.st_size;
+    theJob.chunkSize = chunkSize;
+    theJob.numChunks = (sb.st_size + chunkSize - 1) / chunkSize;
+    theJob.mode = mode;
+    theJob.nextChunk = 0;
+    theJob.nError = 0;
+    theJob.chunkSums = NULL;
+    pthread_mutex_init(&theJob.lock, NULL);
+
+    if (pSums) {
+        theJob.chunkSums = (struct Checksums*) calloc(theJob.numChunks + 1, sizeof(struct Checksums));
+        if (theJob.chunkSums == NULL) {
+            fprintf(stderr, "Error: Unable to allocate checksum table\n");
+            exit(1);
+        }
+    }
+
+    // no point in more workers than chunks
+    if (nThreads > theJob.numChunks) {
+        nThreads = theJob.numChunks;
+    }
+
+    /* Create the threads */
+    int i;
+    for (i = 0; i < nThreads; i++) {
+        TheWorkers[i].nIndex = i;
+        TheWorkers[i].job = &theJob;
+        pthread_create(&TheWorkers[i].threadId, NULL, parallel_worker, &TheWorkers[i]);
+    }
+
+    /* Join the threads */
+    for (i = 0; i < nThreads; i++) {
+        pthread_join(TheWorkers[i].threadId, NULL);
+    }
+
+    if (theJob.nError != 0) {
+        fprintf(stderr, "Error: Unable to transform %s: %s\n", in_filename, strerror(theJob.nError));
+        if (out_filename) {
+            unlink(out_filename);
+        }
+        exit(1);
+    }
+
+    if (pSums) {
+        // chunks are numbered in input order; reversed output runs the other way
+        off_t k;
+        for (k = 0; k < theJob.numChunks; k++) {
+            checksums_merge(pSums, &theJob.chunkSums[k], 0, mode != MODE_BITFLIP);
+        }
+        free(theJob.chunkSums);
+    }
+
+    if (theJob.fdOut >= 0 && close(theJob.fdOut) != 0) {
+        fprintf(stderr, "Error: Unable to write %s: %s\n", out_filename, strerror(errno));
+        exit(1);
+    }
+    close(theJob.fdIn);
+    pthread_mutex_destroy(&theJob.lock);
+
+    return sb.st_size;
+}
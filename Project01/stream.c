@@ -0,0 +1,275 @@
+/*
+stream.c - Constant-memory streaming engine for bitflip
+
+The input is processed in fixed-size chunks through two buffers. A reader
+thread preads the next chunk into one buffer while the main thread transforms
+and writes out the other one, so the disk never waits on the CPU.
+
+For -bf the chunks are read front to back. For -r and -bfr they are read from
+the end of the file towards the start; reversing each chunk and appending it
+to the output produces the fully reversed file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "bitflip.h"
+
+#define NUM_STREAM_BUFFERS 2
+
+struct StreamChunk {
+    char*   buffer;
+    size_t  length;
+    char    bFull;
+};
+
+struct StreamPipeline {
+    int                 fdIn;
+    off_t               fileSize;
+    size_t              chunkSize;
+    off_t               numChunks;
+    enum TransformMode  mode;
+    char                bReadError;
+
+    struct StreamChunk  chunks[NUM_STREAM_BUFFERS];
+
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+};
+
+/* Work out where chunk k lives in the input file. Forward modes walk from the
+   start, reverse modes walk backwards from the end. */
+static void chunk_range(struct StreamPipeline* pPipe, off_t k, off_t* pOffset, size_t* pLength) {
+    off_t start, end;
+
+    if (pPipe->mode == MODE_BITFLIP) {
+        start = k * pPipe->chunkSize;
+        end = start + pPipe->chunkSize;
+        if (end > pPipe->fileSize) {
+            end = pPipe->fileSize;
+        }
+    } else {
+        end = pPipe->fileSize - k * pPipe->chunkSize;
+        start = end - (off_t) pPipe->chunkSize;
+        if (start < 0) {
+            start = 0;
+        }
+    }
+
+    *pOffset = start;
+    *pLength = end - start;
+}
+
+/* Read exactly length bytes at offset, retrying on short reads */
+int pread_full(int fd, char* buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = pread(fd, buffer + done, length - done, offset + done);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (result == 0) {
+            // the file got shorter underneath us
+            errno = EIO;
+            return -1;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+/* Write exactly length bytes, retrying on short writes */
+int write_full(int fd, char* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = write(fd, buffer + done, length - done);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+/* Write exactly length bytes at offset, retrying on short writes */
+int pwrite_full(int fd, char* buffer, size_t length, off_t offset) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t result = pwrite(fd, buffer + done, length - done, offset + done);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += result;
+    }
+    return 0;
+}
+
+/* Create the output file, which should not already exist. It is opened
+   read/write so the mmap engine can map it as well. */
+int create_output(char* out_filename) {
+    int fdOut = open(out_filename, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fdOut < 0) {
+        if (errno == EEXIST) {
+            fprintf(stderr, "Error: %s file already exist!\n", out_filename);
+        } else {
+            fprintf(stderr, "Error: Unable to create %s: %s\n", out_filename, strerror(errno));
+        }
+        exit(1);
+    }
+    return fdOut;
+}
+
+/* Reader thread: fill the free buffer with the next chunk while the main thread
+   is busy transforming and writing the other one */
+static void* stream_reader(void* pData) {
+    struct StreamPipeline* pPipe = (struct StreamPipeline*) pData;
+
+    off_t k;
+    for (k = 0; k < pPipe->numChunks; k++) {
+        struct StreamChunk* pChunk = &pPipe->chunks[k % NUM_STREAM_BUFFERS];
+
+        // wait for the writer to hand this buffer back
+        pthread_mutex_lock(&pPipe->lock);
+        while (pChunk->bFull) {
+            pthread_cond_wait(&pPipe->cond, &pPipe->lock);
+        }
+        pthread_mutex_unlock(&pPipe->lock);
+
+        off_t offset;
+        size_t length;
+        chunk_range(pPipe, k, &offset, &length);
+
+        int result = pread_full(pPipe->fdIn, pChunk->buffer, length, offset);
+
+        pthread_mutex_lock(&pPipe->lock);
+        if (result != 0) {
+            pPipe->bReadError = 1;
+        }
+        pChunk->length = length;
+        pChunk->bFull = 1;
+        pthread_cond_broadcast(&pPipe->cond);
+        pthread_mutex_unlock(&pPipe->lock);
+
+        if (result != 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+off_t stream_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, struct Checksums* pSums) {
+    struct StreamPipeline thePipe;
+    struct stat sb;
+
+    thePipe.fdIn = open(in_filename, O_RDONLY);
+    if (thePipe.fdIn < 0) {
+        fprintf(stderr, "Error: Unable to open %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+    if (fstat(thePipe.fdIn, &sb) != 0) {
+        fprintf(stderr, "Error: Unable to stat %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+
+    // verifying only reads, there is no output file
+    int fdOut = -1;
+    if (out_filename) {
+        fdOut = create_output(out_filename);
+    }
+
+    // the input is read in one direction only, let the kernel read ahead
+    posix_fadvise(thePipe.fdIn, 0, 0, mode == MODE_BITFLIP ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+
+    thePipe.fileSize = sb.st_size;
+    thePipe.chunkSize = chunkSize;
+    thePipe.numChunks = (sb.st_size + chunkSize - 1) / chunkSize;
+    thePipe.mode = mode;
+    thePipe.bReadError = 0;
+    pthread_mutex_init(&thePipe.lock, NULL);
+    pthread_cond_init(&thePipe.cond, NULL);
+
+    int i;
+    for (i = 0; i < NUM_STREAM_BUFFERS; i++) {
+        thePipe.chunks[i].buffer = (char*) malloc(chunkSize);
+        thePipe.chunks[i].length = 0;
+        thePipe.chunks[i].bFull = 0;
+        if (thePipe.chunks[i].buffer == NULL) {
+            fprintf(stderr, "Error: Unable to allocate %zu byte stream buffer\n", chunkSize);
+            exit(1);
+        }
+    }
+
+    pthread_t readerID;
+    pthread_create(&readerID, NULL, stream_reader, &thePipe);
+
+    off_t written = 0;
+    off_t k;
+    for (k = 0; k < thePipe.numChunks; k++) {
+        struct StreamChunk* pChunk = &thePipe.chunks[k % NUM_STREAM_BUFFERS];
+
+        // wait for the reader to fill this buffer
+        pthread_mutex_lock(&thePipe.lock);
+        while (!pChunk->bFull) {
+            pthread_cond_wait(&thePipe.cond, &thePipe.lock);
+        }
+        char bReadError = thePipe.bReadError;
+        pthread_mutex_unlock(&thePipe.lock);
+
+        if (bReadError) {
+            fprintf(stderr, "Error: Reading error\n");
+            exit(1);
+        }
+
+        if (pSums) {
+            // reverse modes read the input from the end, so each chunk goes in front of the rest
+            struct Checksums chunkSums;
+            transform_checked(pChunk->buffer, pChunk->length, mode, fdOut < 0, &chunkSums);
+            checksums_merge(pSums, &chunkSums, mode != MODE_BITFLIP, 0);
+        } else {
+            transform_buffer(pChunk->buffer, pChunk->length, mode);
+        }
+
+        if (fdOut >= 0 && write_full(fdOut, pChunk->buffer, pChunk->length) != 0) {
+            fprintf(stderr, "Error: Unable to write %s: %s\n", out_filename, strerror(errno));
+            exit(1);
+        }
+        written += pChunk->length;
+
+        // hand the buffer back to the reader
+        pthread_mutex_lock(&thePipe.lock);
+        pChunk->bFull = 0;
+        pthread_cond_broadcast(&thePipe.cond);
+        pthread_mutex_unlock(&thePipe.lock);
+    }
+
+    pthread_join(readerID, NULL);
+
+    if (fdOut >= 0 && close(fdOut) != 0) {
+        fprintf(stderr, "Error: Unable to write %s: %s\n", out_filename, strerror(errno));
+        exit(1);
+    }
+    close(thePipe.fdIn);
+
+    for (i = 0; i < NUM_STREAM_BUFFERS; i++) {
+        free(thePipe.chunks[i].buffer);
+    }
+    pthread_mutex_destroy(&thePipe.lock);
+    pthread_cond_destroy(&thePipe.cond);
+
+    return written;
+}
@@ -0,0 +1,347 @@
+/*
+uring.c - io_uring asynchronous I/O backend for bitflip
+
+A fixed number of chunk slots (the queue depth) stay in flight. Each slot
+starts as a read; when its read completes the chunk is transformed right away
+and a write to the chunk's final offset is submitted from the same buffer.
+When the write completes the slot picks up the next unread chunk. The CPU
+transforms one chunk while the disk works on the others.
+
+The ring is driven with the raw syscalls so no liburing is needed. If the
+kernel (or a seccomp policy) refuses io_uring, or its io_uring is too old to
+read and write files (before 5.6), the thread-pool pread/pwrite engine in
+parallel.c is used with one thread per queue slot instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "bitflip.h"
+
+enum SlotState {
+    SLOT_IDLE,
+    SLOT_READING,
+    SLOT_WRITING
+};
+
+struct UringSlot {
+    char*           buffer;
+    enum SlotState  state;
+    off_t           inOffset;
+    off_t           outOffset;
+    size_t          length;
+    size_t          done;       /* bytes of the current read or write completed so far */
+};
+
+struct Uring {
+    int             fd;
+
+    /* Submission queue */
+    unsigned*       sqHead;
+    unsigned*       sqTail;
+    unsigned*       sqMask;
+    unsigned*       sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned        sqPending;
+
+    /* Completion queue */
+    unsigned*       cqHead;
+    unsigned*       cqTail;
+    unsigned*       cqMask;
+    struct io_uring_cqe* cqes;
+
+    void*           sqMap;
+    size_t          sqMapSize;
+    void*           cqMap;
+    size_t          cqMapSize;
+    size_t          sqesSize;
+};
+
+/* Whether the ring can do IORING_OP_READ and IORING_OP_WRITE. Both arrived in
+   5.6 along with the probe itself, so a kernel that refuses to be probed
+   cannot do them either. */
+static int uring_supports_rw(int fd) {
+    size_t nSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* pProbe = (struct io_uring_probe*) calloc(1, nSize);
+    int bSupported = 0;
+    if (pProbe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, pProbe, 256) == 0) {
+        bSupported = IORING_OP_WRITE < pProbe->ops_len
+            && (pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+            && (pProbe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(pProbe);
+    return bSupported;
+}
+
+static int uring_setup(struct Uring* pRing, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    pRing->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (pRing->fd < 0) {
+        return -1;
+    }
+    if (!uring_supports_rw(pRing->fd)) {
+        close(pRing->fd);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    pRing->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    pRing->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    // newer kernels put both rings behind one mapping
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (pRing->cqMapSize > pRing->sqMapSize) {
+            pRing->sqMapSize = pRing->cqMapSize;
+        }
+        pRing->cqMapSize = pRing->sqMapSize;
+    }
+
+    pRing->sqMap = mmap(NULL, pRing->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        pRing->fd, IORING_OFF_SQ_RING);
+    if (pRing->sqMap == MAP_FAILED) {
+        close(pRing->fd);
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        pRing->cqMap = pRing->sqMap;
+    } else {
+        pRing->cqMap = mmap(NULL, pRing->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            pRing->fd, IORING_OFF_CQ_RING);
+        if (pRing->cqMap == MAP_FAILED) {
+            munmap(pRing->sqMap, pRing->sqMapSize);
+            close(pRing->fd);
+            return -1;
+        }
+    }
+
+    pRing->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    pRing->sqes = mmap(NULL, pRing->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       pRing->fd, IORING_OFF_SQES);
+    if (pRing->sqes == MAP_FAILED) {
+        if (pRing->cqMap != pRing->sqMap) {
+            munmap(pRing->cqMap, pRing->cqMapSize);
+        }
+        munmap(pRing->sqMap, pRing->sqMapSize);
+        close(pRing->fd);
+        return -1;
+    }
+
+    char* sq = (char*) pRing->sqMap;
+    pRing->sqHead = (unsigned*) (sq + params.sq_off.head);
+    pRing->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    pRing->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    pRing->sqArray = (unsigned*) (sq + params.sq_off.array);
+    pRing->sqPending = 0;
+
+    char* cq = (char*) pRing->cqMap;
+    pRing->cqHead = (unsigned*) (cq + params.cq_off.head);
+    pRing->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    pRing->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    pRing->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+static void uring_teardown(struct Uring* pRing) {
+    munmap(pRing->sqes, pRing->sqesSize);
+    if (pRing->cqMap != pRing->sqMap) {
+        munmap(pRing->cqMap, pRing->cqMapSize);
+    }
+    munmap(pRing->sqMap, pRing->sqMapSize);
+    close(pRing->fd);
+}
+
+/* Queue a read or write for a slot. The ring has two entries per slot so
+   there is always room. */
+static void uring_queue(struct Uring* pRing, int opcode, int fd, char* buffer, size_t length, off_t offset, int slot) {
+    unsigned tail = *pRing->sqTail;
+    unsigned index = tail & *pRing->sqMask;
+    struct io_uring_sqe* pSqe = &pRing->sqes[index];
+
+    memset(pSqe, 0, sizeof(*pSqe));
+    pSqe->opcode = opcode;
+    pSqe->fd = fd;
+    pSqe->addr = (unsigned long) buffer;
+    pSqe->len = length;
+    pSqe->off = offset;
+    pSqe->user_data = slot;
+
+    pRing->sqArray[index] = index;
+    // the kernel must see the entry before it sees the new tail
+    __atomic_store_n(pRing->sqTail, tail + 1, __ATOMIC_RELEASE);
+    pRing->sqPending++;
+}
+
+/* Submit everything queued and wait for at least one completion */
+static int uring_submit_and_wait(struct Uring* pRing) {
+    int result;
+    do {
+        result = syscall(__NR_io_uring_enter, pRing->fd, pRing->sqPending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0) {
+        return -1;
+    }
+    pRing->sqPending -= result;
+    return 0;
+}
+
+/* Queue the next part of a slot's current read or write */
+static void slot_continue(struct Uring* pRing, struct UringSlot* pSlot, int slot, int fdIn, int fdOut) {
+    if (pSlot->state == SLOT_READING) {
+        uring_queue(pRing, IORING_OP_READ, fdIn, pSlot->buffer + pSlot->done, pSlot->length - pSlot->done,
+                    pSlot->inOffset + pSlot->done, slot);
+    } else {
+        uring_queue(pRing, IORING_OP_WRITE, fdOut, pSlot->buffer + pSlot->done, pSlot->length - pSlot->done,
+                    pSlot->outOffset + pSlot->done, slot);
+    }
+}
+
+off_t uring_file(char* in_filename, char* out_filename, enum TransformMode mode, size_t chunkSize, int queueDepth) {
+    struct Uring theRing;
+    struct stat sb;
+
+    if (uring_setup(&theRing, 2 * queueDepth) != 0) {
+        fprintf(stderr, "Warning: io_uring unavailable (%s), using %d pread/pwrite threads\n", strerror(errno), queueDepth);
+        return parallel_file(in_filename, out_filename, mode, chunkSize, queueDepth, NULL);
+    }
+
+    int fdIn = open(in_filename, O_RDONLY);
+    if (fdIn < 0) {
+        fprintf(stderr, "Error: Unable to open %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+    if (fstat(fdIn, &sb) != 0) {
+        fprintf(stderr, "Error: Unable to stat %s: %s\n", in_filename, strerror(errno));
+        exit(1);
+    }
+
+    int fdOut = create_output(out_filename);
+    if (sb.st_size > 0) {
+        // writes land in any order, so size the output up front
+        int result = posix_fallocate(fdOut, 0, sb.st_size);
+        if (result == EOPNOTSUPP || result == EINVAL) {
+            result = ftruncate(fdOut, sb.st_size) == 0 ? 0 : errno;
+        }
+        if (result != 0) {
+            fprintf(stderr, "Error: Unable to allocate %s: %s\n", out_filename, strerror(result));
+            unlink(out_filename);
+            exit(1);
+        }
+    }
+
+    struct UringSlot* slots = (struct UringSlot*) calloc(queueDepth, sizeof(struct UringSlot));
+    int i;
+    for (i = 0; i < queueDepth; i++) {
+        slots[i].buffer = (char*) malloc(chunkSize);
+        slots[i].state = SLOT_IDLE;
+        if (slots[i].buffer == NULL) {
+            fprintf(stderr, "Error: Unable to allocate %zu byte chunk buffer\n", chunkSize);
+            exit(1);
+        }
+    }
+
+    off_t nextOffset = 0;
+    int inFlight = 0;
+    int error = 0;
+
+    while (error == 0) {
+        // give every idle slot the next chunk to read
+        for (i = 0; i < queueDepth && nextOffset < sb.st_size; i++) {
+            struct UringSlot* pSlot = &slots[i];
+            if (pSlot->state != SLOT_IDLE) {
+                continue;
+            }
+            pSlot->inOffset = nextOffset;
+            pSlot->length = chunkSize;
+            if (nextOffset + (off_t) chunkSize > sb.st_size) {
+                pSlot->length = sb.st_size - nextOffset;
+            }
+            // reversed output puts the chunk at the mirrored position
+            pSlot->outOffset = pSlot->inOffset;
+            if (mode != MODE_BITFLIP) {
+                pSlot->outOffset = sb.st_size - pSlot->inOffset - pSlot->length;
+            }
+            pSlot->done = 0;
+            pSlot->state = SLOT_READING;
+            slot_continue(&theRing, pSlot, i, fdIn, fdOut);
+            nextOffset += pSlot->length;
+            inFlight++;
+        }
+
+        if (inFlight == 0) {
+            break;
+        }
+
+        if (uring_submit_and_wait(&theRing) != 0) {
+            error = errno;
+            break;
+        }
+
+        // reap everything that has completed
+        unsigned head = *theRing.cqHead;
+        unsigned tail = __atomic_load_n(theRing.cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* pCqe = &theRing.cqes[head & *theRing.cqMask];
+            int slot = (int) pCqe->user_data;
+            struct UringSlot* pSlot = &slots[slot];
+
+            if (pCqe->res < 0) {
+                error = -pCqe->res;
+                break;
+            }
+            if (pCqe->res == 0) {
+                // a zero-length read means the file got shorter underneath us
+                error = EIO;
+                break;
+            }
+
+            pSlot->done += pCqe->res;
+            if (pSlot->done < pSlot->length) {
+                // short read or write, go back for the rest
+                slot_continue(&theRing, pSlot, slot, fdIn, fdOut);
+            } else if (pSlot->state == SLOT_READING) {
+                // transform as soon as the data is here and send it straight back out
+                transform_buffer(pSlot->buffer, pSlot->length, mode);
+                pSlot->state = SLOT_WRITING;
+                pSlot->done = 0;
+                slot_continue(&theRing, pSlot, slot, fdIn, fdOut);
+            } else {
+                pSlot->state = SLOT_IDLE;
+                inFlight--;
+            }
+        }
+        __atomic_store_n(theRing.cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    if (error != 0) {
+        fprintf(stderr, "Error: Unable to transform %s: %s\n", in_filename, strerror(error));
+        unlink(out_filename);
+        exit(1);
+    }
+
+    if (close(fdOut) != 0) {
+        fprintf(stderr, "Error: Unable to write %s: %s\n", out_filename, strerror(errno));
+        exit(1);
+    }
+    close(fdIn);
+
+    for (i = 0; i < queueDepth; i++) {
+        free(slots[i].buffer);
+    }
+    free(slots);
+    uring_teardown(&theRing);
+
+    return sb.st_size;
+}
@@ -0,0 +1,271 @@
+/*
+batch.c - Parallel batch runner for ndshell
+
+"batch N jobfile" reads a file of commands, one per line, and keeps up to N
+of them running at once. There is no waiting on any particular pid: the
+reaper tells the batch whenever one of its processes exits, and the next line
+is started straight away. A line may be a pipeline, which counts as one job
+and finishes when its last process has; it may also start with "bound SEC"
+or "bound -term GRACE SEC" to limit how long it can run, and may use
+runcached, in which case a line whose result is cached finishes at once.
+Blank lines and lines starting with # are skipped.
+
+When every job has finished a summary is printed: each job's exit status,
+wall time and CPU time (from wait4), then the totals. Control-C stops the
+batch from starting anything more and interrupts what is running.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "ndshell.h"
+
+struct BatchJob {
+    char*       szLine;
+    int         nLine;              /* line number in the job file */
+    int         nLive;              /* processes of the job still running */
+    pid_t       lastPid;            /* its exit status is the job's */
+    int         wstatus;
+    int         bStarted;
+    int64_t     startNs;
+    int64_t     endNs;
+    double      cpu;                /* user + system seconds of all its processes */
+};
+
+struct Batch {
+    int                 bActive;
+    char*               szFile;
+    int                 nMax;
+    struct BatchJob*    jobs;
+    int                 nJobs;
+    int                 nNext;      /* next job to start */
+    int                 nRunning;
+    int                 nDone;
+    int                 bInterrupted;
+    int64_t             startNs;
+};
+
+static struct Batch g_batch;
+
+/* Splits job lines, apart from the shell's own so a batch can start from inside a command */
+static struct Tokenizer g_tok;
+
+static double timeval_s(struct timeval* pTime) {
+    return pTime->tv_sec + pTime->tv_usec / 1e6;
+}
+
+/* Read the job file into g_batch.jobs. Returns 0, or -1 after reporting why not. */
+static int batch_load(char* szFile) {
+    FILE* pFile = fopen(szFile, "r");
+    if (pFile == NULL) {
+        fprintf(stderr, "ndshell: %s: %s\n", szFile, strerror(errno));
+        return -1;
+    }
+
+    char* szLine = NULL;
+    size_t nSize = 0;
+    ssize_t nLength;
+    int nLine = 0;
+    int nCapacity = 0;
+    while ((nLength = getline(&szLine, &nSize, pFile)) >= 0) {
+        nLine++;
+        while (nLength > 0 && (szLine[nLength - 1] == '\n' || szLine[nLength - 1] == '\r')) {
+            szLine[--nLength] = '\0';
+        }
+        char* pStart = szLine + strspn(szLine, " \t");
+        if (*pStart == '\0' || *pStart == '#') {
+            continue;
+        }
+
+        if (g_batch.nJobs == nCapacity) {
+            nCapacity = nCapacity ? nCapacity * 2 : 64;
+            struct BatchJob* jobs = (struct BatchJob*) realloc(g_batch.jobs, nCapacity * sizeof(struct BatchJob));
+            if (jobs == NULL) {
+                fprintf(stderr, "ndshell: Out of memory reading %s\n", szFile);
+                break;
+            }
+            g_batch.jobs = jobs;
+        }
+        struct BatchJob* pJob = &g_batch.jobs[g_batch.nJobs];
+        memset(pJob, 0, sizeof(struct BatchJob));
+        pJob->szLine = strdup(pStart);
+        pJob->nLine = nLine;
+        if (pJob->szLine == NULL) {
+            fprintf(stderr, "ndshell: Out of memory reading %s\n", szFile);
+            break;
+        }
+        g_batch.nJobs++;
+    }
+    free(szLine);
+    fclose(pFile);
+    return 0;
+}
+
+/* Start job nJob. A job that cannot be started is finished on the spot. */
+static void batch_start_job(int nJob) {
+    struct BatchJob* pJob = &g_batch.jobs[nJob];
+    int counter = tokenizer_split(&g_tok, pJob->szLine, strlen(pJob->szLine));
+    char** command = g_tok.tokens;
+
+    char** executable = command;
+    int64_t limitNs = 0, graceNs = 0;
+    int bBad = 0;
+    if (counter < 0) {
+        fprintf(stderr, "ndshell: Invalid line %d of %s: %s.\n", pJob->nLine, g_batch.szFile, g_tok.szError);
+        bBad = 1;
+    }
+    else if (counter > 0 && strcmp(command[0], "bound") == 0) {
+        int nWords = parseBound(command + 1, &limitNs, &graceNs);
+        if (nWords < 0 || command[1 + nWords] == NULL) {
+            fprintf(stderr, "ndshell: Invalid bound on line %d of %s.\n", pJob->nLine, g_batch.szFile);
+            bBad = 1;
+        }
+        else {
+            executable = command + 1 + nWords;
+        }
+    }
+
+    pJob->bStarted = 1;
+    pJob->startNs = now_ns();
+    g_batch.nRunning++;
+    int nResult = bBad ? -1 : createChildProcess(executable, g_tok.quoted + (executable - command), nJob);
+    if (nResult == 1) {
+        // replayed from the cache, and already counted as done
+        return;
+    }
+    if (nResult != 0 && pJob->nLive == 0) {
+        // nothing started, so nothing will be reaped: count it as failed now
+        pJob->wstatus = 127 << 8;
+        pJob->endNs = pJob->startNs;
+        g_batch.nRunning--;
+        g_batch.nDone++;
+        return;
+    }
+    if (limitNs > 0 && pJob->nLive > 0) {
+        boundStarted(limitNs, graceNs);
+    }
+}
+
+/* Keep starting jobs until N are running or there are none left. Returns 1 when the batch is over. */
+int batch_fill() {
+    if (!g_batch.bActive) {
+        return 1;
+    }
+    while (!g_batch.bInterrupted && g_batch.nRunning < g_batch.nMax && g_batch.nNext < g_batch.nJobs) {
+        batch_start_job(g_batch.nNext++);
+    }
+    if (g_batch.nRunning > 0 || (!g_batch.bInterrupted && g_batch.nNext < g_batch.nJobs)) {
+        return 0;
+    }
+
+    // every job has finished (or the rest were cancelled): print the summary
+    double wall = (now_ns() - g_batch.startNs) / 1e9;
+    double cpu = 0;
+    int nOk = 0, nFailed = 0, nSignalled = 0;
+    int i;
+    printf("\nBatch %s: %d jobs, up to %d at a time\n", g_batch.szFile, g_batch.nJobs, g_batch.nMax);
+    for (i = 0; i < g_batch.nJobs; i++) {
+        struct BatchJob* pJob = &g_batch.jobs[i];
+        if (!pJob->bStarted) {
+            printf("  line %-5d not started             %s\n", pJob->nLine, pJob->szLine);
+            continue;
+        }
+        char szStatus[32];
+        if (WIFSIGNALED(pJob->wstatus)) {
+            snprintf(szStatus, sizeof(szStatus), "signal %d", WTERMSIG(pJob->wstatus));
+            nSignalled++;
+        }
+        else {
+            snprintf(szStatus, sizeof(szStatus), "exit %d", WEXITSTATUS(pJob->wstatus));
+            if (WEXITSTATUS(pJob->wstatus) == 0) {
+                nOk++;
+            }
+            else {
+                nFailed++;
+            }
+        }
+        printf("  line %-5d %-10s %8.3f s wall %8.3f s cpu  %s\n", pJob->nLine, szStatus,
+               (pJob->endNs - pJob->startNs) / 1e9, pJob->cpu, pJob->szLine);
+        cpu += pJob->cpu;
+    }
+    printf("Batch done in %.3f s wall, %.3f s cpu: %d succeeded, %d failed, %d killed by a signal",
+           wall, cpu, nOk, nFailed, nSignalled);
+    if (g_batch.nNext < g_batch.nJobs) {
+        printf(", %d not started", g_batch.nJobs - g_batch.nNext);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    for (i = 0; i < g_batch.nJobs; i++) {
+        free(g_batch.jobs[i].szLine);
+    }
+    free(g_batch.jobs);
+    free(g_batch.szFile);
+    memset(&g_batch, 0, sizeof(g_batch));
+    return 1;
+}
+
+/* Begin a batch. Returns 0 if the shell should now wait for it, -1 if there is nothing to wait for. */
+int batch_begin(int nMax, char* szFile) {
+    memset(&g_batch, 0, sizeof(g_batch));
+    if (g_tok.tokens == NULL) {
+        tokenizer_init(&g_tok);
+    }
+    if (batch_load(szFile) != 0) {
+        return -1;
+    }
+    if (g_batch.nJobs == 0) {
+        printf("ndshell: %s has no jobs in it.\n", szFile);
+        free(g_batch.jobs);
+        return -1;
+    }
+    g_batch.bActive = 1;
+    g_batch.szFile = strdup(szFile);
+    g_batch.nMax = nMax;
+    g_batch.startNs = now_ns();
+    return batch_fill() ? -1 : 0;
+}
+
+/* A process of batch job nJob has started */
+void batch_process_started(int nJob, pid_t pid) {
+    g_batch.jobs[nJob].nLive++;
+    g_batch.jobs[nJob].lastPid = pid;
+}
+
+/* A process of batch job nJob has been reaped */
+void batch_process_done(int nJob, pid_t pid, int wstatus, struct rusage* pUsage) {
+    struct BatchJob* pJob = &g_batch.jobs[nJob];
+    pJob->cpu += timeval_s(&pUsage->ru_utime) + timeval_s(&pUsage->ru_stime);
+    if (pid == pJob->lastPid) {
+        pJob->wstatus = wstatus;
+    }
+    if (--pJob->nLive == 0) {
+        pJob->endNs = now_ns();
+        g_batch.nRunning--;
+        g_batch.nDone++;
+    }
+}
+
+/* Batch job nJob was answered from the runcached cache without starting anything */
+void batch_job_replayed(int nJob, int wstatus) {
+    struct BatchJob* pJob = &g_batch.jobs[nJob];
+    pJob->wstatus = wstatus;
+    pJob->endNs = now_ns();
+    g_batch.nRunning--;
+    g_batch.nDone++;
+}
+
+/* Control-C: start nothing more and pass the interrupt on to the running jobs */
+void batch_interrupt() {
+    int i;
+    g_batch.bInterrupted = 1;
+    for (i = 0; i < g_jobs.nCapacity; i++) {
+        if (g_jobs.jobs[i].pid > 0 && g_jobs.jobs[i].nBatchJob >= 0) {
+            kill(g_jobs.jobs[i].pid, SIGINT);
+        }
+    }
+}
@@ -0,0 +1,722 @@
+/*
+cache.c - Memoized commands for ndshell
+
+"runcached [-in FILE]... [-env NAME]... [-out FILE]... command args" runs a
+command whose result depends only on what it is given, and remembers that
+result. Next time the same command is given the same inputs its output and
+exit status are replayed from the cache and nothing is started. runcached
+works at the front of run, start, bound and batch lines too.
+
+A result is keyed on everything the command sees that the shell can name:
+the working directory, the path, size and mtime of the executable PATH finds
+(so rebuilding a program invalidates its results), each argument, PATH and
+the variables given with -env, and the size and mtime of each -in file and
+of a "< file" redirection. The key text is hashed to name the entry, and
+kept in it as well, so two keys that hash alike are told apart on lookup.
+
+An entry is a directory named by the hash, holding the status, the -out
+paths and the key in "meta", the captured "stdout" and "stderr", and a copy
+of each -out file, which a replay puts back. While a command runs its output
+goes to files in a hidden directory, so output is shown when the command
+finishes, hit or miss. Only commands that exit (with any status) are
+stored; one killed by a signal is not. The finished directory is renamed
+into place, so an entry is either complete or absent, and hidden
+directories left by a shell that was killed are swept up by the next one.
+
+The directory is $NDSHELL_CACHE_DIR, else $XDG_CACHE_HOME/ndshell, else
+~/.cache/ndshell, and it is kept under $NDSHELL_CACHE_SIZE (512M by default)
+by evicting the least recently used entries; a hit bumps an entry's mtime.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+#include "ndshell.h"
+
+#define CACHE_DEFAULT_SIZE  (512LL << 20)
+#define CACHE_MAX_OUTS      16
+#define CACHE_DIR_MAX       (PATH_MAX / 2)
+
+/* A command that missed and is running; its result is stored when it is reaped */
+struct CachePending {
+    pid_t   pid;                /* 0 when the slot is free */
+    char    szHash[CACHE_HASH_LEN + 1];
+    char    szTemp[CACHE_DIR_MAX + 64]; /* the entry being filled in */
+    char*   szKey;
+    int     nOuts;
+    char*   outs[CACHE_MAX_OUTS];
+};
+
+/* An entry on disk, for eviction */
+struct CacheEntry {
+    char    szName[CACHE_HASH_LEN + 1];
+    int64_t lastUsed;           /* mtime of its directory, in ns */
+    int64_t nBytes;
+};
+
+static struct {
+    int                     bReady;
+    char                    szDir[CACHE_DIR_MAX];
+    int64_t                 maxBytes;
+    int64_t                 nBytes;         /* on disk, counted when the cache is first used */
+    int                     nEntries;
+    struct CachePending*    pending;
+    int                     nPending;
+    int                     nTemp;          /* names the hidden directories */
+    /* this session */
+    int                     nHits;
+    int                     nMisses;
+    int                     nStored;
+    int                     nEvicted;
+    int64_t                 savedNs;
+} g_cache;
+
+/* Two FNV-1a hashes from different starting points, as 32 hex digits */
+static void cache_hash(const char* szKey, char* szHash) {
+    uint64_t a = 14695981039346656037ULL;
+    uint64_t b = 0x9e3779b97f4a7c15ULL;
+    const unsigned char* p;
+    for (p = (const unsigned char*) szKey; *p != '\0'; p++) {
+        a = (a ^ *p) * 1099511628211ULL;
+        b = (b ^ *p) * 0x100000001b3ULL;
+        b ^= b >> 29;
+    }
+    snprintf(szHash, CACHE_HASH_LEN + 1, "%016llx%016llx", (unsigned long long) a, (unsigned long long) b);
+}
+
+/* Bytes in the files of one entry directory */
+static int64_t cache_entry_size(char* szEntry) {
+    char szPath[PATH_MAX + 300];
+    int64_t nBytes = 0;
+    DIR* pDir = opendir(szEntry);
+    struct dirent* pFile;
+    struct stat info;
+    if (pDir == NULL) {
+        return 0;
+    }
+    while ((pFile = readdir(pDir)) != NULL) {
+        snprintf(szPath, sizeof(szPath), "%s/%s", szEntry, pFile->d_name);
+        if (pFile->d_name[0] != '.' && stat(szPath, &info) == 0) {
+            nBytes += info.st_size;
+        }
+    }
+    closedir(pDir);
+    return nBytes;
+}
+
+static void cache_remove_entry(char* szEntry) {
+    char szPath[PATH_MAX + 300];
+    DIR* pDir = opendir(szEntry);
+    struct dirent* pFile;
+    if (pDir != NULL) {
+        while ((pFile = readdir(pDir)) != NULL) {
+            if (strcmp(pFile->d_name, ".") != 0 && strcmp(pFile->d_name, "..") != 0) {
+                snprintf(szPath, sizeof(szPath), "%s/%s", szEntry, pFile->d_name);
+                unlink(szPath);
+            }
+        }
+        closedir(pDir);
+    }
+    rmdir(szEntry);
+}
+
+/* Every entry, for counting and eviction; returns how many, or -1 */
+static int cache_list(struct CacheEntry** pEntries) {
+    DIR* pDir = opendir(g_cache.szDir);
+    struct dirent* pFile;
+    int nCount = 0, nCapacity = 0;
+    *pEntries = NULL;
+    if (pDir == NULL) {
+        return -1;
+    }
+    while ((pFile = readdir(pDir)) != NULL) {
+        char szEntry[PATH_MAX + 300];
+        struct stat info;
+        if (strlen(pFile->d_name) != CACHE_HASH_LEN) {
+            continue;
+        }
+        snprintf(szEntry, sizeof(szEntry), "%s/%s", g_cache.szDir, pFile->d_name);
+        if (stat(szEntry, &info) != 0 || !S_ISDIR(info.st_mode)) {
+            continue;
+        }
+        if (nCount == nCapacity) {
+            nCapacity = nCapacity ? nCapacity * 2 : 64;
+            struct CacheEntry* entries = (struct CacheEntry*) realloc(*pEntries, nCapacity * sizeof(struct CacheEntry));
+            if (entries == NULL) {
+                break;
+            }
+            *pEntries = entries;
+        }
+        struct CacheEntry* pEntry = &(*pEntries)[nCount++];
+        memcpy(pEntry->szName, pFile->d_name, CACHE_HASH_LEN + 1);
+        pEntry->lastUsed = info.st_mtim.tv_sec * NSEC_PER_SEC + info.st_mtim.tv_nsec;
+        pEntry->nBytes = cache_entry_size(szEntry);
+    }
+    closedir(pDir);
+    return nCount;
+}
+
+static int cache_compare_used(const void* pA, const void* pB) {
+    const struct CacheEntry* a = (const struct CacheEntry*) pA;
+    const struct CacheEntry* b = (const struct CacheEntry*) pB;
+    return (a->lastUsed > b->lastUsed) - (a->lastUsed < b->lastUsed);
+}
+
+/* Remove the least recently used entries until the cache fits again */
+static void cache_evict() {
+    struct CacheEntry* entries;
+    int nCount = cache_list(&entries);
+    int i;
+    if (nCount <= 0) {
+        free(entries);
+        return;
+    }
+    qsort(entries, nCount, sizeof(struct CacheEntry), cache_compare_used);
+    g_cache.nBytes = 0;
+    for (i = 0; i < nCount; i++) {
+        g_cache.nBytes += entries[i].nBytes;
+    }
+    g_cache.nEntries = nCount;
+    for (i = 0; i < nCount && g_cache.nBytes > g_cache.maxBytes; i++) {
+        char szEntry[PATH_MAX + 300];
+        snprintf(szEntry, sizeof(szEntry), "%s/%s", g_cache.szDir, entries[i].szName);
+        cache_remove_entry(szEntry);
+        g_cache.nBytes -= entries[i].nBytes;
+        g_cache.nEntries--;
+        g_cache.nEvicted++;
+    }
+    free(entries);
+}
+
+/* Remove the hidden .run.PID.N directories of shells that died with commands
+   still running. Those of another shell that is still alive are left alone;
+   this shell has none yet, so any with its pid belong to an earlier one. */
+static void cache_sweep() {
+    DIR* pDir = opendir(g_cache.szDir);
+    struct dirent* pFile;
+    if (pDir == NULL) {
+        return;
+    }
+    while ((pFile = readdir(pDir)) != NULL) {
+        char szEntry[PATH_MAX + 300];
+        int pid;
+        if (sscanf(pFile->d_name, ".run.%d.", &pid) != 1) {
+            continue;
+        }
+        if (pid == getpid() || pid <= 0 || (kill(pid, 0) != 0 && errno == ESRCH)) {
+            snprintf(szEntry, sizeof(szEntry), "%s/%s", g_cache.szDir, pFile->d_name);
+            cache_remove_entry(szEntry);
+        }
+    }
+    closedir(pDir);
+}
+
+/* Find or make the cache directory the first time it is needed. Returns 0, or -1 after saying why not. */
+static int cache_setup() {
+    if (g_cache.bReady) {
+        return 0;
+    }
+    char* szDir = getenv("NDSHELL_CACHE_DIR");
+    char* szXdg = getenv("XDG_CACHE_HOME");
+    char* szHome = getenv("HOME");
+    char szParent[CACHE_DIR_MAX];
+    int nLength;
+    if (szDir != NULL && szDir[0] != '\0') {
+        nLength = snprintf(g_cache.szDir, sizeof(g_cache.szDir), "%s", szDir);
+    }
+    else if (szXdg != NULL && szXdg[0] != '\0') {
+        nLength = snprintf(g_cache.szDir, sizeof(g_cache.szDir), "%s/ndshell", szXdg);
+    }
+    else if (szHome != NULL && szHome[0] != '\0') {
+        snprintf(szParent, sizeof(szParent), "%s/.cache", szHome);
+        mkdir(szParent, 0755);
+        nLength = snprintf(g_cache.szDir, sizeof(g_cache.szDir), "%s/.cache/ndshell", szHome);
+    }
+    else {
+        fprintf(stderr, "ndshell: runcached: set NDSHELL_CACHE_DIR or HOME to say where the cache goes.\n");
+        return -1;
+    }
+    if (nLength >= (int) sizeof(g_cache.szDir)) {
+        fprintf(stderr, "ndshell: runcached: the cache directory's name is too long.\n");
+        return -1;
+    }
+    if (mkdir(g_cache.szDir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "ndshell: runcached: %s: %s\n", g_cache.szDir, strerror(errno));
+        return -1;
+    }
+
+    g_cache.maxBytes = CACHE_DEFAULT_SIZE;
+    char* szSize = getenv("NDSHELL_CACHE_SIZE");
+    if (szSize != NULL && parse_size(szSize) > 0) {
+        g_cache.maxBytes = parse_size(szSize);
+    }
+    // counting the entries also brings the cache under a size that may have shrunk
+    cache_sweep();
+    cache_evict();
+    g_cache.bReady = 1;
+    return 0;
+}
+
+/* Where PATH finds argv0, or NULL */
+static char* cache_find_exe(char* szName, char* szPath, size_t nSize) {
+    if (strchr(szName, '/') != NULL) {
+        snprintf(szPath, nSize, "%s", szName);
+        return access(szPath, X_OK) == 0 ? szPath : NULL;
+    }
+    char* szDirs = getenv("PATH");
+    char* p = szDirs != NULL ? szDirs : "/usr/local/bin:/usr/bin:/bin";
+    while (*p != '\0') {
+        size_t nDir = strcspn(p, ":");
+        snprintf(szPath, nSize, "%.*s/%s", (int) nDir, nDir ? p : ".", szName);
+        if (access(szPath, X_OK) == 0) {
+            return szPath;
+        }
+        p += nDir + (p[nDir] == ':');
+    }
+    return NULL;
+}
+
+/* Append to a growing string; returns 0, or -1 if there was no memory */
+static int key_add(char** pKey, size_t* pLength, size_t* pSize, const char* szFormat, ...) {
+    while (1) {
+        va_list args;
+        va_start(args, szFormat);
+        int nWritten = vsnprintf(*pKey + *pLength, *pSize - *pLength, szFormat, args);
+        va_end(args);
+        if (nWritten < 0) {
+            return -1;
+        }
+        if (*pLength + nWritten < *pSize) {
+            *pLength += nWritten;
+            return 0;
+        }
+        size_t nSize = (*pSize + nWritten) * 2;
+        char* szKey = (char*) realloc(*pKey, nSize);
+        if (szKey == NULL) {
+            fprintf(stderr, "ndshell: runcached: Out of memory\n");
+            return -1;
+        }
+        *pKey = szKey;
+        *pSize = nSize;
+    }
+}
+
+/* The size and mtime of a file, for the key */
+static int key_add_file(char** pKey, size_t* pLength, size_t* pSize, char* szKind, char* szFile) {
+    struct stat info;
+    if (stat(szFile, &info) != 0) {
+        fprintf(stderr, "ndshell: runcached: %s: %s\n", szFile, strerror(errno));
+        return -1;
+    }
+    return key_add(pKey, pLength, pSize, "%s %zu:%s %lld %lld.%09ld\n", szKind, strlen(szFile), szFile,
+                   (long long) info.st_size, (long long) info.st_mtim.tv_sec, info.st_mtim.tv_nsec);
+}
+
+/* Copy a whole file to fd; returns 0 or -1 */
+static int cache_copy_to(char* szFile, int fdTo) {
+    int fdFrom = open(szFile, O_RDONLY | O_CLOEXEC);
+    if (fdFrom < 0) {
+        return -1;
+    }
+    char buffer[65536];
+    ssize_t nMoved;
+    // sendfile where the kernel can, otherwise read and write
+    while ((nMoved = sendfile(fdTo, fdFrom, NULL, 1 << 30)) > 0) {
+    }
+    if (nMoved < 0 && (errno == EINVAL || errno == ENOSYS)) {
+        while ((nMoved = read(fdFrom, buffer, sizeof(buffer))) > 0) {
+            ssize_t nDone = 0;
+            while (nDone < nMoved) {
+                ssize_t nWritten = write(fdTo, buffer + nDone, nMoved - nDone);
+                if (nWritten < 0) {
+                    close(fdFrom);
+                    return -1;
+                }
+                nDone += nWritten;
+            }
+        }
+    }
+    close(fdFrom);
+    return nMoved < 0 ? -1 : 0;
+}
+
+/* Copy szFrom to szTo by way of a temporary file, so szTo is never half written */
+static int cache_copy_file(char* szFrom, char* szTo) {
+    char szTemp[PATH_MAX + 32];
+    snprintf(szTemp, sizeof(szTemp), "%s.ndshell.%d", szTo, getpid());
+    int fd = open(szTemp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    int nResult = cache_copy_to(szFrom, fd);
+    if (close(fd) != 0 || nResult != 0 || rename(szTemp, szTo) != 0) {
+        unlink(szTemp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Show what a run captured: its stdout and stderr, in that order */
+static void cache_show_output(char* szEntry) {
+    char szFile[PATH_MAX + 16];
+    fflush(stdout);
+    snprintf(szFile, sizeof(szFile), "%s/stdout", szEntry);
+    cache_copy_to(szFile, STDOUT_FILENO);
+    snprintf(szFile, sizeof(szFile), "%s/stderr", szEntry);
+    cache_copy_to(szFile, STDERR_FILENO);
+}
+
+/* Replay an entry if it is there and its key matches. Returns 1 and fills in
+   *pStatus if it did, 0 if it is a miss. */
+static int cache_replay(char* szHash, char* szKey, int* pStatus) {
+    char szEntry[PATH_MAX + 64];
+    char szFile[PATH_MAX + 96];
+    snprintf(szEntry, sizeof(szEntry), "%s/%s", g_cache.szDir, szHash);
+    snprintf(szFile, sizeof(szFile), "%s/meta", szEntry);
+    FILE* pFile = fopen(szFile, "r");
+    if (pFile == NULL) {
+        return 0;
+    }
+
+    // the status line, then the -out paths (file.N is a copy of the Nth), then the key
+    int wstatus, nOuts = 0;
+    long long wallNs;
+    char* outs[CACHE_MAX_OUTS];
+    int bMatch = fscanf(pFile, "status %d wall %lld outs %d\n", &wstatus, &wallNs, &nOuts) == 3
+        && nOuts >= 0 && nOuts <= CACHE_MAX_OUTS;
+    int i, nRead = 0;
+    for (i = 0; bMatch && i < nOuts; i++) {
+        size_t nLength;
+        bMatch = fscanf(pFile, "%zu:", &nLength) == 1 && nLength < PATH_MAX
+            && (outs[nRead] = (char*) malloc(nLength + 1)) != NULL;
+        if (bMatch) {
+            bMatch = fread(outs[nRead], 1, nLength, pFile) == nLength && fgetc(pFile) == '\n';
+            outs[nRead++][nLength] = '\0';
+        }
+    }
+    size_t nKey = strlen(szKey);
+    char* szStored = bMatch ? (char*) malloc(nKey + 2) : NULL;
+    bMatch = szStored != NULL
+        && fread(szStored, 1, nKey + 1, pFile) == nKey
+        && memcmp(szStored, szKey, nKey) == 0;
+    free(szStored);
+    fclose(pFile);
+
+    int64_t startNs = now_ns();
+    // -out files first: if one cannot be put back this is a miss after all
+    for (i = 0; bMatch && i < nOuts; i++) {
+        snprintf(szFile, sizeof(szFile), "%s/file.%d", szEntry, i);
+        if (cache_copy_file(szFile, outs[i]) != 0) {
+            fprintf(stderr, "ndshell: runcached: unable to restore %s, running the command again.\n", outs[i]);
+            bMatch = 0;
+        }
+    }
+    for (i = 0; i < nRead; i++) {
+        free(outs[i]);
+    }
+    if (!bMatch) {
+        return 0;
+    }
+    cache_show_output(szEntry);
+    utimensat(AT_FDCWD, szEntry, NULL, 0);
+
+    *pStatus = wstatus;
+    g_cache.nHits++;
+    int64_t replayNs = now_ns() - startNs;
+    g_cache.savedNs += wallNs > replayNs ? wallNs - replayNs : 0;
+    printf("ndshell: runcached: replayed a result that took %.3f s, exited %s %d\n", wallNs / 1e9,
+           WIFSIGNALED(wstatus) ? "with signal" : "with status",
+           WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : WEXITSTATUS(wstatus));
+    fflush(stdout);
+    return 1;
+}
+
+/* A free slot in the pending array, growing it if need be; -1 if there was no memory */
+static int cache_pending_slot() {
+    int i;
+    for (i = 0; i < g_cache.nPending; i++) {
+        if (g_cache.pending[i].pid == 0) {
+            return i;
+        }
+    }
+    struct CachePending* all = (struct CachePending*) realloc(g_cache.pending, (i + 1) * sizeof(struct CachePending));
+    if (all == NULL) {
+        return -1;
+    }
+    all[i].pid = 0;
+    g_cache.pending = all;
+    return g_cache.nPending++;
+}
+
+/* Run args through the cache: replay a stored result, or start the command
+   with its output captured so the result can be stored when it is reaped.
+   Returns 1 if it was replayed (a batch job is told its status), 0 if it
+   was started (runCPID is its pid), or -1 after saying what went wrong. */
+int cache_run(char** args, char* quoted, int nBatchJob) {
+    char* ins[CACHE_MAX_OUTS];
+    char* envs[CACHE_MAX_OUTS];
+    char* outs[CACHE_MAX_OUTS];
+    int nIns = 0, nEnvs = 0, nOuts = 0;
+    int i = 0;
+
+    // options, then limits, then the command
+    while (args[i] != NULL && !quoted[i] && args[i][0] == '-'
+           && (strcmp(args[i], "-in") == 0 || strcmp(args[i], "-env") == 0 || strcmp(args[i], "-out") == 0)) {
+        if (args[i + 1] == NULL || nIns == CACHE_MAX_OUTS || nEnvs == CACHE_MAX_OUTS || nOuts == CACHE_MAX_OUTS) {
+            fprintf(stderr, "ndshell: Invalid runcached command! %s takes a name, at most %d times.\n", args[i], CACHE_MAX_OUTS);
+            return -1;
+        }
+        if (args[i][1] == 'i') {
+            ins[nIns++] = args[i + 1];
+        } else if (args[i][1] == 'e') {
+            envs[nEnvs++] = args[i + 1];
+        } else {
+            outs[nOuts++] = args[i + 1];
+        }
+        i += 2;
+    }
+    args += i;
+    quoted += i;
+
+    struct Limits limits;
+    int nWords = limits_parse(args, &limits);
+    if (nWords < 0) {
+        return -1;
+    }
+    args += nWords;
+    quoted += nWords;
+
+    struct Pipeline pipeline;
+    if (pipeline_parse(args, quoted, &pipeline) != 0) {
+        return -1;
+    }
+    if (pipeline.nStages > 1 || pipeline.szOutput != NULL) {
+        fprintf(stderr, "ndshell: Invalid runcached command! It takes one command, which may read from < file; use -out FILE for what it writes.\n");
+        return -1;
+    }
+    if (cache_setup() != 0) {
+        return -1;
+    }
+
+    // the key: everything the result depends on that the shell can see
+    char szExe[PATH_MAX];
+    char szCwd[PATH_MAX];
+    size_t nLength = 0, nSize = 1024;
+    char* szKey = (char*) malloc(nSize);
+    if (szKey == NULL) {
+        fprintf(stderr, "ndshell: runcached: Out of memory\n");
+        return -1;
+    }
+    int bOk = 1;
+    if (getcwd(szCwd, sizeof(szCwd)) == NULL) {
+        szCwd[0] = '\0';
+    }
+    bOk = bOk && key_add(&szKey, &nLength, &nSize, "cwd %zu:%s\n", strlen(szCwd), szCwd) == 0;
+    if (bOk && cache_find_exe(args[0], szExe, sizeof(szExe)) != NULL) {
+        bOk = key_add_file(&szKey, &nLength, &nSize, "exe", szExe) == 0;
+    }
+    for (i = 0; bOk && args[i] != NULL; i++) {
+        bOk = key_add(&szKey, &nLength, &nSize, "arg %zu:%s\n", strlen(args[i]), args[i]) == 0;
+    }
+    char* szPath = getenv("PATH");
+    bOk = bOk && key_add(&szKey, &nLength, &nSize, "env 4:PATH=%zu:%s\n", strlen(szPath ? szPath : ""), szPath ? szPath : "") == 0;
+    for (i = 0; bOk && i < nEnvs; i++) {
+        char* szValue = getenv(envs[i]);
+        if (szValue != NULL) {
+            bOk = key_add(&szKey, &nLength, &nSize, "env %zu:%s=%zu:%s\n", strlen(envs[i]), envs[i], strlen(szValue), szValue) == 0;
+        } else {
+            bOk = key_add(&szKey, &nLength, &nSize, "env %zu:%s unset\n", strlen(envs[i]), envs[i]) == 0;
+        }
+    }
+    if (bOk && pipeline.szInput != NULL) {
+        bOk = key_add_file(&szKey, &nLength, &nSize, "stdin", pipeline.szInput) == 0;
+    }
+    for (i = 0; bOk && i < nIns; i++) {
+        bOk = key_add_file(&szKey, &nLength, &nSize, "in", ins[i]) == 0;
+    }
+    for (i = 0; bOk && i < nOuts; i++) {
+        bOk = key_add(&szKey, &nLength, &nSize, "out %zu:%s\n", strlen(outs[i]), outs[i]) == 0;
+    }
+    if (!bOk) {
+        free(szKey);
+        return -1;
+    }
+
+    char szHash[CACHE_HASH_LEN + 1];
+    int wstatus;
+    cache_hash(szKey, szHash);
+    if (cache_replay(szHash, szKey, &wstatus)) {
+        free(szKey);
+        if (nBatchJob >= 0) {
+            batch_job_replayed(nBatchJob, wstatus);
+        }
+        return 1;
+    }
+    g_cache.nMisses++;
+
+    // a miss: run it with stdout and stderr going into a hidden entry directory
+    int nSlot = cache_pending_slot();
+    if (nSlot < 0) {
+        fprintf(stderr, "ndshell: runcached: Out of memory\n");
+        free(szKey);
+        return -1;
+    }
+    struct CachePending pending;
+    memset(&pending, 0, sizeof(pending));
+    memcpy(pending.szHash, szHash, sizeof(szHash));
+    pending.szKey = szKey;
+    snprintf(pending.szTemp, sizeof(pending.szTemp), "%s/.run.%d.%d", g_cache.szDir, getpid(), ++g_cache.nTemp);
+    char szOut[PATH_MAX + 16], szErr[PATH_MAX + 16];
+    snprintf(szOut, sizeof(szOut), "%s/stdout", pending.szTemp);
+    snprintf(szErr, sizeof(szErr), "%s/stderr", pending.szTemp);
+    int fdIn = -1, fdOut = -1, fdErr = -1;
+    if (mkdir(pending.szTemp, 0755) != 0
+        || (fdOut = open(szOut, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+        || (fdErr = open(szErr, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+        || (pipeline.szInput != NULL && (fdIn = open(pipeline.szInput, O_RDONLY | O_CLOEXEC)) < 0)) {
+        fprintf(stderr, "ndshell: runcached: %s\n", strerror(errno));
+        if (fdOut >= 0) {
+            close(fdOut);
+        }
+        if (fdErr >= 0) {
+            close(fdErr);
+        }
+        cache_remove_entry(pending.szTemp);
+        free(szKey);
+        return -1;
+    }
+
+    int bLimited = limits_prepare(&limits);
+    int nError;
+    fflush(stdout);
+    int64_t startNs = now_ns();
+    pid_t pid = spawn_process(args, g_nSpawnBackend, events_child_sigmask(), fdIn, fdOut, fdErr, bLimited ? &limits : NULL, &nError);
+    if (fdIn >= 0) {
+        close(fdIn);
+    }
+    close(fdOut);
+    close(fdErr);
+    if (pid < 0) {
+        spawn_report_error(args[0], nError);
+        limits_abandon(&limits);
+        cache_remove_entry(pending.szTemp);
+        free(szKey);
+        return -1;
+    }
+
+    struct Job* pJob = addJob(pid, args, nBatchJob, startNs, &limits);
+    if (pJob == NULL) {
+        cache_remove_entry(pending.szTemp);
+        free(szKey);
+        return -1;
+    }
+    pending.pid = pid;
+    for (i = 0; i < nOuts; i++) {
+        if ((pending.outs[pending.nOuts] = strdup(outs[i])) != NULL) {
+            pending.nOuts++;
+        }
+    }
+    g_cache.pending[nSlot] = pending;
+    pJob->nCache = nSlot;
+    printf("Process %d started\n", pid);
+    fflush(stdout);
+    return 0;
+}
+
+/* A runcached job has been reaped: show its output, and store its result if it exited */
+void cache_process_done(struct Job* pJob, int wstatus) {
+    struct CachePending* pPending = &g_cache.pending[pJob->nCache];
+    char szFile[PATH_MAX + 16];
+    char szEntry[PATH_MAX + 64];
+    int64_t wallNs = now_ns() - pJob->startNs;
+    int bStore = WIFEXITED(wstatus);
+    int i;
+
+    cache_show_output(pPending->szTemp);
+
+    // keep a copy of everything it wrote
+    for (i = 0; bStore && i < pPending->nOuts; i++) {
+        snprintf(szFile, sizeof(szFile), "%s/file.%d", pPending->szTemp, i);
+        if (cache_copy_file(pPending->outs[i], szFile) != 0) {
+            fprintf(stderr, "ndshell: runcached: %s: %s, not caching the result.\n", pPending->outs[i], strerror(errno));
+            bStore = 0;
+        }
+    }
+    if (bStore) {
+        snprintf(szFile, sizeof(szFile), "%s/meta", pPending->szTemp);
+        FILE* pFile = fopen(szFile, "w");
+        bStore = pFile != NULL
+            && fprintf(pFile, "status %d wall %lld outs %d\n", wstatus, (long long) wallNs, pPending->nOuts) > 0;
+        for (i = 0; bStore && i < pPending->nOuts; i++) {
+            bStore = fprintf(pFile, "%zu:%s\n", strlen(pPending->outs[i]), pPending->outs[i]) > 0;
+        }
+        bStore = bStore && fputs(pPending->szKey, pFile) >= 0;
+        if (pFile != NULL && fclose(pFile) != 0) {
+            bStore = 0;
+        }
+    }
+
+    // the finished entry replaces any old one of the same name
+    snprintf(szEntry, sizeof(szEntry), "%s/%s", g_cache.szDir, pPending->szHash);
+    if (bStore) {
+        int64_t nBytes = cache_entry_size(pPending->szTemp);
+        struct stat info;
+        if (stat(szEntry, &info) == 0) {
+            g_cache.nBytes -= cache_entry_size(szEntry);
+            g_cache.nEntries--;
+            cache_remove_entry(szEntry);
+        }
+        if (rename(pPending->szTemp, szEntry) == 0) {
+            g_cache.nStored++;
+            g_cache.nEntries++;
+            g_cache.nBytes += nBytes;
+            if (g_cache.nBytes > g_cache.maxBytes) {
+                cache_evict();
+            }
+        }
+    }
+    cache_remove_entry(pPending->szTemp);
+
+    for (i = 0; i < pPending->nOuts; i++) {
+        free(pPending->outs[i]);
+    }
+    free(pPending->szKey);
+    pPending->pid = 0;
+    pJob->nCache = -1;
+}
+
+/* The cachestats command */
+void cache_stats() {
+    if (cache_setup() != 0) {
+        return;
+    }
+    int nRuns = g_cache.nHits + g_cache.nMisses;
+    printf("runcached: %d hits, %d misses (%.1f%% hit rate), %.3f s saved; %d stored, %d evicted\n",
+           g_cache.nHits, g_cache.nMisses, nRuns ? 100.0 * g_cache.nHits / nRuns : 0.0,
+           g_cache.savedNs / 1e9, g_cache.nStored, g_cache.nEvicted);
+    printf("cache %s: %d entries, %lld of %lld KiB\n", g_cache.szDir, g_cache.nEntries,
+           (long long) (g_cache.nBytes >> 10), (long long) (g_cache.maxBytes >> 10));
+    fflush(stdout);
+}
+
+/* On the way out: drop the hidden directories of commands still running */
+void cache_cleanup() {
+    int i;
+    for (i = 0; i < g_cache.nPending; i++) {
+        if (g_cache.pending[i].pid != 0) {
+            cache_remove_entry(g_cache.pending[i].szTemp);
+        }
+    }
+}
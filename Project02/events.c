@@ -0,0 +1,202 @@
+/*
+events.c - Event loop plumbing for ndshell
+
+SIGCHLD and SIGINT are blocked and delivered through a signalfd instead of
+a handler, so nothing runs in signal context. The shell polls the signalfd
+together with stdin and the bound jobs' timerfd (timers.c): whenever a child
+exits it is reaped straight away with wait4(WNOHANG), in a loop because one
+SIGCHLD can stand for several exits, and its status is printed whether or
+not anyone is waiting for it. Background
+jobs therefore never linger as zombies and the prompt never blocks on them.
+
+stdin is read with read() into a buffer rather than through stdio, so poll
+can tell whether a line is waiting; lines already in the buffer are handed
+out, in place, before stdin is polled again. The buffer grows to fit the
+longest line, so lines may be any length.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "ndshell.h"
+
+static int g_signalFd = -1;
+static sigset_t g_originalMask;
+
+int64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Block the signals the loop handles and open the signalfd for them */
+int events_init() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    if (sigprocmask(SIG_BLOCK, &mask, &g_originalMask) != 0) {
+        return -1;
+    }
+    g_signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    return g_signalFd < 0 ? -1 : 0;
+}
+
+/* The mask a new child should exec with: the one the shell started with */
+sigset_t* events_child_sigmask() {
+    return &g_originalMask;
+}
+
+/* Sleep until a signal arrives, a bound job's time is up or, if bReadInput,
+   stdin has something. Signals the jobs that are out of time and reads what
+   stdin has. Returns 0, or -1 if poll failed. */
+int events_wait(struct InputBuffer* pInput, int bReadInput) {
+    struct pollfd fds[3];
+    int nFds = 2;
+
+    fds[0].fd = g_signalFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = timers_fd();
+    fds[1].events = POLLIN;
+    if (bReadInput && !pInput->bEOF) {
+        fds[2].fd = pInput->fd;
+        fds[2].events = POLLIN;
+        nFds = 3;
+    }
+
+    if (poll(fds, nFds, -1) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    if (fds[1].revents & POLLIN) {
+        timers_expire();
+    }
+    if (nFds == 3 && (fds[2].revents & (POLLIN | POLLHUP | POLLERR))) {
+        // move what is left of a line to the front, and grow when one line fills the buffer
+        if (pInput->nStart > 0) {
+            memmove(pInput->data, pInput->data + pInput->nStart, pInput->nLength - pInput->nStart);
+            pInput->nLength -= pInput->nStart;
+            pInput->nStart = 0;
+        }
+        if (pInput->nLength == pInput->nSize) {
+            size_t nSize = pInput->nSize ? pInput->nSize * 2 : INPUT_BUFFER_INITIAL;
+            char* data = (char*) realloc(pInput->data, nSize);
+            if (data == NULL) {
+                fprintf(stderr, "ndshell: Out of memory for a %zu byte line\n", pInput->nLength);
+                pInput->bEOF = 1;
+                return 0;
+            }
+            pInput->data = data;
+            pInput->nSize = nSize;
+        }
+        ssize_t nRead = read(pInput->fd, pInput->data + pInput->nLength, pInput->nSize - pInput->nLength);
+        if (nRead == 0) {
+            pInput->bEOF = 1;
+        } else if (nRead < 0 && errno != EINTR && errno != EAGAIN) {
+            perror("ndshell: read");
+            pInput->bEOF = 1;
+        } else if (nRead > 0) {
+            pInput->nLength += nRead;
+        }
+    }
+    return 0;
+}
+
+/* Report how a reaped child ended and what it used, and drop it from the table */
+static void events_report(struct Job* pJob, pid_t cpid, int wstatus, struct rusage* pUsage) {
+    // a runcached job's output was held back until now
+    if (pJob->nCache >= 0) {
+        cache_process_done(pJob, wstatus);
+    }
+    if (WIFSIGNALED(wstatus)) {
+        printf("Process %d exited abnormally with signal %d\n", cpid, WTERMSIG(wstatus));
+    }
+    else {
+        printf("Process %d exited normally with status %d\n", cpid, WEXITSTATUS(wstatus));
+    }
+    stats_record(pJob, wstatus, pUsage);
+    fflush(stdout);
+    if (pJob->nBatchJob >= 0) {
+        batch_process_done(pJob->nBatchJob, cpid, wstatus, pUsage);
+    }
+    timers_cancel(pJob);
+    limits_release(pJob);
+    jobs_remove(&g_jobs, cpid);
+}
+
+/* Drain the signalfd, reap every child that has exited and interrupt the
+   foreground job on Control-C. *pWaiting is cleared once what the shell was
+   waiting for has happened. */
+void events_handle_signals(pid_t* pWaiting) {
+    struct signalfd_siginfo info;
+    int bChild = 0;
+
+    while (read(g_signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGCHLD) {
+            bChild = 1;
+        } else if (info.ssi_signo == SIGINT) {
+            // Control-C goes to whatever the shell is waiting on, never to the shell itself
+            if (*pWaiting > 0) {
+                interruptWaiting(*pWaiting);
+            } else if (*pWaiting == WAIT_BATCH) {
+                batch_interrupt();
+            } else if (*pWaiting == WAIT_NONE) {
+                printf("\nndshell>");
+                fflush(stdout);
+            }
+        }
+    }
+    if (!bChild) {
+        return;
+    }
+
+    pid_t cpid;
+    int wstatus;
+    struct rusage usage;
+    while ((cpid = wait4(-1, &wstatus, WNOHANG, &usage)) > 0) {
+        // a child the table could not take was killed and waited for when it started
+        struct Job* pJob = jobs_find(&g_jobs, cpid);
+        if (pJob == NULL) {
+            continue;
+        }
+        events_report(pJob, cpid, wstatus, &usage);
+        if (*pWaiting == cpid || *pWaiting == WAIT_NEXT) {
+            *pWaiting = WAIT_NONE;
+        }
+    }
+    if (*pWaiting == WAIT_ALL && g_jobs.nCount == 0) {
+        *pWaiting = WAIT_NONE;
+    }
+    // start the next batch jobs in place of the ones that finished
+    if (*pWaiting == WAIT_BATCH && batch_fill()) {
+        *pWaiting = WAIT_NONE;
+    }
+}
+
+/* Take the next whole line out of the buffer, without its newline. At end of
+   input a last line without a newline counts too. *pLine points into the
+   buffer and is good until the next events_wait. Returns 1 if there was a line. */
+int input_next_line(struct InputBuffer* pInput, char** pLine, size_t* pLength) {
+    char* pBegin = pInput->data + pInput->nStart;
+    size_t nAvailable = pInput->nLength - pInput->nStart;
+    char* pEnd = nAvailable > 0 ? memchr(pBegin, '\n', nAvailable) : NULL;
+
+    if (pEnd != NULL) {
+        *pLength = pEnd - pBegin;
+        pInput->nStart += *pLength + 1;
+    } else if (pInput->bEOF && nAvailable > 0) {
+        *pLength = nAvailable;
+        pInput->nStart = pInput->nLength;
+    } else {
+        return 0;
+    }
+    *pLine = pBegin;
+    return 1;
+}
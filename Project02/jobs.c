@@ -0,0 +1,146 @@
+/*
+jobs.c - Job table for ndshell
+
+Jobs live in one array that doubles as it fills, and a job's ID is its place
+in the array plus one. Slots of finished jobs go on a free list and are
+handed out again, lowest-recently-freed first, so IDs stay small the way
+shell job numbers do. A hash table of pids (chained through the jobs
+themselves, bucket count a power of two kept at least the array size) finds
+a job from the pid waitpid returns, so starting, reaping and looking up a job
+are O(1) however many are running.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ndshell.h"
+
+/* Fibonacci hashing spreads the mostly sequential pids across the buckets */
+static int jobs_bucket(struct JobTable* pTable, pid_t pid) {
+    return (int) (((uint32_t) pid * 2654435769u) >> (32 - pTable->nBucketBits));
+}
+
+/* Double the job array and the buckets, and rehash */
+static int jobs_grow(struct JobTable* pTable) {
+    int nCapacity = pTable->nCapacity ? pTable->nCapacity * 2 : JOB_TABLE_INITIAL;
+    struct Job* jobs = (struct Job*) realloc(pTable->jobs, nCapacity * sizeof(struct Job));
+    if (jobs == NULL) {
+        return -1;
+    }
+    int nBucketBits = pTable->nBucketBits ? pTable->nBucketBits : 1;
+    while ((1 << nBucketBits) < nCapacity) {
+        nBucketBits++;
+    }
+    int* buckets = (int*) malloc((1 << nBucketBits) * sizeof(int));
+    if (buckets == NULL) {
+        pTable->jobs = jobs;
+        return -1;
+    }
+
+    // the new slots go on the free list in order, so IDs are handed out from the bottom
+    int i;
+    for (i = pTable->nCapacity; i < nCapacity; i++) {
+        jobs[i].pid = 0;
+        jobs[i].nNext = i + 1 < nCapacity ? i + 1 : pTable->nFree;
+    }
+    pTable->nFree = pTable->nCapacity;
+
+    free(pTable->buckets);
+    pTable->jobs = jobs;
+    pTable->nCapacity = nCapacity;
+    pTable->buckets = buckets;
+    pTable->nBucketBits = nBucketBits;
+    for (i = 0; i < (1 << nBucketBits); i++) {
+        buckets[i] = -1;
+    }
+    for (i = 0; i < nCapacity; i++) {
+        if (jobs[i].pid > 0) {
+            int nBucket = jobs_bucket(pTable, jobs[i].pid);
+            jobs[i].nNext = buckets[nBucket];
+            buckets[nBucket] = i;
+        }
+    }
+    return 0;
+}
+
+void jobs_init(struct JobTable* pTable) {
+    memset(pTable, 0, sizeof(struct JobTable));
+    pTable->nFree = -1;
+}
+
+/* Record a new job. Returns its ID, or -1 if there was no memory. */
+int jobs_add(struct JobTable* pTable, pid_t pid, char** command) {
+    if (pTable->nFree < 0 && jobs_grow(pTable) != 0) {
+        return -1;
+    }
+    int nSlot = pTable->nFree;
+    struct Job* pJob = &pTable->jobs[nSlot];
+    pTable->nFree = pJob->nNext;
+
+    pJob->pid = pid;
+    pJob->nBatchJob = -1;
+    pJob->nTimer = -1;
+    pJob->nCpu = -1;
+    pJob->nCgroup = 0;
+    pJob->nCache = -1;
+    // keep as much of the command line as fits, for the jobs command
+    size_t nLength = 0;
+    int i;
+    pJob->szCommand[0] = '\0';
+    for (i = 0; command[i] != NULL && nLength + 1 < JOB_COMMAND_LEN; i++) {
+        nLength += snprintf(pJob->szCommand + nLength, JOB_COMMAND_LEN - nLength, i ? " %s" : "%s", command[i]);
+    }
+
+    int nBucket = jobs_bucket(pTable, pid);
+    pJob->nNext = pTable->buckets[nBucket];
+    pTable->buckets[nBucket] = nSlot;
+    pTable->nCount++;
+    return nSlot + 1;
+}
+
+struct Job* jobs_find(struct JobTable* pTable, pid_t pid) {
+    if (pTable->nCapacity == 0 || pid <= 0) {
+        return NULL;
+    }
+    int nSlot = pTable->buckets[jobs_bucket(pTable, pid)];
+    while (nSlot >= 0 && pTable->jobs[nSlot].pid != pid) {
+        nSlot = pTable->jobs[nSlot].nNext;
+    }
+    return nSlot >= 0 ? &pTable->jobs[nSlot] : NULL;
+}
+
+/* The job with the given ID, or NULL if there is none */
+struct Job* jobs_by_id(struct JobTable* pTable, int nId) {
+    if (nId < 1 || nId > pTable->nCapacity || pTable->jobs[nId - 1].pid <= 0) {
+        return NULL;
+    }
+    return &pTable->jobs[nId - 1];
+}
+
+int jobs_id(struct JobTable* pTable, struct Job* pJob) {
+    return (int) (pJob - pTable->jobs) + 1;
+}
+
+/* Forget a job. Returns 0, or -1 if the pid was not a job. */
+int jobs_remove(struct JobTable* pTable, pid_t pid) {
+    if (pTable->nCapacity == 0 || pid <= 0) {
+        return -1;
+    }
+    int* pLink = &pTable->buckets[jobs_bucket(pTable, pid)];
+    while (*pLink >= 0 && pTable->jobs[*pLink].pid != pid) {
+        pLink = &pTable->jobs[*pLink].nNext;
+    }
+    if (*pLink < 0) {
+        return -1;
+    }
+    int nSlot = *pLink;
+    struct Job* pJob = &pTable->jobs[nSlot];
+    *pLink = pJob->nNext;
+
+    pJob->pid = 0;
+    pJob->nNext = pTable->nFree;
+    pTable->nFree = nSlot;
+    pTable->nCount--;
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+jobs_bench.c - Per-job overhead of ndshell
+
+Starts a number of /bin/true jobs twice: once straight from this program
+with posix_spawn and waitpid, which is how ndshell starts jobs by default,
+and once by feeding ndshell a script of "start /bin/true" lines followed
+by enough "wait"s to see them all reaped.
+The difference per job is what the shell itself costs: reading and parsing
+the line, the job table, and reaping and reporting the exit.
+
+Usage: ./jobs_bench [jobs] [ndshell]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_JOBS    100000
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+extern char** environ;
+
+/* posix_spawn /bin/true nJobs times, reaping whatever has exited as we go */
+static double run_direct(int nJobs) {
+    char* argv[] = {"/bin/true", NULL};
+    int nRunning = 0;
+    int i;
+
+    double start = now_s();
+    for (i = 0; i < nJobs; i++) {
+        pid_t pid;
+        int nError = posix_spawn(&pid, argv[0], NULL, NULL, argv, environ);
+        if (nError != 0) {
+            fprintf(stderr, "jobs_bench: posix_spawn: %s\n", strerror(nError));
+            exit(1);
+        }
+        nRunning++;
+        while (nRunning > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+            nRunning--;
+        }
+    }
+    while (nRunning > 0 && waitpid(-1, NULL, 0) > 0) {
+        nRunning--;
+    }
+    return now_s() - start;
+}
+
+/* Write all of a buffer to a pipe */
+static void write_all(int fd, char* pData, size_t nLength) {
+    while (nLength > 0) {
+        ssize_t nWritten = write(fd, pData, nLength);
+        if (nWritten <= 0) {
+            perror("jobs_bench: write");
+            exit(1);
+        }
+        pData += nWritten;
+        nLength -= nWritten;
+    }
+}
+
+/* Run the same jobs through ndshell, its output thrown away */
+static double run_shell(int nJobs, char* szShell) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("jobs_bench: pipe");
+        exit(1);
+    }
+
+    double start = now_s();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("jobs_bench: fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int fdNull = open("/dev/null", O_WRONLY);
+        dup2(fds[0], STDIN_FILENO);
+        dup2(fdNull, STDOUT_FILENO);
+        dup2(fdNull, STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execl(szShell, szShell, (char*) NULL);
+        _exit(127);
+    }
+    close(fds[0]);
+
+    // every wait either sees a job exit or finds none left, so nJobs of them reap everything
+    static char start_line[] = "start /bin/true\n";
+    static char wait_line[] = "wait\n";
+    char block[4096];
+    size_t nBlock = 0;
+    int i;
+    for (i = 0; i < 2 * nJobs; i++) {
+        char* szLine = i < nJobs ? start_line : wait_line;
+        size_t nLine = i < nJobs ? sizeof(start_line) - 1 : sizeof(wait_line) - 1;
+        if (nBlock + nLine > sizeof(block)) {
+            write_all(fds[1], block, nBlock);
+            nBlock = 0;
+        }
+        memcpy(block + nBlock, szLine, nLine);
+        nBlock += nLine;
+    }
+    write_all(fds[1], block, nBlock);
+    write_all(fds[1], "exit\n", 5);
+    close(fds[1]);
+
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        fprintf(stderr, "jobs_bench: %s did not exit cleanly\n", szShell);
+        exit(1);
+    }
+    return now_s() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int nJobs = DEFAULT_JOBS;
+    char* szShell = "./ndshell";
+
+    if (argc > 1) {
+        nJobs = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        szShell = argv[2];
+    }
+    if (nJobs <= 0) {
+        fprintf(stderr, "Usage: %s [jobs] [ndshell]\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    double direct = run_direct(nJobs);
+    printf("direct    %8d jobs %8.3f s %8.1f us/job\n", nJobs, direct, direct * 1e6 / nJobs);
+    double shell = run_shell(nJobs, szShell);
+    printf("ndshell   %8d jobs %8.3f s %8.1f us/job\n", nJobs, shell, shell * 1e6 / nJobs);
+    printf("overhead  %26.1f us/job\n", (shell - direct) * 1e6 / nJobs);
+    return 0;
+}
@@ -0,0 +1,595 @@
+/*
+limits.c - Resource limits and CPU placement for ndshell jobs
+
+"limit key=value ..." sets limits for every job started afterwards, and the
+same words at the front of a command (start, run, bound or a batch line)
+set them for that job alone, overriding the shell-wide ones:
+
+    cpus=0-3,6      CPU affinity
+    cpu=150         CPU time as a percentage of one core (cgroup cpu.max)
+    mem=512M        memory (cgroup memory.max, else RLIMIT_AS)
+    nice=10         scheduling priority
+    io=idle|be:N|rt:N   IO priority class and level
+    spread=on       pin each job to a core of its own
+
+Any of them can be "off". A job with limits is started with fork rather
+than posix_spawnp, whatever the backend, because posix_spawnp has no hook
+to run code in the child: the child takes its limits on itself between the
+fork and the exec, so the program never runs a moment without them. Every
+process of a pipeline shares its job's limits, cgroup and core.
+
+CPU and memory quotas need cgroup v2. The first job that asks for one makes
+a cgroup "ndshell.PID" under the shell's own, moves the shell into a "shell"
+leaf inside it (a cgroup that hands controllers down may not hold processes
+itself) and enables the cpu and memory controllers. Each limited job then
+gets a "job.N" cgroup of its own, removed when its last process is reaped. Where the
+cgroup tree is not writable or the controllers are not delegated, memory
+falls back to RLIMIT_AS through prlimit, and a CPU quota, which has no rlimit
+equivalent, is reported as not applied.
+
+Spread mode hands out cores round the allowed set, least used first, so as
+long as there are no more jobs than cores no two share one and they stop
+evicting each other's cache.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "ndshell.h"
+
+/* ioprio_set has no glibc wrapper */
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_IDLE   3
+
+/* CPU quota period for cpu.max */
+#define CPU_PERIOD_US       100000
+
+static struct Limits g_limits;
+
+/* How many running jobs spread mode has pinned to each CPU */
+static int g_spreadCount[LIMITS_MAX_CPUS];
+
+static struct {
+    int     bTried;
+    int     bCpu;               /* controllers enabled for the job cgroups */
+    int     bMemory;
+    char    szBase[PATH_MAX];   /* where the shell started */
+    char    szRoot[PATH_MAX];   /* ndshell.PID */
+} g_cgroup;
+
+static int g_bWarnedCpu = 0;
+
+static char* g_szIoClasses[] = {"none", "rt", "be", "idle"};
+
+static void cpus_set(uint64_t* cpus, int nCpu) {
+    cpus[nCpu / 64] |= 1ULL << (nCpu % 64);
+}
+
+static int cpus_isset(uint64_t* cpus, int nCpu) {
+    return (cpus[nCpu / 64] >> (nCpu % 64)) & 1;
+}
+
+/* "0-3,6" into a CPU bitmap. Returns 0, or -1 if it is not a valid list. */
+static int parse_cpus(char* szList, uint64_t* cpus) {
+    memset(cpus, 0, LIMITS_MAX_CPUS / 8);
+    char* p = szList;
+    int bAny = 0;
+    while (*p != '\0') {
+        char* pEnd;
+        long nFirst = strtol(p, &pEnd, 10);
+        long nLast = nFirst;
+        if (pEnd == p) {
+            return -1;
+        }
+        if (*pEnd == '-') {
+            p = pEnd + 1;
+            nLast = strtol(p, &pEnd, 10);
+            if (pEnd == p) {
+                return -1;
+            }
+        }
+        if (nFirst < 0 || nLast >= LIMITS_MAX_CPUS || nFirst > nLast) {
+            return -1;
+        }
+        for (; nFirst <= nLast; nFirst++) {
+            cpus_set(cpus, nFirst);
+        }
+        bAny = 1;
+        if (*pEnd == ',') {
+            pEnd++;
+        }
+        else if (*pEnd != '\0') {
+            return -1;
+        }
+        p = pEnd;
+    }
+    return bAny ? 0 : -1;
+}
+
+/* "512M" and the like into bytes, or -1 */
+int64_t parse_size(char* szSize) {
+    char* pEnd;
+    double size = strtod(szSize, &pEnd);
+    int nShift = 0;
+    switch (*pEnd) {
+        case 'k': case 'K': nShift = 10; pEnd++; break;
+        case 'm': case 'M': nShift = 20; pEnd++; break;
+        case 'g': case 'G': nShift = 30; pEnd++; break;
+        case 't': case 'T': nShift = 40; pEnd++; break;
+    }
+    if (pEnd == szSize || *pEnd != '\0' || size <= 0) {
+        return -1;
+    }
+    return (int64_t) (size * (1LL << nShift));
+}
+
+/* Apply one key=value word to pLimits. Returns 1 if it was one, 0 if it is
+   not a limit at all, or -1 after saying what is wrong with the value. */
+static int limits_word(char* szWord, struct Limits* pLimits) {
+    char* szValue = strchr(szWord, '=');
+    if (szValue == NULL) {
+        return 0;
+    }
+    size_t nKey = szValue - szWord;
+    szValue++;
+    int bOff = strcmp(szValue, "off") == 0;
+    char* pEnd;
+
+    if (nKey == 4 && strncmp(szWord, "cpus", 4) == 0) {
+        if (!bOff && parse_cpus(szValue, pLimits->cpus) != 0) {
+            fprintf(stderr, "ndshell: Invalid limit! cpus takes a list such as 0-3,6.\n");
+            return -1;
+        }
+        pLimits->bCpus = !bOff;
+        pLimits->nSet |= LIMIT_CPUS;
+    }
+    else if (nKey == 3 && strncmp(szWord, "cpu", 3) == 0) {
+        long nPercent = bOff ? 0 : strtol(szValue, &pEnd, 10);
+        if (!bOff && (*pEnd != '\0' || nPercent <= 0)) {
+            fprintf(stderr, "ndshell: Invalid limit! cpu takes a percentage of one core, such as 50 or 200.\n");
+            return -1;
+        }
+        pLimits->nCpuPercent = (int) nPercent;
+        pLimits->nSet |= LIMIT_CPU;
+    }
+    else if (nKey == 3 && strncmp(szWord, "mem", 3) == 0) {
+        int64_t nBytes = bOff ? 0 : parse_size(szValue);
+        if (nBytes < 0) {
+            fprintf(stderr, "ndshell: Invalid limit! mem takes a size such as 512M or 2G.\n");
+            return -1;
+        }
+        pLimits->memBytes = nBytes;
+        pLimits->nSet |= LIMIT_MEM;
+    }
+    else if (nKey == 4 && strncmp(szWord, "nice", 4) == 0) {
+        long nNice = bOff ? 0 : strtol(szValue, &pEnd, 10);
+        if (!bOff && (*pEnd != '\0' || nNice < -20 || nNice > 19)) {
+            fprintf(stderr, "ndshell: Invalid limit! nice takes a number from -20 to 19.\n");
+            return -1;
+        }
+        pLimits->bNice = !bOff;
+        pLimits->nNice = (int) nNice;
+        pLimits->nSet |= LIMIT_NICE;
+    }
+    else if (nKey == 2 && strncmp(szWord, "io", 2) == 0) {
+        int nClass = 0, nLevel = 4;
+        if (!bOff) {
+            for (nClass = 1; nClass <= IOPRIO_CLASS_IDLE; nClass++) {
+                size_t nName = strlen(g_szIoClasses[nClass]);
+                if (strncmp(szValue, g_szIoClasses[nClass], nName) == 0
+                    && (szValue[nName] == '\0' || szValue[nName] == ':')) {
+                    break;
+                }
+            }
+            char* szLevel = strchr(szValue, ':');
+            if (szLevel != NULL) {
+                nLevel = (int) strtol(szLevel + 1, &pEnd, 10);
+            }
+            if (nClass > IOPRIO_CLASS_IDLE || (szLevel != NULL && (*pEnd != '\0' || nLevel < 0 || nLevel > 7
+                || nClass == IOPRIO_CLASS_IDLE))) {
+                fprintf(stderr, "ndshell: Invalid limit! io takes idle, be:LEVEL or rt:LEVEL, LEVEL from 0 to 7.\n");
+                return -1;
+            }
+        }
+        pLimits->nIoClass = nClass;
+        pLimits->nIoLevel = nClass == IOPRIO_CLASS_IDLE ? 0 : nLevel;
+        pLimits->nSet |= LIMIT_IO;
+    }
+    else if (nKey == 6 && strncmp(szWord, "spread", 6) == 0) {
+        if (!bOff && strcmp(szValue, "on") != 0) {
+            fprintf(stderr, "ndshell: Invalid limit! spread takes on or off.\n");
+            return -1;
+        }
+        pLimits->bSpread = !bOff;
+        pLimits->nSet |= LIMIT_SPREAD;
+    }
+    else {
+        return 0;
+    }
+    return 1;
+}
+
+/* Take the limits off the front of a command. Returns how many words they
+   were, or -1 after saying what is wrong. */
+int limits_parse(char** args, struct Limits* pLimits) {
+    memset(pLimits, 0, sizeof(struct Limits));
+    int i;
+    for (i = 0; args[i] != NULL; i++) {
+        int nResult = limits_word(args[i], pLimits);
+        if (nResult < 0) {
+            return -1;
+        }
+        if (nResult == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* Write a string to a cgroup file. Returns 0, or -1 with errno set. */
+static int cgroup_write(char* szDir, char* szFile, char* szValue) {
+    char szPath[PATH_MAX];
+    snprintf(szPath, sizeof(szPath), "%s/%s", szDir, szFile);
+    int fd = open(szPath, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t nWritten = write(fd, szValue, strlen(szValue));
+    int nError = errno;
+    close(fd);
+    errno = nError;
+    return nWritten < 0 ? -1 : 0;
+}
+
+/* Set up ndshell.PID the first time a job needs a quota. Returns 1 if cgroup
+   quotas can be used. */
+static int cgroup_setup() {
+    if (g_cgroup.bTried) {
+        return g_cgroup.bCpu || g_cgroup.bMemory;
+    }
+    g_cgroup.bTried = 1;
+
+    // where cgroup2 is mounted, and where in it the shell is
+    char szLine[PATH_MAX + 256];
+    char szMount[PATH_MAX] = "";
+    char szPath[sizeof(szLine)] = "";
+    FILE* pFile = fopen("/proc/self/mountinfo", "r");
+    while (pFile != NULL && fgets(szLine, sizeof(szLine), pFile) != NULL) {
+        char* pType = strstr(szLine, " - cgroup2 ");
+        if (pType != NULL) {
+            sscanf(szLine, "%*s %*s %*s %*s %4095s", szMount);
+            break;
+        }
+    }
+    if (pFile != NULL) {
+        fclose(pFile);
+    }
+    pFile = fopen("/proc/self/cgroup", "r");
+    while (pFile != NULL && fgets(szLine, sizeof(szLine), pFile) != NULL) {
+        if (strncmp(szLine, "0::", 3) == 0) {
+            snprintf(szPath, sizeof(szPath), "%s", szLine + 3);
+            szPath[strcspn(szPath, "\n")] = '\0';
+            break;
+        }
+    }
+    if (pFile != NULL) {
+        fclose(pFile);
+    }
+    if (szMount[0] == '\0') {
+        return 0;
+    }
+
+    if (snprintf(g_cgroup.szBase, sizeof(g_cgroup.szBase), "%s%s", szMount,
+                 strcmp(szPath, "/") == 0 ? "" : szPath) >= (int) sizeof(g_cgroup.szBase)
+        || snprintf(g_cgroup.szRoot, sizeof(g_cgroup.szRoot), "%s/ndshell.%d",
+                    g_cgroup.szBase, getpid()) >= (int) sizeof(g_cgroup.szRoot)
+        || (mkdir(g_cgroup.szRoot, 0755) != 0 && errno != EEXIST)) {
+        g_cgroup.szRoot[0] = '\0';
+        return 0;
+    }
+
+    // the shell moves down into a leaf so ndshell.PID, and perhaps the cgroup it came from, hold no processes
+    char szShell[PATH_MAX + 8];
+    char szPid[32];
+    snprintf(szShell, sizeof(szShell), "%s/shell", g_cgroup.szRoot);
+    snprintf(szPid, sizeof(szPid), "%d", getpid());
+    if (mkdir(szShell, 0755) == 0) {
+        cgroup_write(szShell, "cgroup.procs", szPid);
+    }
+    cgroup_write(g_cgroup.szBase, "cgroup.subtree_control", "+cpu +memory");
+    cgroup_write(g_cgroup.szRoot, "cgroup.subtree_control", "+cpu");
+    cgroup_write(g_cgroup.szRoot, "cgroup.subtree_control", "+memory");
+
+    char szControl[PATH_MAX + 32];
+    snprintf(szControl, sizeof(szControl), "%s/cgroup.subtree_control", g_cgroup.szRoot);
+    pFile = fopen(szControl, "r");
+    if (pFile != NULL) {
+        char* pWord;
+        if (fgets(szLine, sizeof(szLine), pFile) != NULL) {
+            for (pWord = strtok(szLine, " \n"); pWord != NULL; pWord = strtok(NULL, " \n")) {
+                g_cgroup.bCpu |= strcmp(pWord, "cpu") == 0;
+                g_cgroup.bMemory |= strcmp(pWord, "memory") == 0;
+            }
+        }
+        fclose(pFile);
+    }
+    return g_cgroup.bCpu || g_cgroup.bMemory;
+}
+
+/* A cgroup for one job with the quotas it can have there. Returns its
+   number, or 0 if it could have none; clears *pbCpu and *pMemBytes for the
+   quotas it took. */
+static int cgroup_create(int* pbCpu, int64_t* pMemBytes, int nCpuPercent) {
+    static int nLast = 0;
+    char szDir[PATH_MAX + 32];
+    char szValue[64];
+    if (!cgroup_setup()) {
+        return 0;
+    }
+    int nCgroup = ++nLast;
+    snprintf(szDir, sizeof(szDir), "%s/job.%d", g_cgroup.szRoot, nCgroup);
+    if (mkdir(szDir, 0755) != 0) {
+        return 0;
+    }
+
+    int bCpu = 0, bMem = 0;
+    if (*pbCpu && g_cgroup.bCpu) {
+        snprintf(szValue, sizeof(szValue), "%lld %d", (long long) nCpuPercent * CPU_PERIOD_US / 100, CPU_PERIOD_US);
+        bCpu = cgroup_write(szDir, "cpu.max", szValue) == 0;
+    }
+    if (*pMemBytes > 0 && g_cgroup.bMemory) {
+        snprintf(szValue, sizeof(szValue), "%lld", (long long) *pMemBytes);
+        bMem = cgroup_write(szDir, "memory.max", szValue) == 0;
+    }
+    if (!bCpu && !bMem) {
+        rmdir(szDir);
+        return 0;
+    }
+    if (bCpu) {
+        *pbCpu = 0;
+    }
+    if (bMem) {
+        *pMemBytes = 0;
+    }
+    return nCgroup;
+}
+
+/* The least used CPU the job may run on, or -1 */
+static int spread_pick(struct Limits* pLimits) {
+    cpu_set_t allowed;
+    int nBest = -1;
+    int i;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return -1;
+    }
+    for (i = 0; i < LIMITS_MAX_CPUS && i < CPU_SETSIZE; i++) {
+        if (!CPU_ISSET(i, &allowed) || (pLimits->bCpus && !cpus_isset(pLimits->cpus, i))) {
+            continue;
+        }
+        if (nBest < 0 || g_spreadCount[i] < g_spreadCount[nBest]) {
+            nBest = i;
+        }
+    }
+    return nBest;
+}
+
+/* Work out everything a new job gets, in place: the limits the command gave,
+   the shell's for the rest, a core if spreading, and a cgroup for its quotas
+   (what a cgroup cannot take is left for rlimits). Every process of the job
+   shares them. Returns 1 if the job's processes have anything to set up
+   before they exec. */
+int limits_prepare(struct Limits* pLimits) {
+    struct Limits limits = g_limits;
+    if (pLimits->nSet & LIMIT_CPUS) {
+        limits.bCpus = pLimits->bCpus;
+        memcpy(limits.cpus, pLimits->cpus, sizeof(limits.cpus));
+    }
+    if (pLimits->nSet & LIMIT_CPU) {
+        limits.nCpuPercent = pLimits->nCpuPercent;
+    }
+    if (pLimits->nSet & LIMIT_MEM) {
+        limits.memBytes = pLimits->memBytes;
+    }
+    if (pLimits->nSet & LIMIT_NICE) {
+        limits.bNice = pLimits->bNice;
+        limits.nNice = pLimits->nNice;
+    }
+    if (pLimits->nSet & LIMIT_IO) {
+        limits.nIoClass = pLimits->nIoClass;
+        limits.nIoLevel = pLimits->nIoLevel;
+    }
+    if (pLimits->nSet & LIMIT_SPREAD) {
+        limits.bSpread = pLimits->bSpread;
+    }
+    limits.nCpu = -1;
+    limits.nCgroup = 0;
+
+    // spreading narrows the job's CPUs down to one
+    if (limits.bSpread) {
+        limits.nCpu = spread_pick(&limits);
+        if (limits.nCpu >= 0) {
+            memset(limits.cpus, 0, sizeof(limits.cpus));
+            cpus_set(limits.cpus, limits.nCpu);
+            limits.bCpus = 1;
+        }
+    }
+
+    int bCpu = limits.nCpuPercent > 0;
+    if (bCpu || limits.memBytes > 0) {
+        limits.nCgroup = cgroup_create(&bCpu, &limits.memBytes, limits.nCpuPercent);
+    }
+    if (bCpu && !g_bWarnedCpu) {
+        fprintf(stderr, "ndshell: CPU quotas need the cgroup v2 cpu controller, which is not available here; cpu= is not applied.\n");
+        g_bWarnedCpu = 1;
+    }
+    *pLimits = limits;
+    return limits.bCpus || limits.bNice || limits.nIoClass > 0 || limits.memBytes > 0 || limits.nCgroup > 0;
+}
+
+/* In a new child, before it execs: take on the job's limits. A limit that
+   cannot be set is reported, and the job runs without it. */
+void limits_enter(struct Limits* pLimits) {
+    if (pLimits->nCgroup > 0) {
+        char szDir[PATH_MAX + 32];
+        snprintf(szDir, sizeof(szDir), "%s/job.%d", g_cgroup.szRoot, pLimits->nCgroup);
+        // "0" is whoever writes it
+        if (cgroup_write(szDir, "cgroup.procs", "0") != 0) {
+            fprintf(stderr, "ndshell: cgroup: %s\n", strerror(errno));
+        }
+    }
+    if (pLimits->bCpus) {
+        cpu_set_t set;
+        int i;
+        CPU_ZERO(&set);
+        for (i = 0; i < LIMITS_MAX_CPUS && i < CPU_SETSIZE; i++) {
+            if (cpus_isset(pLimits->cpus, i)) {
+                CPU_SET(i, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "ndshell: cpus: %s\n", strerror(errno));
+        }
+    }
+    if (pLimits->bNice && setpriority(PRIO_PROCESS, 0, pLimits->nNice) != 0) {
+        fprintf(stderr, "ndshell: nice: %s\n", strerror(errno));
+    }
+    if (pLimits->nIoClass > 0) {
+        int nPriority = pLimits->nIoClass << IOPRIO_CLASS_SHIFT | pLimits->nIoLevel;
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, nPriority) != 0) {
+            fprintf(stderr, "ndshell: io: %s\n", strerror(errno));
+        }
+    }
+    if (pLimits->memBytes > 0) {
+        struct rlimit limit = {(rlim_t) pLimits->memBytes, (rlim_t) pLimits->memBytes};
+        if (setrlimit(RLIMIT_AS, &limit) != 0) {
+            fprintf(stderr, "ndshell: mem: %s\n", strerror(errno));
+        }
+    }
+}
+
+/* One of the job's processes has started */
+void limits_started(struct Job* pJob, struct Limits* pLimits) {
+    pJob->nCpu = pLimits->nCpu;
+    pJob->nCgroup = pLimits->nCgroup;
+    if (pJob->nCpu >= 0) {
+        g_spreadCount[pJob->nCpu]++;
+    }
+}
+
+/* A process has been reaped: give back its core, and remove its cgroup if it
+   was the last one in it (rmdir fails while any are left) */
+void limits_release(struct Job* pJob) {
+    if (pJob->nCpu >= 0) {
+        g_spreadCount[pJob->nCpu]--;
+    }
+    if (pJob->nCgroup > 0) {
+        char szDir[PATH_MAX + 32];
+        snprintf(szDir, sizeof(szDir), "%s/job.%d", g_cgroup.szRoot, pJob->nCgroup);
+        rmdir(szDir);
+    }
+}
+
+/* None of the job's processes started: remove the cgroup made for it */
+void limits_abandon(struct Limits* pLimits) {
+    if (pLimits->nCgroup > 0) {
+        char szDir[PATH_MAX + 32];
+        snprintf(szDir, sizeof(szDir), "%s/job.%d", g_cgroup.szRoot, pLimits->nCgroup);
+        rmdir(szDir);
+    }
+}
+
+/* The shell is exiting: move back to where it started and remove ndshell.PID */
+void limits_cleanup() {
+    if (g_cgroup.szRoot[0] == '\0') {
+        return;
+    }
+    char szShell[PATH_MAX + 8];
+    char szPid[32];
+    snprintf(szShell, sizeof(szShell), "%s/shell", g_cgroup.szRoot);
+    snprintf(szPid, sizeof(szPid), "%d", getpid());
+    cgroup_write(g_cgroup.szBase, "cgroup.procs", szPid);
+    // jobs still running in the background keep their cgroups, and so this one
+    rmdir(szShell);
+    rmdir(g_cgroup.szRoot);
+}
+
+/* The limit command: show the shell-wide limits, or set them */
+void limits_command(char** args) {
+    int i;
+    for (i = 0; args[i] != NULL; i++) {
+        struct Limits limits;
+        memset(&limits, 0, sizeof(limits));
+        int nResult = limits_word(args[i], &limits);
+        if (nResult == 0) {
+            fprintf(stderr, "ndshell: Invalid limit! %s is not one of cpus, cpu, mem, nice, io or spread.\n", args[i]);
+        }
+        if (nResult <= 0) {
+            return;
+        }
+    }
+    // all of them are valid, so set them
+    for (i = 0; args[i] != NULL; i++) {
+        limits_word(args[i], &g_limits);
+    }
+    if (i > 0) {
+        return;
+    }
+
+    printf("cpus=");
+    if (g_limits.bCpus) {
+        int nCpu, bFirst = 1;
+        for (nCpu = 0; nCpu < LIMITS_MAX_CPUS; nCpu++) {
+            if (cpus_isset(g_limits.cpus, nCpu) && (nCpu == 0 || !cpus_isset(g_limits.cpus, nCpu - 1))) {
+                int nLast = nCpu;
+                while (nLast + 1 < LIMITS_MAX_CPUS && cpus_isset(g_limits.cpus, nLast + 1)) {
+                    nLast++;
+                }
+                printf(nLast > nCpu ? "%s%d-%d" : "%s%d", bFirst ? "" : ",", nCpu, nLast);
+                bFirst = 0;
+            }
+        }
+    }
+    else {
+        printf("off");
+    }
+    if (g_limits.nCpuPercent > 0) {
+        printf(" cpu=%d", g_limits.nCpuPercent);
+    }
+    else {
+        printf(" cpu=off");
+    }
+    if (g_limits.memBytes > 0) {
+        printf(" mem=%lldK", (long long) g_limits.memBytes >> 10);
+    }
+    else {
+        printf(" mem=off");
+    }
+    if (g_limits.bNice) {
+        printf(" nice=%d", g_limits.nNice);
+    }
+    else {
+        printf(" nice=off");
+    }
+    if (g_limits.nIoClass == IOPRIO_CLASS_IDLE) {
+        printf(" io=idle");
+    }
+    else if (g_limits.nIoClass > 0) {
+        printf(" io=%s:%d", g_szIoClasses[g_limits.nIoClass], g_limits.nIoLevel);
+    }
+    else {
+        printf(" io=off");
+    }
+    printf(" spread=%s\n", g_limits.bSpread ? "on" : "off");
+    fflush(stdout);
+}
@@ -2,287 +2,434 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <signal.h>
 
-#define maxChildProcesses 1000
-#define maxInputSize  100
-#define maxCommandLen 10
+#include "ndshell.h"
 
 // Globals for parent to store child processes
-int numChildProcesses = 0;
 int runCPID = 0;
-int childProcesses[maxChildProcesses];
+struct JobTable g_jobs;
 
-// create new child process and update globals
-void createChildProcess(char** command) {
-    int rc = fork();
-    if (rc < 0) {
-        fprintf(stderr, "Fork Failed\n");
-        exit(1);
+// Every process the last createChildProcess started, one per pipeline stage
+static pid_t startedPids[MAX_STAGES];
+static int nStartedPids = 0;
+
+// What the shell is blocked on (WAIT_NONE when it is reading commands)
+pid_t waiting = WAIT_NONE;
+
+// Set by exit, or by quit once it has killed every child
+#define QUIT_EXIT   1
+#define QUIT_ALL    2
+int bQuit = 0;
+
+// How jobs are started (the backend command switches it)
+int g_nSpawnBackend = SPAWN_POSIX;
+
+// put a process that has just started in the job table; returns its job, or
+// NULL after killing it if the table has no room
+struct Job* addJob(pid_t cpid, char** command, int nBatchJob, int64_t startNs, struct Limits* pLimits) {
+    runCPID = cpid;
+    if (nStartedPids < MAX_STAGES) {
+        startedPids[nStartedPids++] = cpid;
     }
-    else if (rc == 0) {
-        execvp(command[0], command);
-        printf("ndshell: %s: command not found. Process %d has been terminated.\n", command[0], getpid());
-        exit(1);
+    int nId = jobs_add(&g_jobs, cpid, command);
+    if (nId < 0) {
+        fprintf(stderr, "ndshell: Out of memory for process %d, killing it.\n", cpid);
+        kill(cpid, SIGKILL);
+        waitpid(cpid, NULL, 0);
+        return NULL;
     }
-    else {
-        int cpid = rc;
-        runCPID = cpid;
-        childProcesses[numChildProcesses] = cpid;
-        numChildProcesses++;
-        printf("Process %d started\n", cpid);
-        fflush(stdout);
+    struct Job* pJob = jobs_by_id(&g_jobs, nId);
+    pJob->startNs = startNs;
+    limits_started(pJob, pLimits);
+    if (nBatchJob >= 0) {
+        pJob->nBatchJob = nBatchJob;
+        batch_process_started(nBatchJob, cpid);
     }
+    return pJob;
 }
 
-// check if a process id is currently running in ndshell
-int isChildProccess(int cpid) {
-    int i;
-    for (i = 0; i < numChildProcesses; i++) {
-        if (cpid == childProcesses[i])
-            return 1;
+// create new child processes (one per stage of a pipeline) and update globals;
+// nBatchJob is the batch job they belong to, or -1. Returns 0 if they all
+// started, 1 if runcached replayed the result instead, or -1
+int createChildProcess(char** command, char* quoted, int nBatchJob) {
+    struct Pipeline pipeline;
+    struct Limits limits;
+    pid_t pids[MAX_STAGES];
+
+    nStartedPids = 0;
+    if (command[0] != NULL && !quoted[0] && strcmp(command[0], "runcached") == 0) {
+        return cache_run(command + 1, quoted + 1, nBatchJob);
     }
-    return 0;
-}
 
-// remove child process with given procces id
-void removeChildProcess(int cpid) {
-    int temp_array[numChildProcesses - 1];
+    // key=value limits at the front are for every stage
+    int nWords = limits_parse(command, &limits);
+    if (nWords < 0) {
+        return -1;
+    }
+    command += nWords;
+    quoted += nWords;
+    if (pipeline_parse(command, quoted, &pipeline) != 0) {
+        return -1;
+    }
+    int bLimited = limits_prepare(&limits);
+    // whatever the shell has printed goes out before anything the job prints
+    fflush(stdout);
+    int64_t startNs = now_ns();
+    int nStarted = pipeline_start(&pipeline, g_nSpawnBackend, events_child_sigmask(), bLimited ? &limits : NULL, pids);
+    if (nStarted == 0) {
+        limits_abandon(&limits);
+    }
 
-    int i, counter = 0;
-    for (i = 0; i < numChildProcesses; i++) {
-        if (cpid != childProcesses[i]) {
-            temp_array[counter] = childProcesses[i];
-            counter++;
+    int i;
+    for (i = 0; i < nStarted; i++) {
+        int cpid = pids[i];
+        if (addJob(cpid, pipeline.stages[i], nBatchJob, startNs, &limits) == NULL) {
+            return -1;
         }
+        printf("Process %d started\n", cpid);
     }
+    fflush(stdout);
+    return nStarted == pipeline.nStages ? 0 : -1;
+}
 
-    for (i = 0; i < numChildProcesses - 1; i++) {
-        childProcesses[i] = temp_array[i];
+// give every process the last createChildProcess started a bound time limit,
+// so no stage of a pipeline outlives it
+void boundStarted(int64_t limitNs, int64_t graceNs) {
+    int i;
+    for (i = 0; i < nStartedPids; i++) {
+        timers_add(startedPids[i], limitNs, graceNs);
     }
-    childProcesses[numChildProcesses] = 0;
-
-    numChildProcesses--;
 }
 
-void nd_wait(int pid) {
-    int wstatus;
-    int cpid = waitpid(pid, &wstatus, 0);
-    if (WTERMSIG(wstatus)) {
-        printf("Process %d exited abnormally with signal %d\n", cpid, WTERMSIG(wstatus));
+// a number of seconds, which may have a fraction, into nanoseconds; nan, inf
+// and anything too long to count in nanoseconds are not valid. Returns 0 or -1
+static int parseSeconds(char* szArg, int64_t* pNs) {
+    char* pEnd;
+    if (szArg == NULL) {
+        return -1;
     }
-    else {
-        printf("Process %d exited normally with status %d\n", cpid, WEXITSTATUS(wstatus));
+    double sec = strtod(szArg, &pEnd);
+    // written so that nan fails it too
+    if (pEnd == szArg || *pEnd != '\0' || !(sec > 0 && sec < INT64_MAX / NSEC_PER_SEC)) {
+        return -1;
     }
-    fflush(stdout);
-
-    removeChildProcess(cpid);
+    *pNs = (int64_t) (sec * NSEC_PER_SEC);
+    return 0;
 }
 
-void signalCapture(int signum) {
-    if (numChildProcesses == 0) {
-            return;
+// pass Control-C on to the process the shell is waiting for and, when it is the
+// last stage of the pipeline just started, to every other stage still running
+void interruptWaiting(pid_t pid) {
+    int i, bPipeline = 0;
+    for (i = 0; i < nStartedPids; i++) {
+        bPipeline |= startedPids[i] == pid;
     }
-    int cpid = childProcesses[numChildProcesses - 1];
-    if (signum == SIGINT) {
-        if (!isChildProccess(getpid())) {
-            nd_wait(cpid);
+    for (i = 0; bPipeline && i < nStartedPids; i++) {
+        if (startedPids[i] != pid && jobs_find(&g_jobs, startedPids[i]) != NULL) {
+            kill(startedPids[i], SIGINT);
         }
     }
+    kill(pid, SIGINT);
 }
 
-int main(int argc, char* argv[]) {
+// read the "[-term GRACE] SEC" that starts a bound command; returns how many
+// words it took, or -1 if they are not valid
+int parseBound(char** args, int64_t* pLimitNs, int64_t* pGraceNs) {
+    int nWords = 0;
+    *pGraceNs = 0;
+    if (args[0] != NULL && strcmp(args[0], "-term") == 0) {
+        if (parseSeconds(args[1], pGraceNs) != 0) {
+            return -1;
+        }
+        nWords = 2;
+    }
+    if (parseSeconds(args[nWords], pLimitNs) != 0) {
+        return -1;
+    }
+    return nWords + 1;
+}
 
-    if (argc != 1) {
-        fprintf(stderr, "ndshell: Executable does not take any parameters!\n");
-        exit(1);
+// turn a pid, or %id for a job ID, into the pid of a running job (0 if there is none)
+int parseJob(char* szArg) {
+    struct Job* pJob;
+    if (szArg[0] == '%') {
+        pJob = jobs_by_id(&g_jobs, atoi(szArg + 1));
+    } else {
+        pJob = jobs_find(&g_jobs, atoi(szArg));
     }
+    return pJob != NULL ? pJob->pid : 0;
+}
 
-    struct sigaction sigSetValue;
-    sigSetValue.sa_handler = signalCapture;
-    sigaction(SIGINT, &sigSetValue, NULL);
-    sigaction(SIGKILL, &sigSetValue, NULL);
+// Splits command lines; its words are good until the next line
+static struct Tokenizer tok;
 
-    const int ppid = getpid();
+// run one command line
+void runCommand(char* input, size_t nLength) {
+    int counter = tokenizer_split(&tok, input, nLength);
+    char** command = tok.tokens;
+    char** executable = command + 1;
 
-    int flag = 1;
-    while (flag && ppid == getpid()) {
+    if (counter < 0) {
+        fprintf(stderr, "ndshell: Invalid command! %s.\n", tok.szError);
+        return;
+    }
 
-        // handling input from user
-        char input[maxInputSize];
+    // if newline is pressed
+    if (counter == 0) {
+        return;
+    }
 
-        fprintf(stdout, "ndshell>");
-        char* fgets_return = fgets(input, maxInputSize, stdin);
+    // exit command
+    if (strcmp(command[0], "exit") == 0) {
+        bQuit = QUIT_EXIT;
+    }
 
-        if (fgets_return == NULL) {
-            break;
+    // start command
+    else if (strcmp(command[0], "start") == 0) {
+        if (counter <= 1) {
+            fprintf(stderr, "ndshell: Invalid start command! Please enter a process to run.\n");
+            return;
         }
 
-        input[strlen(input) - 1] = '\0';
-        char* split = strtok(input, " ");
-        char* command[maxCommandLen];
-        char* executable[maxCommandLen - 1];
+        createChildProcess(executable, tok.quoted + 1, -1);
+    }
+
+    // wait command
+    else if (strcmp(command[0], "wait") == 0) {
+        // wait for any child process to exit
+        if (g_jobs.nCount == 0) {
+            printf("ndshell: There are currently no processes running.\n");
+        }
+        else {
+            waiting = WAIT_NEXT;
+        }
+    }
+
+    // backend command
+    else if (strcmp(command[0], "backend") == 0) {
+        if (counter == 1) {
+            printf("ndshell: Jobs are started with %s.\n", g_nSpawnBackend == SPAWN_FORK ? "fork" : "posix_spawn");
+        }
+        else if (strcmp(command[1], "spawn") == 0) {
+            g_nSpawnBackend = SPAWN_POSIX;
+        }
+        else if (strcmp(command[1], "fork") == 0) {
+            g_nSpawnBackend = SPAWN_FORK;
+        }
+        else {
+            fprintf(stderr, "ndshell: Invalid backend command! Please enter spawn or fork.\n");
+        }
+    }
 
-        int counter = 0;
-        while (split != NULL && counter < maxCommandLen) {
-            if (counter > 0) {
-                executable[counter - 1] = split;
+    // jobs command
+    else if (strcmp(command[0], "jobs") == 0) {
+        int i;
+        for (i = 0; i < g_jobs.nCapacity; i++) {
+            if (g_jobs.jobs[i].pid > 0) {
+                printf("[%d] %d %s\n", i + 1, g_jobs.jobs[i].pid, g_jobs.jobs[i].szCommand);
             }
-            command[counter] = split;
-            split = strtok(NULL, " ");
-            counter++;
         }
-        command[counter] = NULL;
-        executable[counter - 1] = NULL;
+        fflush(stdout);
+    }
 
+    // limit command
+    else if (strcmp(command[0], "limit") == 0) {
+        limits_command(command + 1);
+    }
 
-        // if newline is pressed
-        if (counter == 0) {
-            continue;
+    // stats command
+    else if (strcmp(command[0], "stats") == 0) {
+        stats_command(command + 1);
+    }
+
+    // waitfor command
+    else if (strcmp(command[0], "waitfor") == 0) {
+        if (counter <= 1) {
+            fprintf(stderr, "ndshell: Invalid waitfor command! Invalid pid specified.\n");
+            return;
         }
+        int cpid = parseJob(command[1]);
 
-        // exit command
-        if (strcmp(command[0], "exit") == 0) {
-            flag = 0;
+        if (g_jobs.nCount == 0) {
+            printf("ndshell: There are currently no processes running.\n");
+        }
+        else if (atoi(command[1] + (command[1][0] == '%')) == 0) {
+            printf("ndshell: Enter a valid pid.\n");
         }
+        else if (cpid == 0) {
+            fprintf(stderr, "ndshell: Process %s does not exist!\n", command[1]);
+        }
+        else {
+            waiting = cpid;
+        }
+    }
 
-        // start command
-        else if (strcmp(command[0], "start") == 0) {
-            if (counter <= 1) {
-                fprintf(stderr, "ndshell: Invalid start command! Please enter a process to run.\n");
-                continue;
-            }
+    // run command
+    else if (strcmp(command[0], "run") == 0) {
+        if (counter <= 1) {
+            fprintf(stderr, "ndshell: Invalid start command! Please enter a process to run.\n");
+            return;
+        }
+        if (createChildProcess(executable, tok.quoted + 1, -1) == 0) {
+            waiting = runCPID;
+        }
+    }
 
-            createChildProcess(executable);
+    // runcached command: run, but replay the result if it is already known
+    else if (strcmp(command[0], "runcached") == 0) {
+        if (counter <= 1) {
+            fprintf(stderr, "ndshell: Invalid runcached command! Please enter a process to run.\n");
+            return;
         }
+        if (createChildProcess(command, tok.quoted, -1) == 0) {
+            waiting = runCPID;
+        }
+    }
 
-        // wait command
-        else if (strcmp(command[0], "wait") == 0) {
-            // wait for any child process to exit
-            if (numChildProcesses == 0) {
-                printf("ndshell: There are currently no processes running.\n");
-            }
-            else {
-                nd_wait(-1);
-            }
+    // cachestats command
+    else if (strcmp(command[0], "cachestats") == 0) {
+        cache_stats();
+    }
+
+    // kill command
+    else if (strcmp(command[0], "kill") == 0) {
+        if (counter <= 1) {
+            fprintf(stderr, "ndshell: Invalid kill command! Please enter a process id to kill.\n");
+            return;
         }
+        int cpid = parseJob(command[1]);
 
-        // waitfor command
-        else if (strcmp(command[0], "waitfor") == 0) {
-            if (counter <= 1) {
-                fprintf(stderr, "ndshell: Invalid waitfor command! Invalid pid specified.\n");
-                continue;
-            }
-            int cpid = atoi(command[1]);
-            
-            if (numChildProcesses == 0) {
-                printf("ndshell: There are currently no processes running.\n");
-            }
-            else if (cpid == 0) {
-                printf("ndshell: Enter a valid pid.\n");
-            }
-            else if (!isChildProccess(cpid)) {
-                fprintf(stderr, "ndshell: Process %d does not exist!\n", cpid);
-            }
-            else {
-                nd_wait(cpid);
-            }
+        if (g_jobs.nCount == 0) {
+            printf("ndshell: There are currently no processes running.\n");
+        }
+        else if (cpid == 0) {
+            fprintf(stderr, "ndshell: Process %s does not exist!\n", command[1]);
+        }
+        else {
+            kill(cpid, SIGKILL);
+            waiting = cpid;
         }
 
-        // run command
-        else if (strcmp(command[0], "run") == 0) {
-            if (counter <= 1) {
-                fprintf(stderr, "ndshell: Invalid start command! Please enter a process to run.\n");
-                continue;
-            }
-            createChildProcess(executable);
-            nd_wait(runCPID);
+    }
 
+    // quit command
+    else if (strcmp(command[0], "quit") == 0) {
+        int i;
+        for (i = 0; i < g_jobs.nCapacity; i++) {
+            if (g_jobs.jobs[i].pid > 0) {
+                kill(g_jobs.jobs[i].pid, SIGKILL);
+            }
+        }
+        // the reaper reports each one; the shell exits once they are all gone
+        bQuit = QUIT_ALL;
+        if (g_jobs.nCount > 0) {
+            waiting = WAIT_ALL;
         }
+    }
 
-        // kill command
-        else if (strcmp(command[0], "kill") == 0) {
-            if (counter <= 1) {
-                fprintf(stderr, "ndshell: Invalid kill command! Please enter a process id to kill.\n");
-                continue;
-            }
-            int cpid = atoi(command[1]);
-            
-            if (numChildProcesses == 0) {
-                printf("ndshell: There are currently no processes running.\n");
-            }
-            else if (!isChildProccess(cpid)) {
-                fprintf(stderr, "ndshell: Process %d does not exist!\n", cpid);
-            }
-            else {
-                kill(cpid, SIGKILL);
-                nd_wait(cpid);
-            }
+    // bound command
+    else if (strcmp(command[0], "bound") == 0) {
+        if (counter <= 2) {
+            fprintf(stderr, "ndshell: Invalid bound command! Please enter number of seconds and a command.\n");
+            return;
+        }
+        // check params
+        int64_t limitNs, graceNs;
+        int nWords = parseBound(command + 1, &limitNs, &graceNs);
+        if (nWords < 0) {
+            fprintf(stderr, "ndshell: Invalid bound command! Please enter a valid number of seconds for the command to run.\n");
+            return;
+        }
+        if (command[1 + nWords] == NULL) {
+            fprintf(stderr, "ndshell: Invalid bound command! Please enter number of seconds and a command.\n");
+            return;
+        }
 
+        // run and wait for given process; stages that started before a later one
+        // failed are still bounded, so none of them outlives the limit
+        int nResult = createChildProcess(command + 1 + nWords, tok.quoted + 1 + nWords, -1);
+        boundStarted(limitNs, graceNs);
+        if (nResult != 0) {
+            return;
         }
+        waiting = runCPID;
 
-        // quit command
-        else if (strcmp(command[0], "quit") == 0) {
-            int copyCPID[numChildProcesses];
-            int copyNUM = numChildProcesses;
-            int i;
-            for (i = 0; i < numChildProcesses; i++) {
-                copyCPID[i] = childProcesses[i];
-            }
+    }
 
-            for (i = 0; i < copyNUM; i++) {
-                kill(copyCPID[i], SIGKILL);
-                nd_wait(copyCPID[i]);
-            }
+    // batch command
+    else if (strcmp(command[0], "batch") == 0) {
+        if (counter != 3 || atoi(command[1]) <= 0) {
+            fprintf(stderr, "ndshell: Invalid batch command! Please enter how many jobs to run at once and a job file.\n");
+            return;
+        }
+        if (batch_begin(atoi(command[1]), command[2]) == 0) {
+            waiting = WAIT_BATCH;
+        }
+    }
+    else {
+        printf("ndshell: Unknown command %s\n", command[0]);
+    }
+}
 
-            printf("\nndshell: All child processes complete - exiting the shell.\n");
-            break;
+int main(int argc, char* argv[]) {
 
-        }
+    if (argc != 1) {
+        fprintf(stderr, "ndshell: Executable does not take any parameters!\n");
+        exit(1);
+    }
 
-        // bound command
-        else if (strcmp(command[0], "bound") == 0) {
-            if (counter <= 2) {
-                fprintf(stderr, "ndshell: Invalid bound command! Please enter number of seconds and a command.\n");
-                continue;
-            }
-            // check params
-            int sec = atoi(command[1]);
-            if (sec == 0) {
-                fprintf(stderr, "ndshell: Invalid bound command! Please enter a valid number of seconds for the command to run.\n");
-                continue;
+    jobs_init(&g_jobs);
+    if (events_init() != 0 || timers_init() != 0) {
+        perror("ndshell: unable to set up signal handling");
+        exit(1);
+    }
+
+    static struct InputBuffer input;
+    input.fd = STDIN_FILENO;
+    tokenizer_init(&tok);
+    char* line;
+    size_t nLength;
+    int bPrompt = 1;
+
+    while (1) {
+        if (waiting == WAIT_NONE) {
+            if (bQuit) {
+                break;
             }
-            char* bound_executable[maxCommandLen - 2];
-            int i;
-            for (i = 2; i <= counter; i++) {
-                bound_executable[i-2] = command[i];
+            if (bPrompt) {
+                fprintf(stdout, "ndshell>");
+                bPrompt = 0;
             }
 
-            // run and wait for given process
-            createChildProcess(bound_executable);
-            int cpid = runCPID;
-
-            int rc = fork();
-            if (rc < 0) {
-                fprintf(stderr, "Fork Failed\n");
-                exit(1);
-            }
-            else if (rc == 0) {
-                sleep(sec);
-                kill(cpid, SIGKILL);
+            // lines already read come before anything new
+            if (input_next_line(&input, &line, &nLength)) {
+                runCommand(line, nLength);
+                bPrompt = 1;
+                continue;
             }
-            else {
-                nd_wait(runCPID);
-                wait(NULL); // wait for timer to return
+            if (input.bEOF) {
+                break;
             }
-
         }
-        else {
-            printf("ndshell: Unknown command %s\n", command[0]);
+
+        // sleep until a child exits or, when reading commands, until a line comes in;
+        // a script piped in only flushes the prompts it has piled up when it runs dry
+        fflush(stdout);
+        if (events_wait(&input, waiting == WAIT_NONE) != 0) {
+            perror("ndshell: poll");
+            exit(1);
         }
+        events_handle_signals(&waiting);
+    }
 
+    limits_cleanup();
+    cache_cleanup();
+    if (bQuit == QUIT_ALL) {
+        printf("\nndshell: All child processes complete - exiting the shell.\n");
     }
     return 0;
-}
\ No newline at end of file
+}
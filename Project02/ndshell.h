@@ -0,0 +1,196 @@
+/* ndshell.h : Shared definitions for ndshell */
+
+#ifndef NDSHELL_H
+#define NDSHELL_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "tokenizer.h"
+
+#define NSEC_PER_SEC        1000000000LL
+
+/* Commands in one pipeline, and how much the in-shell tee moves at a time */
+#define MAX_STAGES          16
+#define RELAY_CHUNK         (1 << 20)
+
+/* Bytes of stdin read at a time to start with; the buffer grows to fit the longest line */
+#define INPUT_BUFFER_INITIAL    65536
+
+/* What the shell is blocked on instead of reading commands. Any value above
+   zero is the pid that run, waitfor, kill or bound is waiting for. */
+#define WAIT_NONE   0
+#define WAIT_NEXT   -1      /* wait: the next child to exit */
+#define WAIT_ALL    -2      /* quit: every child */
+#define WAIT_BATCH  -3      /* batch: every job in the job file */
+
+/* Process creation backends */
+#define SPAWN_POSIX 0       /* posix_spawnp: vfork-style, no page-table copy */
+#define SPAWN_FORK  1       /* fork + execvp */
+
+/* Job slots allocated up front, and how much of a job's command line the jobs command shows */
+#define JOB_TABLE_INITIAL   64
+#define JOB_COMMAND_LEN     64
+
+/* CPUs a limit can name, and which limits a struct Limits sets */
+#define LIMITS_MAX_CPUS     1024
+#define LIMIT_CPUS          0x01
+#define LIMIT_CPU           0x02
+#define LIMIT_MEM           0x04
+#define LIMIT_NICE          0x08
+#define LIMIT_IO            0x10
+#define LIMIT_SPREAD        0x20
+
+/* Hex digits naming a runcached entry */
+#define CACHE_HASH_LEN      32
+
+struct Job {
+    pid_t   pid;                /* 0 when the slot is free */
+    int     nNext;              /* next job in the pid's hash bucket, or on the free list */
+    int     nBatchJob;          /* the batch job it is part of, or -1 */
+    int     nTimer;             /* its bound timer's place in the timer heap, or -1 */
+    int64_t startNs;            /* CLOCK_MONOTONIC, just before it was started */
+    int     nCpu;               /* the core spread mode pinned it to, or -1 */
+    int     nCgroup;            /* the job.N cgroup it is in, or 0 */
+    int     nCache;             /* the runcached result it is making, or -1 */
+    char    szCommand[JOB_COMMAND_LEN];
+};
+
+struct JobTable {
+    struct Job* jobs;           /* job ID - 1 is the index */
+    int         nCapacity;
+    int         nCount;
+    int         nFree;          /* first free slot, -1 when full */
+    int*        buckets;        /* first job in each bucket, -1 when empty */
+    int         nBucketBits;
+};
+
+/* Limits for jobs, the shell's own or one job's. "off" is 0 or unset. */
+struct Limits {
+    int         nSet;           /* LIMIT_ flags for the ones given */
+    int         bCpus;
+    uint64_t    cpus[LIMITS_MAX_CPUS / 64];
+    int         nCpuPercent;    /* of one core */
+    int64_t     memBytes;
+    int         bNice;
+    int         nNice;
+    int         nIoClass;       /* 1 rt, 2 best effort, 3 idle */
+    int         nIoLevel;
+    int         bSpread;
+    int         nCpu;           /* filled in by limits_prepare: the core spread picked, or -1 */
+    int         nCgroup;        /* and the job's cgroup, or 0 */
+};
+
+/* A bound job's time limit. nSlot is the job's slot in the job table, which
+   keeps its place as the table grows where a pointer would not. */
+struct BoundTimer {
+    int64_t deadlineNs;         /* CLOCK_MONOTONIC */
+    int     nSlot;
+    int     nSignal;            /* what to send when the deadline passes */
+    int64_t graceNs;            /* from SIGTERM to SIGKILL, 0 to go straight to SIGKILL */
+};
+
+struct TimerHeap {
+    struct BoundTimer*  timers; /* earliest deadline first */
+    int                 nCount;
+    int                 nCapacity;
+    int                 timerFd;
+};
+
+/* One command line split at its pipes. Each stage's argv ends at the NULL
+   that replaced the "|" or redirection after it. */
+struct Pipeline {
+    int     nStages;
+    char**  stages[MAX_STAGES];
+    char*   szInput;            /* < file for the first stage, or NULL */
+    char*   szOutput;           /* > or >> file for the last stage, or NULL */
+    int     bAppend;
+};
+
+/* stdin as it arrives, split into lines by the shell */
+struct InputBuffer {
+    int     fd;
+    char*   data;
+    size_t  nSize;
+    size_t  nStart;             /* first byte not handed out yet */
+    size_t  nLength;            /* end of what has been read */
+    int     bEOF;
+};
+
+// Globals for parent to store child processes
+extern int runCPID;
+extern struct JobTable g_jobs;
+extern int g_nSpawnBackend;
+
+/* Function prototypes */
+
+/* ndshell.c */
+int         createChildProcess(char** command, char* quoted, int nBatchJob);
+struct Job* addJob(pid_t cpid, char** command, int nBatchJob, int64_t startNs, struct Limits* pLimits);
+void        boundStarted(int64_t limitNs, int64_t graceNs);
+void        interruptWaiting(pid_t pid);
+int         parseBound(char** args, int64_t* pLimitNs, int64_t* pGraceNs);
+
+/* jobs.c - jobs by pid in O(1), IDs reused from a free list */
+void        jobs_init(struct JobTable* pTable);
+int         jobs_add(struct JobTable* pTable, pid_t pid, char** command);
+struct Job* jobs_find(struct JobTable* pTable, pid_t pid);
+struct Job* jobs_by_id(struct JobTable* pTable, int nId);
+int         jobs_id(struct JobTable* pTable, struct Job* pJob);
+int         jobs_remove(struct JobTable* pTable, pid_t pid);
+
+/* spawn.c - start a job with posix_spawnp or fork, reporting a failed exec to the shell */
+pid_t   spawn_process(char** argv, int nBackend, sigset_t* pMask, int fdIn, int fdOut, int fdErr, struct Limits* pLimits, int* pError);
+void    spawn_report_error(char* szCommand, int nError);
+
+/* pipeline.c - stages joined by pipe2(O_CLOEXEC), < and > files, an in-shell splice tee */
+int     pipeline_parse(char** tokens, char* quoted, struct Pipeline* pPipeline);
+int     pipeline_start(struct Pipeline* pPipeline, int nBackend, sigset_t* pMask, struct Limits* pLimits, pid_t* pids);
+
+/* timers.c - bound time limits on one timerfd, SIGTERM then SIGKILL */
+int     timers_init();
+int     timers_fd();
+int     timers_add(pid_t pid, int64_t limitNs, int64_t graceNs);
+void    timers_cancel(struct Job* pJob);
+void    timers_expire();
+
+/* stats.c - wait4 rusage and wall time of every job, with percentiles and CSV */
+void    stats_record(struct Job* pJob, int wstatus, struct rusage* pUsage);
+void    stats_command(char** args);
+
+/* limits.c - affinity, cgroup v2 cpu.max/memory.max (else rlimits), nice, IO priority, spread */
+int     limits_parse(char** args, struct Limits* pLimits);
+int     limits_prepare(struct Limits* pLimits);
+void    limits_enter(struct Limits* pLimits);
+void    limits_started(struct Job* pJob, struct Limits* pLimits);
+void    limits_release(struct Job* pJob);
+void    limits_abandon(struct Limits* pLimits);
+void    limits_cleanup();
+void    limits_command(char** args);
+int64_t parse_size(char* szSize);
+
+/* batch.c - run a job file N at a time */
+int     batch_begin(int nMax, char* szFile);
+int     batch_fill();
+void    batch_process_started(int nJob, pid_t pid);
+void    batch_process_done(int nJob, pid_t pid, int wstatus, struct rusage* pUsage);
+void    batch_job_replayed(int nJob, int wstatus);
+void    batch_interrupt();
+
+/* cache.c - runcached: results keyed on argv, environment and input mtimes, replayed from an LRU disk cache */
+int     cache_run(char** args, char* quoted, int nBatchJob);
+void    cache_process_done(struct Job* pJob, int wstatus);
+void    cache_stats();
+void    cache_cleanup();
+
+/* events.c - SIGCHLD and SIGINT through a signalfd, polled with stdin */
+int64_t     now_ns();
+int         events_init();
+sigset_t*   events_child_sigmask();
+int     events_wait(struct InputBuffer* pInput, int bReadInput);
+void    events_handle_signals(pid_t* pWaiting);
+int     input_next_line(struct InputBuffer* pInput, char** pLine, size_t* pLength);
+
+#endif
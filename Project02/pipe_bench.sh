@@ -0,0 +1,40 @@
+#!/bin/bash
+# pipe_bench.sh - Throughput of ndshell pipelines
+#
+# Usage: ./pipe_bench.sh [MiB to push through] [scratch directory]
+#
+# Pushes the given amount of data (4 GiB by default) from head through
+# multi-stage pipelines started by ndshell's run command. The plain pipeline
+# of cats shows what the pipes themselves cost. The two tee pipelines make
+# the same copy to a file, once with the in-shell tee (splice and tee(2), no
+# user-space copy) and once with /usr/bin/tee (read and write).
+
+MB=${1:-4096}
+DIR=${2:-.}
+COPY="$DIR/pipe-bench-copy.bin"
+
+if [ ! -x ./ndshell ]; then
+    echo "pipe_bench.sh: build ndshell first (make)" >&2
+    exit 1
+fi
+
+# run one pipeline in ndshell and print its wall time and throughput
+measure() {
+    local label=$1
+    local line=$2
+    local start=$(date +%s.%N)
+    printf '%s\nexit\n' "$line" | ./ndshell > /dev/null
+    local end=$(date +%s.%N)
+    awk -v l="$label" -v mb="$MB" -v s="$start" -v e="$end" \
+        'BEGIN { t = e - s; printf "%-28s %8d MiB %8.3f s %10.1f MiB/s\n", l, mb, t, mb / t }'
+}
+
+SOURCE="head -c ${MB}M /dev/zero"
+measure "head > /dev/null" "run $SOURCE > /dev/null"
+measure "head | cat | cat" "run $SOURCE | cat | cat > /dev/null"
+measure "head | tee (in-shell) | cat" "run $SOURCE | tee $COPY | cat > /dev/null"
+measure "head | /usr/bin/tee | cat" "run $SOURCE | /usr/bin/tee $COPY | cat > /dev/null"
+measure "head | tee (in-shell)" "run $SOURCE | tee > /dev/null"
+measure "head | cat" "run $SOURCE | cat > /dev/null"
+
+rm -f "$COPY"
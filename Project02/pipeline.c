@@ -0,0 +1,307 @@
+/*
+pipeline.c - Pipelines and redirection for ndshell
+
+A command line such as "cat < in | sort | uniq > out" is split at each "|"
+into stages. Stage i's stdout is connected to stage i+1's stdin through a
+pipe made with pipe2(O_CLOEXEC), so the only copies of each end that outlive
+an exec are the ones moved onto fd 0 and 1. "< file" may end the first stage
+and "> file" or ">> file" the last. The shell opens the files itself, so a
+missing input file is reported as such and not as a missing command.
+
+A stage that is just "tee" or "tee FILE" is run by the shell itself, in a
+forked child that never execs. It moves data between the pipes with splice,
+and makes the copy for FILE with tee(2), so the bytes stay in kernel pipe
+buffers instead of going through user space. Where splice cannot be used
+(a terminal, say) it falls back to read and write.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ndshell.h"
+
+/* Split tokens into stages, taking out the operators and redirections. A
+   token with quoted[i] set is never an operator, so "|" can be an argument.
+   Returns 0, or -1 after saying what is wrong with the line. */
+int pipeline_parse(char** tokens, char* quoted, struct Pipeline* pPipeline) {
+    memset(pPipeline, 0, sizeof(struct Pipeline));
+    pPipeline->stages[0] = tokens;
+    pPipeline->nStages = 1;
+    int bRedirected = 0;
+    int i;
+
+    for (i = 0; tokens[i] != NULL; i++) {
+        char* szToken = tokens[i];
+        int bOperator = !quoted[i];
+        if (bOperator && strcmp(szToken, "|") == 0) {
+            tokens[i] = NULL;
+            if (pPipeline->stages[pPipeline->nStages - 1][0] == NULL || tokens[i + 1] == NULL) {
+                fprintf(stderr, "ndshell: Invalid pipeline! Every | needs a command on each side.\n");
+                return -1;
+            }
+            if (pPipeline->szOutput != NULL) {
+                fprintf(stderr, "ndshell: Invalid pipeline! Only the last command can have its output redirected.\n");
+                return -1;
+            }
+            if (pPipeline->nStages == MAX_STAGES) {
+                fprintf(stderr, "ndshell: Invalid pipeline! At most %d commands can be piped together.\n", MAX_STAGES);
+                return -1;
+            }
+            pPipeline->stages[pPipeline->nStages++] = &tokens[i + 1];
+            bRedirected = 0;
+        }
+        else if (bOperator && (strcmp(szToken, "<") == 0 || strcmp(szToken, ">") == 0 || strcmp(szToken, ">>") == 0)) {
+            tokens[i] = NULL;
+            if (tokens[i + 1] == NULL || (!quoted[i + 1] && strcmp(tokens[i + 1], "|") == 0)) {
+                fprintf(stderr, "ndshell: Invalid redirection! Please enter a file after %s.\n", szToken);
+                return -1;
+            }
+            if (szToken[0] == '<') {
+                if (pPipeline->nStages > 1 || pPipeline->szInput != NULL) {
+                    fprintf(stderr, "ndshell: Invalid redirection! Only the first command can read from a file.\n");
+                    return -1;
+                }
+                pPipeline->szInput = tokens[i + 1];
+            }
+            else {
+                if (pPipeline->szOutput != NULL) {
+                    fprintf(stderr, "ndshell: Invalid redirection! Output can only go to one file.\n");
+                    return -1;
+                }
+                pPipeline->szOutput = tokens[i + 1];
+                pPipeline->bAppend = szToken[1] == '>';
+            }
+            i++;
+            bRedirected = 1;
+        }
+        else if (bRedirected) {
+            // the NULL that ends the argv is already in place, so arguments cannot follow a redirection
+            fprintf(stderr, "ndshell: Invalid redirection! Put %s before the redirections.\n", szToken);
+            return -1;
+        }
+    }
+    if (pPipeline->stages[0][0] == NULL) {
+        fprintf(stderr, "ndshell: Invalid command! Please enter a process to run.\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* "tee" and "tee FILE" run in the shell; anything with options goes to the real tee */
+static int pipeline_is_relay(char** argv) {
+    return strcmp(argv[0], "tee") == 0
+        && (argv[1] == NULL || (argv[1][0] != '-' && argv[2] == NULL));
+}
+
+/* Move up to nMax bytes, with splice while *pbSplice holds. Returns what was moved, 0 at end of input or -1. */
+static ssize_t relay_some(int fdFrom, int fdTo, size_t nMax, int* pbSplice) {
+    if (*pbSplice) {
+        ssize_t nMoved = splice(fdFrom, NULL, fdTo, NULL, nMax, SPLICE_F_MOVE);
+        if (nMoved >= 0 || errno != EINVAL) {
+            return nMoved;
+        }
+        // this pair of descriptors cannot be spliced, copy from now on
+        *pbSplice = 0;
+    }
+    static char buffer[RELAY_CHUNK];
+    ssize_t nRead = read(fdFrom, buffer, nMax < sizeof(buffer) ? nMax : sizeof(buffer));
+    ssize_t nDone = 0;
+    while (nDone < nRead) {
+        ssize_t nWritten = write(fdTo, buffer + nDone, nRead - nDone);
+        if (nWritten < 0) {
+            return -1;
+        }
+        nDone += nWritten;
+    }
+    return nRead;
+}
+
+/* Move exactly nBytes, which are known to be waiting in fdFrom */
+static int relay_all(int fdFrom, int fdTo, size_t nBytes, int* pbSplice) {
+    while (nBytes > 0) {
+        ssize_t nMoved = relay_some(fdFrom, fdTo, nBytes, pbSplice);
+        if (nMoved <= 0) {
+            return -1;
+        }
+        nBytes -= nMoved;
+    }
+    return 0;
+}
+
+static int relay_is_pipe(int fd) {
+    struct stat info;
+    return fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+/* The in-shell tee: stdin to stdout, and to fdCopy as well unless it is -1.
+   splice and tee need a pipe on one side, so a stdin that is not a pipe is
+   first spliced into one of our own, and the copy is teed into a second. */
+static int relay_run(int fdCopy) {
+    int fdIn = STDIN_FILENO;
+    int inPipe[2] = {-1, -1};
+    int copyPipe[2] = {-1, -1};
+    int bSpliceIn = 1, bSpliceOut = 1, bSpliceCopy = 1;
+
+    if (!relay_is_pipe(STDIN_FILENO)) {
+        if (pipe(inPipe) != 0) {
+            return 1;
+        }
+        fcntl(inPipe[0], F_SETPIPE_SZ, RELAY_CHUNK);
+        fdIn = inPipe[0];
+    }
+    if (fdCopy >= 0) {
+        if (pipe(copyPipe) != 0) {
+            return 1;
+        }
+        fcntl(copyPipe[0], F_SETPIPE_SZ, RELAY_CHUNK);
+    }
+    fcntl(STDIN_FILENO, F_SETPIPE_SZ, RELAY_CHUNK);
+    fcntl(STDOUT_FILENO, F_SETPIPE_SZ, RELAY_CHUNK);
+
+    while (1) {
+        ssize_t nBytes = RELAY_CHUNK;
+        if (inPipe[1] >= 0) {
+            nBytes = relay_some(STDIN_FILENO, inPipe[1], RELAY_CHUNK, &bSpliceIn);
+            if (nBytes <= 0) {
+                break;
+            }
+        }
+
+        if (fdCopy >= 0) {
+            // duplicate what is waiting without consuming it, then move both copies on
+            nBytes = tee(fdIn, copyPipe[1], nBytes, 0);
+            if (nBytes <= 0) {
+                break;
+            }
+            if (relay_all(fdIn, STDOUT_FILENO, nBytes, &bSpliceOut) != 0
+                || relay_all(copyPipe[0], fdCopy, nBytes, &bSpliceCopy) != 0) {
+                return 1;
+            }
+        }
+        else if (inPipe[1] >= 0) {
+            if (relay_all(fdIn, STDOUT_FILENO, nBytes, &bSpliceOut) != 0) {
+                return 1;
+            }
+        }
+        else if (relay_some(fdIn, STDOUT_FILENO, RELAY_CHUNK, &bSpliceOut) <= 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Fork the in-shell tee for one stage. fdPending is the read end of the
+   next pipe, which the relay must not keep open or its reader would never
+   see it go away. */
+static pid_t relay_start(char** argv, sigset_t* pMask, int fdIn, int fdOut, int fdPending, struct Limits* pLimits, int* pError) {
+    int fdCopy = -1;
+    if (argv[1] != NULL) {
+        fdCopy = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fdCopy < 0) {
+            *pError = errno;
+            return -1;
+        }
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        *pError = errno;
+    }
+    else if (pid == 0) {
+        sigprocmask(SIG_SETMASK, pMask, NULL);
+        if (fdIn >= 0) {
+            dup2(fdIn, STDIN_FILENO);
+        }
+        if (fdOut >= 0) {
+            dup2(fdOut, STDOUT_FILENO);
+        }
+        if (fdPending >= 0) {
+            close(fdPending);
+        }
+        if (pLimits != NULL) {
+            limits_enter(pLimits);
+        }
+        _exit(relay_run(fdCopy));
+    }
+    if (fdCopy >= 0) {
+        close(fdCopy);
+    }
+    return pid;
+}
+
+/* Start every stage, connected by pipes, each with pLimits if it is not
+   NULL. pids[i] is filled in for each stage that started. Returns how many
+   did; after a failure the stages already running are left to see end of
+   file and finish. */
+int pipeline_start(struct Pipeline* pPipeline, int nBackend, sigset_t* pMask, struct Limits* pLimits, pid_t* pids) {
+    int fdIn = -1, fdOut = -1, fdNext = -1;
+    int nError = 0;
+    int i;
+
+    if (pPipeline->szInput != NULL) {
+        fdIn = open(pPipeline->szInput, O_RDONLY | O_CLOEXEC);
+        if (fdIn < 0) {
+            fprintf(stderr, "ndshell: %s: %s\n", pPipeline->szInput, strerror(errno));
+            return 0;
+        }
+    }
+
+    for (i = 0; i < pPipeline->nStages; i++) {
+        char** argv = pPipeline->stages[i];
+
+        // where this stage writes: the next pipe, the output file, or the shell's stdout
+        fdNext = -1;
+        if (i + 1 < pPipeline->nStages) {
+            int fds[2];
+            if (pipe2(fds, O_CLOEXEC) != 0) {
+                perror("ndshell: pipe");
+                break;
+            }
+            fdNext = fds[0];
+            fdOut = fds[1];
+        }
+        else if (pPipeline->szOutput != NULL) {
+            int nFlags = O_WRONLY | O_CREAT | O_CLOEXEC | (pPipeline->bAppend ? O_APPEND : O_TRUNC);
+            fdOut = open(pPipeline->szOutput, nFlags, 0644);
+            if (fdOut < 0) {
+                fprintf(stderr, "ndshell: %s: %s\n", pPipeline->szOutput, strerror(errno));
+                break;
+            }
+        }
+        else {
+            fdOut = -1;
+        }
+
+        if (pipeline_is_relay(argv)) {
+            pids[i] = relay_start(argv, pMask, fdIn, fdOut, fdNext, pLimits, &nError);
+        }
+        else {
+            pids[i] = spawn_process(argv, nBackend, pMask, fdIn, fdOut, -1, pLimits, &nError);
+        }
+
+        // the stages have their own copies now
+        if (fdIn >= 0) {
+            close(fdIn);
+        }
+        if (fdOut >= 0) {
+            close(fdOut);
+        }
+        fdIn = fdNext;
+        fdNext = -1;
+
+        if (pids[i] < 0) {
+            spawn_report_error(argv[0], nError);
+            break;
+        }
+    }
+    if (fdIn >= 0) {
+        close(fdIn);
+    }
+    return i;
+}
@@ -0,0 +1,133 @@
+/*
+spawn.c - Process creation backends for ndshell
+
+The default backend is posix_spawnp. glibc builds it on
+clone(CLONE_VM | CLONE_VFORK), so the child borrows the shell's address space
+until it execs instead of copying its page tables the way fork does. It also
+reports a failed exec (a missing executable, say) as its return value, so the
+shell can say so itself and no job is created.
+
+The fork backend does what ndshell always did, fork then execvp. To report a
+failed exec the same way, the child writes its errno down a close-on-exec
+pipe: a successful exec closes the pipe with nothing written.
+
+Either way the child is given the signal mask the shell had before it
+blocked SIGCHLD and SIGINT for its signalfd. A job with limits (limits.c)
+is always forked, since only a forked child can run code before its exec.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ndshell.h"
+
+extern char** environ;
+
+static pid_t spawn_posix(char** argv, sigset_t* pMask, int fdIn, int fdOut, int fdErr, int* pError) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    pid_t pid;
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, pMask);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    posix_spawn_file_actions_init(&actions);
+    if (fdIn >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, fdIn, STDIN_FILENO);
+    }
+    if (fdOut >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, fdOut, STDOUT_FILENO);
+    }
+    if (fdErr >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, fdErr, STDERR_FILENO);
+    }
+    *pError = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return *pError == 0 ? pid : -1;
+}
+
+static pid_t spawn_fork(char** argv, sigset_t* pMask, int fdIn, int fdOut, int fdErr, struct Limits* pLimits, int* pError) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        *pError = errno;
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        *pError = errno;
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        sigprocmask(SIG_SETMASK, pMask, NULL);
+        if (fdIn >= 0) {
+            dup2(fdIn, STDIN_FILENO);
+        }
+        if (fdOut >= 0) {
+            dup2(fdOut, STDOUT_FILENO);
+        }
+        if (fdErr >= 0) {
+            dup2(fdErr, STDERR_FILENO);
+        }
+        if (pLimits != NULL) {
+            limits_enter(pLimits);
+        }
+        execvp(argv[0], argv);
+        int nError = errno;
+        if (write(fds[1], &nError, sizeof(nError)) < 0) {
+            // nothing more the child can do
+        }
+        _exit(127);
+    }
+
+    // the write end has to go here too, or the read below never sees the exec close it
+    close(fds[1]);
+    int nError;
+    ssize_t nRead;
+    do {
+        nRead = read(fds[0], &nError, sizeof(nError));
+    } while (nRead < 0 && errno == EINTR);
+    close(fds[0]);
+
+    if (nRead == sizeof(nError)) {
+        // the exec failed; the child is already on its way out, collect it before the reaper does
+        waitpid(pid, NULL, 0);
+        *pError = nError;
+        return -1;
+    }
+    *pError = 0;
+    return pid;
+}
+
+/* Start argv[0] (searched for in PATH) with the given backend and signal
+   mask, with fdIn, fdOut and fdErr as its stdin, stdout and stderr (-1 to
+   share the shell's).
+   Any other descriptor the shell wants closed in the child must be O_CLOEXEC.
+   A job with limits (pLimits not NULL) always forks, so the child can set
+   them up before it execs. Returns its pid, or -1 with *pError set to why it
+   could not be started. */
+pid_t spawn_process(char** argv, int nBackend, sigset_t* pMask, int fdIn, int fdOut, int fdErr, struct Limits* pLimits, int* pError) {
+    if (nBackend == SPAWN_FORK || pLimits != NULL) {
+        return spawn_fork(argv, pMask, fdIn, fdOut, fdErr, pLimits, pError);
+    }
+    return spawn_posix(argv, pMask, fdIn, fdOut, fdErr, pError);
+}
+
+/* How the shell reports a command it could not start */
+void spawn_report_error(char* szCommand, int nError) {
+    if (nError == ENOENT) {
+        fprintf(stderr, "ndshell: %s: command not found.\n", szCommand);
+    } else {
+        fprintf(stderr, "ndshell: %s: %s\n", szCommand, strerror(nError));
+    }
+}
@@ -0,0 +1,84 @@
+/*
+spawn_bench.c - Launch rate of ndshell's process creation backends
+
+Starts /bin/true over and over with each backend in spawn.c and reports
+spawns per second. fork has to copy the parent's page tables, so its cost
+grows with the parent's resident memory while posix_spawnp's does not; give
+a size in MiB to make this program that large first and see the gap.
+
+Usage: ./spawn_bench [spawns] [MiB of resident memory]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ndshell.h"
+
+#define DEFAULT_SPAWNS  5000
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double run(int nSpawns, int nBackend, sigset_t* pMask) {
+    char* argv[] = {"true", NULL};
+    int nError;
+    int i;
+
+    double start = now_s();
+    for (i = 0; i < nSpawns; i++) {
+        pid_t pid = spawn_process(argv, nBackend, pMask, -1, -1, -1, NULL, &nError);
+        if (pid < 0) {
+            spawn_report_error(argv[0], nError);
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return now_s() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int nSpawns = DEFAULT_SPAWNS;
+    size_t nMiB = 0;
+
+    if (argc > 1) {
+        nSpawns = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        nMiB = atol(argv[2]);
+    }
+    if (nSpawns <= 0) {
+        fprintf(stderr, "Usage: %s [spawns] [MiB of resident memory]\n", argv[0]);
+        return 1;
+    }
+
+    // touch every page so it is really mapped and fork has page tables to copy
+    if (nMiB > 0) {
+        char* pBallast = (char*) malloc(nMiB << 20);
+        if (pBallast == NULL) {
+            fprintf(stderr, "spawn_bench: unable to allocate %zu MiB\n", nMiB);
+            return 1;
+        }
+        memset(pBallast, 1, nMiB << 20);
+    }
+
+    sigset_t mask;
+    sigprocmask(SIG_SETMASK, NULL, &mask);
+
+    // one unmeasured round of each to warm up the page cache and PATH lookup
+    run(10, SPAWN_POSIX, &mask);
+    run(10, SPAWN_FORK, &mask);
+
+    double posix = run(nSpawns, SPAWN_POSIX, &mask);
+    double forked = run(nSpawns, SPAWN_FORK, &mask);
+    printf("resident     %zu MiB\n", nMiB);
+    printf("posix_spawn  %8d spawns %8.3f s %10.0f spawns/s %8.1f us/spawn\n", nSpawns, posix, nSpawns / posix, posix * 1e6 / nSpawns);
+    printf("fork         %8d spawns %8.3f s %10.0f spawns/s %8.1f us/spawn\n", nSpawns, forked, nSpawns / forked, forked * 1e6 / nSpawns);
+    return 0;
+}
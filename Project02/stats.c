@@ -0,0 +1,231 @@
+/*
+stats.c - Resource accounting for ndshell jobs
+
+Every process the shell reaps comes back from wait4 with its rusage. Its
+wall time runs from just before it was started to the moment it was reaped,
+so it includes any time it sat as a zombie before the event loop got to it
+(normally well under a millisecond). One line of figures is printed under
+the exit status, and a record is kept for the rest of the session.
+
+"stats" prints the count, mean, p50, p95, p99 and maximum of each figure
+over every job so far, and a histogram of wall times in power-of-two
+buckets. Percentiles are exact: each column is copied and sorted when asked
+for, which is cheap next to starting the processes in the first place.
+"stats csv FILE" writes one row per job, "stats reset" forgets them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "ndshell.h"
+
+/* One reaped job */
+struct JobStats {
+    pid_t   pid;
+    int     wstatus;
+    int64_t wallNs;
+    double  user;               /* seconds */
+    double  sys;
+    long    maxRssKiB;
+    long    nVoluntary;         /* context switches: gave up the CPU, had it taken away */
+    long    nInvoluntary;
+    long    nMinorFaults;
+    long    nMajorFaults;
+    char    szCommand[JOB_COMMAND_LEN];
+};
+
+static struct {
+    struct JobStats*    jobs;
+    int                 nCount;
+    int                 nCapacity;
+} g_stats;
+
+/* Wall time buckets for the histogram: [2^i, 2^(i+1)) microseconds, the last open ended */
+#define STATS_BUCKETS   24
+#define STATS_BAR_WIDTH 40
+
+static double timeval_s(struct timeval* pTime) {
+    return pTime->tv_sec + pTime->tv_usec / 1e6;
+}
+
+/* Print what a reaped job used and keep it for stats */
+void stats_record(struct Job* pJob, int wstatus, struct rusage* pUsage) {
+    struct JobStats record;
+    record.pid = pJob->pid;
+    record.wstatus = wstatus;
+    record.wallNs = now_ns() - pJob->startNs;
+    record.user = timeval_s(&pUsage->ru_utime);
+    record.sys = timeval_s(&pUsage->ru_stime);
+    record.maxRssKiB = pUsage->ru_maxrss;
+    record.nVoluntary = pUsage->ru_nvcsw;
+    record.nInvoluntary = pUsage->ru_nivcsw;
+    record.nMinorFaults = pUsage->ru_minflt;
+    record.nMajorFaults = pUsage->ru_majflt;
+    memcpy(record.szCommand, pJob->szCommand, JOB_COMMAND_LEN);
+
+    printf("  %.3f s wall, %.3f s user, %.3f s sys, %ld KiB max RSS, %ld+%ld context switches, %ld+%ld page faults\n",
+           record.wallNs / 1e9, record.user, record.sys, record.maxRssKiB,
+           record.nVoluntary, record.nInvoluntary, record.nMinorFaults, record.nMajorFaults);
+
+    if (g_stats.nCount == g_stats.nCapacity) {
+        int nCapacity = g_stats.nCapacity ? g_stats.nCapacity * 2 : 256;
+        struct JobStats* jobs = (struct JobStats*) realloc(g_stats.jobs, nCapacity * sizeof(struct JobStats));
+        if (jobs == NULL) {
+            // the figures were printed; only the session totals miss out
+            return;
+        }
+        g_stats.jobs = jobs;
+        g_stats.nCapacity = nCapacity;
+    }
+    g_stats.jobs[g_stats.nCount++] = record;
+}
+
+static int stats_compare(const void* pA, const void* pB) {
+    double a = *(const double*) pA;
+    double b = *(const double*) pB;
+    return (a > b) - (a < b);
+}
+
+/* Nearest-rank percentile of sorted values */
+static double stats_percentile(double* values, int nCount, int nPercent) {
+    int nRank = (nPercent * nCount + 99) / 100;
+    return values[nRank > 0 ? nRank - 1 : 0];
+}
+
+/* Print one figure's row: which one is picked by nColumn */
+static void stats_row(char* szName, int nColumn, double* values) {
+    int i;
+    double total = 0;
+    for (i = 0; i < g_stats.nCount; i++) {
+        struct JobStats* pJob = &g_stats.jobs[i];
+        switch (nColumn) {
+            case 0: values[i] = pJob->wallNs / 1e9; break;
+            case 1: values[i] = pJob->user; break;
+            case 2: values[i] = pJob->sys; break;
+            case 3: values[i] = pJob->maxRssKiB; break;
+            case 4: values[i] = pJob->nVoluntary; break;
+            case 5: values[i] = pJob->nInvoluntary; break;
+            case 6: values[i] = pJob->nMinorFaults; break;
+            default: values[i] = pJob->nMajorFaults; break;
+        }
+        total += values[i];
+    }
+    qsort(values, g_stats.nCount, sizeof(double), stats_compare);
+    printf("%-22s %12.3f %12.3f %12.3f %12.3f %12.3f\n", szName, total / g_stats.nCount,
+           stats_percentile(values, g_stats.nCount, 50), stats_percentile(values, g_stats.nCount, 95),
+           stats_percentile(values, g_stats.nCount, 99), values[g_stats.nCount - 1]);
+}
+
+static void stats_print() {
+    if (g_stats.nCount == 0) {
+        printf("ndshell: No processes have finished yet.\n");
+        return;
+    }
+    double* values = (double*) malloc(g_stats.nCount * sizeof(double));
+    if (values == NULL) {
+        fprintf(stderr, "ndshell: Out of memory for stats\n");
+        return;
+    }
+
+    int i;
+    int nFailed = 0, nSignalled = 0;
+    for (i = 0; i < g_stats.nCount; i++) {
+        int wstatus = g_stats.jobs[i].wstatus;
+        if (WIFSIGNALED(wstatus)) {
+            nSignalled++;
+        }
+        else if (WEXITSTATUS(wstatus) != 0) {
+            nFailed++;
+        }
+    }
+    printf("%d processes: %d succeeded, %d failed, %d killed by a signal\n",
+           g_stats.nCount, g_stats.nCount - nFailed - nSignalled, nFailed, nSignalled);
+    printf("%-22s %12s %12s %12s %12s %12s\n", "", "mean", "p50", "p95", "p99", "max");
+    stats_row("wall s", 0, values);
+    stats_row("user s", 1, values);
+    stats_row("sys s", 2, values);
+    stats_row("max RSS KiB", 3, values);
+    stats_row("voluntary switches", 4, values);
+    stats_row("involuntary switches", 5, values);
+    stats_row("minor faults", 6, values);
+    stats_row("major faults", 7, values);
+    free(values);
+
+    // wall time histogram
+    int buckets[STATS_BUCKETS] = {0};
+    int nLargest = 0;
+    int nFirst = STATS_BUCKETS, nLast = 0;
+    for (i = 0; i < g_stats.nCount; i++) {
+        int64_t us = g_stats.jobs[i].wallNs / 1000;
+        int nBucket = 0;
+        while (nBucket + 1 < STATS_BUCKETS && us >= (2LL << nBucket)) {
+            nBucket++;
+        }
+        buckets[nBucket]++;
+    }
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        if (buckets[i] > 0) {
+            nFirst = nFirst < i ? nFirst : i;
+            nLast = i;
+            nLargest = nLargest > buckets[i] ? nLargest : buckets[i];
+        }
+    }
+    printf("wall time\n");
+    for (i = nFirst; i <= nLast; i++) {
+        int nBar = (int) ((int64_t) buckets[i] * STATS_BAR_WIDTH / nLargest);
+        printf("  >= %10.6f s %8d |%.*s\n", (i ? 1LL << i : 0) / 1e6, buckets[i], nBar,
+               "########################################");
+    }
+    fflush(stdout);
+}
+
+static void stats_csv(char* szFile) {
+    FILE* pFile = fopen(szFile, "w");
+    if (pFile == NULL) {
+        fprintf(stderr, "ndshell: %s: %s\n", szFile, strerror(errno));
+        return;
+    }
+    fprintf(pFile, "pid,status,signal,wall_s,user_s,sys_s,max_rss_kib,voluntary_switches,involuntary_switches,minor_faults,major_faults,command\n");
+    int i;
+    for (i = 0; i < g_stats.nCount; i++) {
+        struct JobStats* pJob = &g_stats.jobs[i];
+        fprintf(pFile, "%d,%d,%d,%.6f,%.6f,%.6f,%ld,%ld,%ld,%ld,%ld,\"",
+                pJob->pid, WIFEXITED(pJob->wstatus) ? WEXITSTATUS(pJob->wstatus) : -1,
+                WIFSIGNALED(pJob->wstatus) ? WTERMSIG(pJob->wstatus) : 0,
+                pJob->wallNs / 1e9, pJob->user, pJob->sys, pJob->maxRssKiB,
+                pJob->nVoluntary, pJob->nInvoluntary, pJob->nMinorFaults, pJob->nMajorFaults);
+        // quotes inside the command are doubled, as CSV has it
+        char* p;
+        for (p = pJob->szCommand; *p != '\0'; p++) {
+            if (*p == '"') {
+                fputc('"', pFile);
+            }
+            fputc(*p, pFile);
+        }
+        fputs("\"\n", pFile);
+    }
+    if (fclose(pFile) != 0) {
+        fprintf(stderr, "ndshell: %s: %s\n", szFile, strerror(errno));
+        return;
+    }
+    printf("ndshell: Wrote %d processes to %s.\n", g_stats.nCount, szFile);
+}
+
+/* The stats command: "stats", "stats csv FILE" or "stats reset" */
+void stats_command(char** args) {
+    if (args[0] == NULL) {
+        stats_print();
+    }
+    else if (strcmp(args[0], "csv") == 0 && args[1] != NULL && args[2] == NULL) {
+        stats_csv(args[1]);
+    }
+    else if (strcmp(args[0], "reset") == 0 && args[1] == NULL) {
+        g_stats.nCount = 0;
+    }
+    else {
+        fprintf(stderr, "ndshell: Invalid stats command! Please enter stats, stats csv FILE or stats reset.\n");
+    }
+}
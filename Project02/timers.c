@@ -0,0 +1,167 @@
+/*
+timers.c - Time limits for bound jobs
+
+Every bound job's deadline sits in one min-heap, and a single timerfd
+(CLOCK_MONOTONIC, absolute time) is armed for the earliest. The event loop
+polls it with everything else, so any number of bound jobs costs no extra
+processes and no sleeping, and deadlines are kept to the nanosecond.
+
+When a deadline passes the job is sent its signal. With a grace period the
+first signal is SIGTERM and a second timer is set for the SIGKILL, which
+only goes out if the job has not exited by then. A job that exits before its
+deadline has its timer taken out of the heap when it is reaped, so a pid
+that is reused later is never signalled by mistake.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "ndshell.h"
+
+static struct TimerHeap g_timers;
+
+/* Swap two heap entries and tell their jobs where they went */
+static void timers_swap(int a, int b) {
+    struct BoundTimer temp = g_timers.timers[a];
+    g_timers.timers[a] = g_timers.timers[b];
+    g_timers.timers[b] = temp;
+    g_jobs.jobs[g_timers.timers[a].nSlot].nTimer = a;
+    g_jobs.jobs[g_timers.timers[b].nSlot].nTimer = b;
+}
+
+static void timers_up(int i) {
+    while (i > 0 && g_timers.timers[(i - 1) / 2].deadlineNs > g_timers.timers[i].deadlineNs) {
+        timers_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void timers_down(int i) {
+    while (1) {
+        int nSmallest = i;
+        int nLeft = 2 * i + 1;
+        int nRight = nLeft + 1;
+        if (nLeft < g_timers.nCount && g_timers.timers[nLeft].deadlineNs < g_timers.timers[nSmallest].deadlineNs) {
+            nSmallest = nLeft;
+        }
+        if (nRight < g_timers.nCount && g_timers.timers[nRight].deadlineNs < g_timers.timers[nSmallest].deadlineNs) {
+            nSmallest = nRight;
+        }
+        if (nSmallest == i) {
+            return;
+        }
+        timers_swap(i, nSmallest);
+        i = nSmallest;
+    }
+}
+
+/* Take entry i out of the heap */
+static void timers_delete(int i) {
+    g_jobs.jobs[g_timers.timers[i].nSlot].nTimer = -1;
+    g_timers.nCount--;
+    if (i == g_timers.nCount) {
+        return;
+    }
+    g_timers.timers[i] = g_timers.timers[g_timers.nCount];
+    g_jobs.jobs[g_timers.timers[i].nSlot].nTimer = i;
+    timers_up(i);
+    timers_down(i);
+}
+
+/* Point the timerfd at the earliest deadline, or disarm it */
+static void timers_arm() {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (g_timers.nCount > 0) {
+        int64_t deadline = g_timers.timers[0].deadlineNs;
+        its.it_value.tv_sec = deadline / NSEC_PER_SEC;
+        its.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+    }
+    timerfd_settime(g_timers.timerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+int timers_init() {
+    memset(&g_timers, 0, sizeof(g_timers));
+    g_timers.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return g_timers.timerFd < 0 ? -1 : 0;
+}
+
+int timers_fd() {
+    return g_timers.timerFd;
+}
+
+/* Signal job pid once limitNs has passed: SIGKILL, or SIGTERM and then
+   SIGKILL graceNs later if graceNs is above zero. Returns 0, or -1 if pid is
+   not a job or there was no memory. */
+int timers_add(pid_t pid, int64_t limitNs, int64_t graceNs) {
+    struct Job* pJob = jobs_find(&g_jobs, pid);
+    if (pJob == NULL) {
+        return -1;
+    }
+    if (pJob->nTimer >= 0) {
+        timers_delete(pJob->nTimer);
+    }
+    if (g_timers.nCount == g_timers.nCapacity) {
+        int nCapacity = g_timers.nCapacity ? g_timers.nCapacity * 2 : 64;
+        struct BoundTimer* timers = (struct BoundTimer*) realloc(g_timers.timers, nCapacity * sizeof(struct BoundTimer));
+        if (timers == NULL) {
+            return -1;
+        }
+        g_timers.timers = timers;
+        g_timers.nCapacity = nCapacity;
+    }
+
+    int i = g_timers.nCount++;
+    int64_t nowNs = now_ns();
+    // a limit near the largest allowed cannot wrap the deadline round to the past
+    g_timers.timers[i].deadlineNs = limitNs < INT64_MAX - nowNs ? nowNs + limitNs : INT64_MAX;
+    g_timers.timers[i].nSlot = jobs_id(&g_jobs, pJob) - 1;
+    g_timers.timers[i].nSignal = graceNs > 0 ? SIGTERM : SIGKILL;
+    g_timers.timers[i].graceNs = graceNs;
+    pJob->nTimer = i;
+    timers_up(i);
+    timers_arm();
+    return 0;
+}
+
+/* The job is gone; forget its timer if it has one */
+void timers_cancel(struct Job* pJob) {
+    if (pJob->nTimer >= 0) {
+        timers_delete(pJob->nTimer);
+        timers_arm();
+    }
+}
+
+/* The timerfd fired: signal every job whose time is up */
+void timers_expire() {
+    uint64_t nExpirations;
+    if (read(g_timers.timerFd, &nExpirations, sizeof(nExpirations)) < 0 && errno != EAGAIN) {
+        perror("ndshell: read");
+    }
+
+    int64_t now = now_ns();
+    while (g_timers.nCount > 0 && g_timers.timers[0].deadlineNs <= now) {
+        struct BoundTimer* pTimer = &g_timers.timers[0];
+        struct Job* pJob = &g_jobs.jobs[pTimer->nSlot];
+
+        kill(pJob->pid, pTimer->nSignal);
+        if (pTimer->nSignal == SIGTERM) {
+            printf("ndshell: Process %d ran out of time, sent SIGTERM\n", pJob->pid);
+            // it stays in the heap for the SIGKILL, in case it does not go quietly
+            pTimer->nSignal = SIGKILL;
+            pTimer->deadlineNs = pTimer->graceNs < INT64_MAX - now ? now + pTimer->graceNs : INT64_MAX;
+            timers_down(0);
+        }
+        else {
+            printf("ndshell: Process %d ran out of time, sent SIGKILL\n", pJob->pid);
+            timers_delete(0);
+        }
+    }
+    fflush(stdout);
+    timers_arm();
+}
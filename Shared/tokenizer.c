@@ -0,0 +1,190 @@
+/*
+tokenizer.c - Command line tokenizer
+
+Words are separated by spaces and tabs. Inside a word:
+
+    'single quotes'     keep everything up to the next ' exactly as it is
+    "double quotes"     keep everything up to the next ", except that \" and
+                        \\ stand for " and \
+    \c                  outside quotes, keeps c (a space, a quote, anything)
+
+and quoted and unquoted parts run together, so a"b c"d is the one word
+"ab cd". "" is an empty word. A quote left open or a \ at the very end is an
+error.
+
+The line is scanned once. Each word's text is copied into the arena as it
+is found, and since a word never takes more room than it did in the line
+(plus its '\0', which takes the place of the separator after it) the arena
+is sized for the whole line before scanning starts and never moves under the
+words already found. Lines may be any length.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tokenizer.h"
+
+/* Character classes for the scanning loop */
+#define CLASS_WORD      0
+#define CLASS_SPACE     1
+#define CLASS_SINGLE    2
+#define CLASS_DOUBLE    3
+#define CLASS_ESCAPE    4
+#define CLASS_END       5       /* newline and '\0' end the line */
+
+static unsigned char g_classes[256];
+
+static void tokenizer_classes() {
+    g_classes[' '] = CLASS_SPACE;
+    g_classes['\t'] = CLASS_SPACE;
+    g_classes['\r'] = CLASS_SPACE;
+    g_classes['\''] = CLASS_SINGLE;
+    g_classes['"'] = CLASS_DOUBLE;
+    g_classes['\\'] = CLASS_ESCAPE;
+    g_classes['\n'] = CLASS_END;
+    g_classes['\0'] = CLASS_END;
+}
+
+void tokenizer_init(struct Tokenizer* pTok) {
+    memset(pTok, 0, sizeof(struct Tokenizer));
+    if (g_classes['\n'] != CLASS_END) {
+        tokenizer_classes();
+    }
+}
+
+void tokenizer_free(struct Tokenizer* pTok) {
+    free(pTok->tokens);
+    free(pTok->quoted);
+    free(pTok->arena);
+    free(pTok->line);
+    memset(pTok, 0, sizeof(struct Tokenizer));
+}
+
+/* Room for one more word and the NULL after it. Returns 0, or -1 if there was no memory. */
+static int tokenizer_grow_tokens(struct Tokenizer* pTok) {
+    int nCapacity = pTok->nTokenCapacity ? pTok->nTokenCapacity * 2 : 16;
+    char** tokens = (char**) realloc(pTok->tokens, (nCapacity + 1) * sizeof(char*));
+    if (tokens == NULL) {
+        return -1;
+    }
+    pTok->tokens = tokens;
+    char* quoted = (char*) realloc(pTok->quoted, nCapacity + 1);
+    if (quoted == NULL) {
+        return -1;
+    }
+    pTok->quoted = quoted;
+    pTok->nTokenCapacity = nCapacity;
+    return 0;
+}
+
+/* Split nLength bytes of pLine; a newline or '\0' outside quotes ends it early.
+   Returns the number of words, or -1 with szError saying what was wrong;
+   tokens then holds the words found before the error. */
+int tokenizer_split(struct Tokenizer* pTok, const char* pLine, size_t nLength) {
+    pTok->nTokens = 0;
+    pTok->szError = NULL;
+    if (pTok->tokens == NULL && tokenizer_grow_tokens(pTok) != 0) {
+        pTok->szError = "out of memory";
+        return -1;
+    }
+    pTok->tokens[0] = NULL;
+    if (nLength + 1 > pTok->nArenaSize) {
+        size_t nSize = pTok->nArenaSize ? pTok->nArenaSize : 256;
+        while (nSize < nLength + 1) {
+            nSize *= 2;
+        }
+        char* arena = (char*) realloc(pTok->arena, nSize);
+        if (arena == NULL) {
+            pTok->szError = "out of memory";
+            return -1;
+        }
+        pTok->arena = arena;
+        pTok->nArenaSize = nSize;
+    }
+
+    const unsigned char* p = (const unsigned char*) pLine;
+    const unsigned char* pEnd = p + nLength;
+    char* pOut = pTok->arena;
+
+    while (1) {
+        // skip to the start of the next word
+        while (p < pEnd && g_classes[*p] == CLASS_SPACE) {
+            p++;
+        }
+        if (p == pEnd || g_classes[*p] == CLASS_END) {
+            break;
+        }
+
+        if (pTok->nTokens == pTok->nTokenCapacity && tokenizer_grow_tokens(pTok) != 0) {
+            pTok->szError = "out of memory";
+            return -1;
+        }
+        char* pWord = pOut;
+        char bQuoted = 0;
+
+        // copy the word, a run of plain characters at a time
+        while (p < pEnd) {
+            unsigned char nClass = g_classes[*p];
+            if (nClass == CLASS_WORD) {
+                *pOut++ = *p++;
+            }
+            else if (nClass == CLASS_SPACE || nClass == CLASS_END) {
+                break;
+            }
+            else if (nClass == CLASS_SINGLE) {
+                const unsigned char* pClose = memchr(p + 1, '\'', pEnd - p - 1);
+                if (pClose == NULL) {
+                    pTok->szError = "unterminated ' quote";
+                    return -1;
+                }
+                memcpy(pOut, p + 1, pClose - p - 1);
+                pOut += pClose - p - 1;
+                p = pClose + 1;
+                bQuoted = 1;
+            }
+            else if (nClass == CLASS_DOUBLE) {
+                p++;
+                while (p < pEnd && *p != '"') {
+                    if (*p == '\\' && p + 1 < pEnd && (p[1] == '"' || p[1] == '\\')) {
+                        p++;
+                    }
+                    *pOut++ = *p++;
+                }
+                if (p == pEnd) {
+                    pTok->szError = "unterminated \" quote";
+                    return -1;
+                }
+                p++;
+                bQuoted = 1;
+            }
+            else {
+                if (p + 1 == pEnd || g_classes[p[1]] == CLASS_END) {
+                    pTok->szError = "\\ at the end of the line";
+                    return -1;
+                }
+                *pOut++ = p[1];
+                p += 2;
+                bQuoted = 1;
+            }
+        }
+
+        *pOut++ = '\0';
+        pTok->quoted[pTok->nTokens] = bQuoted;
+        pTok->tokens[pTok->nTokens++] = pWord;
+    }
+
+    pTok->tokens[pTok->nTokens] = NULL;
+    pTok->quoted[pTok->nTokens] = 0;
+    return pTok->nTokens;
+}
+
+/* Read a whole line of any length from pFile into the tokenizer's own
+   buffer (pTok->line), without its newline. Returns its length, or -1 at
+   end of file. */
+ssize_t tokenizer_read_line(struct Tokenizer* pTok, FILE* pFile) {
+    ssize_t nLength = getline(&pTok->line, &pTok->nLineSize, pFile);
+    if (nLength > 0 && pTok->line[nLength - 1] == '\n') {
+        pTok->line[--nLength] = '\0';
+    }
+    return nLength;
+}
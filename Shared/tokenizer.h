@@ -0,0 +1,30 @@
+/* tokenizer.h : Command line tokenizer shared by singleshell, chime and ndshell */
+
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/* One line split into words. Everything it hands out lives in buffers it
+   owns and reuses: they grow to fit the longest line seen and are never
+   shrunk, so once warmed up splitting a line allocates nothing. The words
+   are only good until the next split. */
+struct Tokenizer {
+    char**      tokens;         /* argv style, tokens[nTokens] is NULL */
+    char*       quoted;         /* quoted[i] is 1 if any of word i was quoted or escaped */
+    int         nTokens;
+    int         nTokenCapacity;
+    char*       arena;          /* the words' text, each ending in '\0' */
+    size_t      nArenaSize;
+    char*       line;           /* for tokenizer_read_line */
+    size_t      nLineSize;
+    const char* szError;        /* why the last split failed */
+};
+
+void    tokenizer_init(struct Tokenizer* pTok);
+void    tokenizer_free(struct Tokenizer* pTok);
+int     tokenizer_split(struct Tokenizer* pTok, const char* pLine, size_t nLength);
+ssize_t tokenizer_read_line(struct Tokenizer* pTok, FILE* pFile);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+tokenizer_bench.c - Throughput and fuzz harness for tokenizer.c
+
+With no -fuzz, splits myscript-style command lines (a file of them if one is
+given, else a built-in mix of plain, quoted and piped commands) over and over
+and reports lines and megabytes per second, next to the strtok loop the
+shells used before as a baseline.
+
+With -fuzz, first checks a table of lines with known splits, then feeds the
+tokenizer random lines heavy in quotes, backslashes and spaces, and checks
+two things about every one that splits: quoting each word back up and
+splitting the result gives the same words, and nothing was written outside
+the words. Build it with -fsanitize=address,undefined to catch the rest:
+
+    make tokenizer_bench CFLAGS="-Wall -fsanitize=address,undefined"
+
+Usage: ./tokenizer_bench [lines] [script]
+       ./tokenizer_bench -fuzz [iterations] [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tokenizer.h"
+
+#define DEFAULT_LINES       10000000
+#define DEFAULT_ITERATIONS  1000000
+#define FUZZ_MAX_LENGTH     200
+
+static char* g_szDefaultScript[] = {
+    "start sleep 1",
+    "wait",
+    "run ls -la /tmp",
+    "bound 2.5 sh -c \"sleep 1; echo done\"",
+    "run sort < in.txt | uniq -c | sort -rn > out.txt",
+    "start echo 'a | b' \"c > d\" e\\ f",
+    "waitfor %3",
+    "chime 2 0.25",
+    "run cpus=0-3 mem=512M nice=10 ./fractal -n 8 -m 2000 -o out.bmp",
+    "",
+};
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* The old way, for comparison: strtok on a copy, no quotes */
+static int split_strtok(char* szCopy, const char* szLine, char** tokens, int nMax) {
+    strcpy(szCopy, szLine);
+    int nTokens = 0;
+    char* split = strtok(szCopy, " ");
+    while (split != NULL && nTokens < nMax) {
+        tokens[nTokens++] = split;
+        split = strtok(NULL, " ");
+    }
+    tokens[nTokens] = NULL;
+    return nTokens;
+}
+
+static int bench(long nLines, char* szScript) {
+    char** lines = g_szDefaultScript;
+    int nScript = sizeof(g_szDefaultScript) / sizeof(g_szDefaultScript[0]);
+    struct Tokenizer tok;
+    tokenizer_init(&tok);
+
+    // a script file is read into memory first, so only the splitting is timed
+    if (szScript != NULL) {
+        FILE* pFile = fopen(szScript, "r");
+        if (pFile == NULL) {
+            perror(szScript);
+            return 1;
+        }
+        lines = NULL;
+        nScript = 0;
+        while (tokenizer_read_line(&tok, pFile) >= 0) {
+            lines = (char**) realloc(lines, (nScript + 1) * sizeof(char*));
+            lines[nScript++] = strdup(tok.line);
+        }
+        fclose(pFile);
+        if (nScript == 0) {
+            fprintf(stderr, "tokenizer_bench: %s is empty\n", szScript);
+            return 1;
+        }
+    }
+
+    size_t* lengths = (size_t*) malloc(nScript * sizeof(size_t));
+    size_t nLongest = 0;
+    int i;
+    for (i = 0; i < nScript; i++) {
+        lengths[i] = strlen(lines[i]);
+        nLongest = lengths[i] > nLongest ? lengths[i] : nLongest;
+    }
+
+    long n;
+    long nWords = 0;
+    size_t nBytes = 0;
+    double start = now_s();
+    for (n = 0; n < nLines; n++) {
+        int nLine = (int) (n % nScript);
+        int nTokens = tokenizer_split(&tok, lines[nLine], lengths[nLine]);
+        nWords += nTokens > 0 ? nTokens : 0;
+        nBytes += lengths[nLine] + 1;
+    }
+    double elapsed = now_s() - start;
+
+    char* szCopy = (char*) malloc(nLongest + 1);
+    char** tokens = (char**) malloc((nLongest / 2 + 2) * sizeof(char*));
+    long nOldWords = 0;
+    start = now_s();
+    for (n = 0; n < nLines; n++) {
+        nOldWords += split_strtok(szCopy, lines[n % nScript], tokens, nLongest / 2 + 1);
+    }
+    double old = now_s() - start;
+
+    printf("tokenizer  %10ld lines %8.3f s %8.2f M lines/s %8.1f MB/s  (%ld words)\n",
+           nLines, elapsed, nLines / elapsed / 1e6, nBytes / elapsed / 1e6, nWords);
+    printf("strtok     %10ld lines %8.3f s %8.2f M lines/s %8.1f MB/s  (%ld words, no quotes)\n",
+           nLines, old, nLines / old / 1e6, nBytes / old / 1e6, nOldWords);
+    tokenizer_free(&tok);
+    return 0;
+}
+
+/* Lines whose splits are known, words separated by | in the expected column */
+static char* g_szCases[][2] = {
+    {"", ""},
+    {"   \t ", ""},
+    {"a", "a"},
+    {"  start   sleep  1  ", "start|sleep|1"},
+    {"echo 'a | b'", "echo|a | b"},
+    {"echo \"c > d\" e\\ f", "echo|c > d|e f"},
+    {"a\"b c\"d", "ab cd"},
+    {"'' \"\"", "|"},
+    {"\"\\\"\\\\\\n\"", "\"\\\\n"},
+    {"'\\'", "\\"},
+    {"a\\'b", "a'b"},
+    {"x\ny", "x"},
+    {"tab\tsep\r", "tab|sep"},
+};
+
+/* Split szLine and join the words with | */
+static const char* split_joined(struct Tokenizer* pTok, const char* szLine, char* szOut) {
+    if (tokenizer_split(pTok, szLine, strlen(szLine)) < 0) {
+        return pTok->szError;
+    }
+    int i;
+    szOut[0] = '\0';
+    for (i = 0; i < pTok->nTokens; i++) {
+        strcat(szOut, i ? "|" : "");
+        strcat(szOut, pTok->tokens[i]);
+    }
+    return NULL;
+}
+
+/* Append szWord to szOut in single quotes, with each ' written as '\'' */
+static char* quote_word(char* pOut, const char* szWord) {
+    *pOut++ = '\'';
+    for (; *szWord != '\0'; szWord++) {
+        if (*szWord == '\'') {
+            memcpy(pOut, "'\\''", 4);
+            pOut += 4;
+        }
+        else {
+            *pOut++ = *szWord;
+        }
+    }
+    *pOut++ = '\'';
+    *pOut++ = ' ';
+    return pOut;
+}
+
+static int fuzz(long nIterations, unsigned int nSeed) {
+    static const char szAlphabet[] = "ab |<>'\"\\\\\\  \t'\"";
+    struct Tokenizer tok, tok2;
+    char szOut[FUZZ_MAX_LENGTH * 8];
+    int nFailures = 0;
+    size_t i;
+    tokenizer_init(&tok);
+    tokenizer_init(&tok2);
+
+    for (i = 0; i < sizeof(g_szCases) / sizeof(g_szCases[0]); i++) {
+        const char* szError = split_joined(&tok, g_szCases[i][0], szOut);
+        if (szError != NULL || strcmp(szOut, g_szCases[i][1]) != 0) {
+            printf("FAIL: [%s] split as [%s], expected [%s]\n", g_szCases[i][0], szError ? szError : szOut, g_szCases[i][1]);
+            nFailures++;
+        }
+    }
+    char* szBad[] = {"'open", "\"open", "end\\", "ok 'a' \"b"};
+    for (i = 0; i < sizeof(szBad) / sizeof(szBad[0]); i++) {
+        if (tokenizer_split(&tok, szBad[i], strlen(szBad[i])) >= 0) {
+            printf("FAIL: [%s] split when it should not have\n", szBad[i]);
+            nFailures++;
+        }
+    }
+
+    srand(nSeed);
+    long n, nSplit = 0;
+    char szLine[FUZZ_MAX_LENGTH + 1];
+    for (n = 0; n < nIterations && nFailures < 10; n++) {
+        int nLength = rand() % (FUZZ_MAX_LENGTH + 1);
+        int j;
+        for (j = 0; j < nLength; j++) {
+            // mostly the characters that matter, now and then any byte but '\0' and newline
+            szLine[j] = rand() % 8 ? szAlphabet[rand() % (sizeof(szAlphabet) - 1)] : (char) (rand() % 254 + 1);
+            if (szLine[j] == '\n') {
+                szLine[j] = 'n';
+            }
+        }
+        szLine[nLength] = '\0';
+
+        if (tokenizer_split(&tok, szLine, nLength) < 0) {
+            continue;
+        }
+        nSplit++;
+
+        // every word lies inside the arena, in order, each ending where the next starts or earlier
+        for (j = 0; j < tok.nTokens; j++) {
+            char* pWord = tok.tokens[j];
+            if (pWord < tok.arena || pWord + strlen(pWord) >= tok.arena + nLength + 1
+                || (j > 0 && pWord <= tok.tokens[j - 1] + strlen(tok.tokens[j - 1]))) {
+                printf("FAIL: [%s] word %d is outside the arena\n", szLine, j);
+                nFailures++;
+            }
+        }
+
+        // quote the words back up and split again: the words must come back the same
+        char* pOut = szOut;
+        for (j = 0; j < tok.nTokens; j++) {
+            pOut = quote_word(pOut, tok.tokens[j]);
+        }
+        *pOut = '\0';
+        if (tokenizer_split(&tok2, szOut, pOut - szOut) != tok.nTokens) {
+            printf("FAIL: [%s] requoted as [%s] split into %d words, not %d\n", szLine, szOut, tok2.nTokens, tok.nTokens);
+            nFailures++;
+            continue;
+        }
+        for (j = 0; j < tok.nTokens; j++) {
+            if (strcmp(tok.tokens[j], tok2.tokens[j]) != 0 || !tok2.quoted[j]) {
+                printf("FAIL: [%s] word %d came back as [%s], not [%s]\n", szLine, j, tok2.tokens[j], tok.tokens[j]);
+                nFailures++;
+            }
+        }
+    }
+
+    printf("%ld random lines, %ld split, %d failures\n", n, nSplit, nFailures);
+    tokenizer_free(&tok);
+    tokenizer_free(&tok2);
+    return nFailures ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "-fuzz") == 0) {
+        long nIterations = argc > 2 ? atol(argv[2]) : DEFAULT_ITERATIONS;
+        unsigned int nSeed = argc > 3 ? (unsigned int) atol(argv[3]) : (unsigned int) time(NULL);
+        printf("seed %u\n", nSeed);
+        return fuzz(nIterations, nSeed);
+    }
+    long nLines = argc > 1 ? atol(argv[1]) : DEFAULT_LINES;
+    if (nLines <= 0) {
+        fprintf(stderr, "Usage: %s [lines] [script]\n       %s -fuzz [iterations] [seed]\n", argv[0], argv[0]);
+        return 1;
+    }
+    return bench(nLines, argc > 2 ? argv[2] : NULL);
+}